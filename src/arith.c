@@ -0,0 +1,839 @@
+// arith.c
+#include "psh.h"
+
+// Shell arithmetic: 64-bit integers with the C operators, as used by $(( )), (( )) and
+// for (( ; ; )). An expression is parsed once into a flat tree of nodes and the result is
+// cached by its text, so an expression inside a loop is only parsed on the first pass.
+
+#define A_NUM 0      // value
+#define A_VAR 1      // name
+#define A_NEG 2      // -a
+#define A_NOT 3      // !a
+#define A_BITNOT 4   // ~a
+#define A_PREINC 5   // ++name
+#define A_PREDEC 6   // --name
+#define A_POSTINC 7  // name++
+#define A_POSTDEC 8  // name--
+#define A_BINARY 9   // a binop b, binop in `sub`
+#define A_AND 10     // a && b
+#define A_OR 11      // a || b
+#define A_COND 12    // a ? b : c
+#define A_ASSIGN 13  // name = b, or name binop= b with binop in `sub`
+#define A_COMMA 14   // a, b
+
+// Binary operators, in A_BINARY nodes and compound assignments
+#define B_MUL 0
+#define B_DIV 1
+#define B_MOD 2
+#define B_ADD 3
+#define B_SUB 4
+#define B_SHL 5
+#define B_SHR 6
+#define B_LT 7
+#define B_LE 8
+#define B_GT 9
+#define B_GE 10
+#define B_EQ 11
+#define B_NE 12
+#define B_BITAND 13
+#define B_BITXOR 14
+#define B_BITOR 15
+#define B_POW 16
+
+typedef struct ArithNode
+{
+    int op;        // A_*
+    int sub;       // B_* of A_BINARY and compound A_ASSIGN, -1 for plain `=`
+    int a, b, c;   // operands, indexes into Arith.nodes
+    int64_t value; // A_NUM
+    char *name;    // A_VAR, A_ASSIGN and the increments
+} ArithNode;
+
+typedef struct Arith
+{
+    ArithNode *nodes;
+    int n;
+    int cap;
+    int root;
+} Arith;
+
+// Binary operators by spelling, longest first so `<<` wins over `<`. `prec` is the
+// binding strength, higher binds tighter.
+static const struct
+{
+    const char *text;
+    int op;
+    int prec;
+} binary_ops[] = {
+    {"**", B_POW, 11}, {"<<", B_SHL, 8}, {">>", B_SHR, 8}, {"<=", B_LE, 7}, {">=", B_GE, 7},
+    {"==", B_EQ, 6},   {"!=", B_NE, 6},  {"*", B_MUL, 10}, {"/", B_DIV, 10}, {"%", B_MOD, 10},
+    {"+", B_ADD, 9},   {"-", B_SUB, 9},  {"<", B_LT, 7},   {">", B_GT, 7},   {"&", B_BITAND, 5},
+    {"^", B_BITXOR, 4}, {"|", B_BITOR, 3},
+};
+
+#define PREC_OR 1
+#define PREC_AND 2
+
+typedef struct ArithParser
+{
+    const char *expr; // the whole expression, for messages
+    const char *p;
+    Arith *ar;
+    int failed;
+} ArithParser;
+
+// Parsed expressions by text. Only expressions written in the script without expansions
+// are cached, never expanded text, variable values or bare numbers, so it stays bounded by
+// the script; the cap guards against generated scripts anyway.
+#define ARITH_CACHE_SIZE 256
+#define ARITH_CACHE_MAX 4096
+
+typedef struct ArithEntry
+{
+    char *text;
+    Arith *arith;
+    struct ArithEntry *next;
+} ArithEntry;
+
+static ArithEntry *arith_cache[ARITH_CACHE_SIZE];
+static int arith_cached = 0;
+static int arith_nesting = 0; // variables holding expressions are evaluated recursively
+
+static int add_node(ArithParser *ap, int op)
+{
+    Arith *ar = ap->ar;
+    if (ar->n == ar->cap)
+    {
+        ar->cap = ar->cap ? ar->cap * 2 : 8;
+        ar->nodes = realloc(ar->nodes, ar->cap * sizeof(ArithNode));
+        if (!ar->nodes)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ar->nodes[ar->n] = (ArithNode){op, -1, -1, -1, -1, 0, NULL};
+    return ar->n++;
+}
+
+static void skip_space(ArithParser *ap)
+{
+    while (isspace((unsigned char)*ap->p))
+    {
+        ap->p++;
+    }
+}
+
+static int arith_error(ArithParser *ap)
+{
+    if (!ap->failed)
+    {
+        fprintf(stderr, "psh: %s: syntax error in expression (error token is \"%s\")\n", ap->expr,
+                *ap->p ? ap->p : ap->expr);
+        ap->failed = 1;
+    }
+    return -1;
+}
+
+// Integer constant: decimal, 0x hex, 0 octal or base#digits with a base up to 64.
+// Returns 0 and advances *p, or -1 when the text is not a valid number.
+static int parse_number(const char **p, int64_t *out)
+{
+    const char *s = *p;
+    uint64_t value = 0;
+    int base = 10;
+
+    if (!isdigit((unsigned char)*s))
+    {
+        return -1;
+    }
+    const char *hash_sign = s + strspn(s, "0123456789");
+    if (*hash_sign == '#')
+    {
+        base = atoi(s);
+        if (base < 2 || base > 64)
+        {
+            return -1;
+        }
+        s = hash_sign + 1;
+    }
+    else if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+    {
+        base = 16;
+        s += 2;
+    }
+    else if (s[0] == '0')
+    {
+        base = 8;
+    }
+
+    const char *digits_start = s;
+    while (1)
+    {
+        int digit;
+        char c = *s;
+        if (isdigit((unsigned char)c))
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'Z')
+        {
+            // bases up to 36 are case-insensitive, above that capitals come after the small letters
+            digit = base <= 36 ? c - 'A' + 10 : c - 'A' + 36;
+        }
+        else if (c == '@' || c == '_')
+        {
+            digit = c == '@' ? 62 : 63;
+        }
+        else
+        {
+            break;
+        }
+        if (digit >= base)
+        {
+            return -1;
+        }
+        value = value * base + digit;
+        s++;
+    }
+    if (s == digits_start && base != 8)
+    {
+        return -1;
+    }
+    if (isalnum((unsigned char)*s) || *s == '_')
+    {
+        return -1;
+    }
+    *out = (int64_t)value;
+    *p = s;
+    return 0;
+}
+
+static int is_name_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int parse_comma(ArithParser *ap);
+static int parse_assign(ArithParser *ap);
+
+// Advances past a variable name and an optional [subscript], which var_get() resolves
+static void skip_name(ArithParser *ap)
+{
+    while (isalnum((unsigned char)*ap->p) || *ap->p == '_')
+    {
+        ap->p++;
+    }
+    if (*ap->p == '[')
+    {
+        int depth = 0;
+        const char *s = ap->p;
+        do
+        {
+            depth += (*s == '[') - (*s == ']');
+            s++;
+        } while (depth > 0 && *s != '\0');
+        if (depth == 0)
+        {
+            ap->p = s;
+        }
+    }
+}
+
+static int parse_unary(ArithParser *ap)
+{
+    skip_space(ap);
+    const char *s = ap->p;
+
+    if ((s[0] == '+' || s[0] == '-') && s[1] == s[0])
+    {
+        // ++name / --name
+        ap->p += 2;
+        skip_space(ap);
+        const char *name = ap->p;
+        if (!is_name_start(*name))
+        {
+            return arith_error(ap);
+        }
+        skip_name(ap);
+        int node = add_node(ap, s[0] == '+' ? A_PREINC : A_PREDEC);
+        ap->ar->nodes[node].name = strndup(name, ap->p - name);
+        return node;
+    }
+    if (s[0] == '-' || s[0] == '+' || s[0] == '!' || s[0] == '~')
+    {
+        ap->p++;
+        int operand = parse_unary(ap);
+        if (operand < 0 || s[0] == '+')
+        {
+            return operand;
+        }
+        int node = add_node(ap, s[0] == '-' ? A_NEG : s[0] == '!' ? A_NOT : A_BITNOT);
+        ap->ar->nodes[node].a = operand;
+        return node;
+    }
+
+    int node;
+    if (*s == '(')
+    {
+        ap->p++;
+        node = parse_comma(ap);
+        skip_space(ap);
+        if (node < 0 || *ap->p != ')')
+        {
+            return arith_error(ap);
+        }
+        ap->p++;
+    }
+    else if (isdigit((unsigned char)*s))
+    {
+        int64_t value;
+        if (parse_number(&ap->p, &value) == -1)
+        {
+            return arith_error(ap);
+        }
+        node = add_node(ap, A_NUM);
+        ap->ar->nodes[node].value = value;
+    }
+    else if (is_name_start(*s))
+    {
+        skip_name(ap);
+        node = add_node(ap, A_VAR);
+        ap->ar->nodes[node].name = strndup(s, ap->p - s);
+
+        skip_space(ap);
+        if ((ap->p[0] == '+' || ap->p[0] == '-') && ap->p[1] == ap->p[0])
+        {
+            ap->ar->nodes[node].op = ap->p[0] == '+' ? A_POSTINC : A_POSTDEC;
+            ap->p += 2;
+        }
+    }
+    else
+    {
+        return arith_error(ap);
+    }
+    return node;
+}
+
+// Binary operators binding at least as tight as min_prec, by precedence climbing
+static int parse_binary(ArithParser *ap, int min_prec)
+{
+    int left = parse_unary(ap);
+    while (left >= 0)
+    {
+        skip_space(ap);
+        const char *s = ap->p;
+        int op = -1, prec = -1;
+        size_t len = 0;
+
+        if (s[0] == '|' && s[1] == '|')
+        {
+            op = A_OR, prec = PREC_OR, len = 2;
+        }
+        else if (s[0] == '&' && s[1] == '&')
+        {
+            op = A_AND, prec = PREC_AND, len = 2;
+        }
+        else
+        {
+            for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++)
+            {
+                size_t n = strlen(binary_ops[i].text);
+                if (strncmp(s, binary_ops[i].text, n) == 0)
+                {
+                    op = binary_ops[i].op, prec = binary_ops[i].prec, len = n;
+                    break;
+                }
+            }
+            // `a += 1` is an assignment, not `a +` followed by `= 1`
+            if (op >= 0 && s[len] == '=' && op != B_LE && op != B_GE && op != B_EQ && op != B_NE)
+            {
+                op = -1;
+            }
+        }
+        if (op < 0 || prec < min_prec)
+        {
+            break;
+        }
+        ap->p += len;
+
+        // ** is right-associative, everything else groups to the left
+        int right = parse_binary(ap, op == B_POW ? prec : prec + 1);
+        if (right < 0)
+        {
+            return -1;
+        }
+        int node;
+        if (prec == PREC_OR || prec == PREC_AND)
+        {
+            node = add_node(ap, op);
+        }
+        else
+        {
+            node = add_node(ap, A_BINARY);
+            ap->ar->nodes[node].sub = op;
+        }
+        ap->ar->nodes[node].a = left;
+        ap->ar->nodes[node].b = right;
+        left = node;
+    }
+    return left;
+}
+
+static int parse_conditional(ArithParser *ap)
+{
+    int cond = parse_binary(ap, PREC_OR);
+    skip_space(ap);
+    if (cond < 0 || *ap->p != '?')
+    {
+        return cond;
+    }
+    ap->p++;
+    int then = parse_assign(ap);
+    skip_space(ap);
+    if (then < 0 || *ap->p != ':')
+    {
+        return arith_error(ap);
+    }
+    ap->p++;
+    int otherwise = parse_conditional(ap);
+    if (otherwise < 0)
+    {
+        return -1;
+    }
+    int node = add_node(ap, A_COND);
+    ap->ar->nodes[node].a = cond;
+    ap->ar->nodes[node].b = then;
+    ap->ar->nodes[node].c = otherwise;
+    return node;
+}
+
+// Length of the assignment operator at s and its binary part (-1 for `=`), 0 if none
+static size_t assign_op(const char *s, int *sub)
+{
+    if (s[0] == '=' && s[1] != '=')
+    {
+        *sub = -1;
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++)
+    {
+        size_t n = strlen(binary_ops[i].text);
+        int op = binary_ops[i].op;
+        if (op == B_POW || op == B_LE || op == B_GE || op == B_EQ || op == B_NE || op == B_LT || op == B_GT)
+        {
+            continue;
+        }
+        if (strncmp(s, binary_ops[i].text, n) == 0 && s[n] == '=')
+        {
+            *sub = op;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_assign(ArithParser *ap)
+{
+    int left = parse_conditional(ap);
+    if (left < 0)
+    {
+        return -1;
+    }
+    skip_space(ap);
+    int sub;
+    size_t len = assign_op(ap->p, &sub);
+    if (len == 0)
+    {
+        return left;
+    }
+    if (ap->ar->nodes[left].op != A_VAR)
+    {
+        if (!ap->failed)
+        {
+            fprintf(stderr, "psh: %s: attempted assignment to non-variable (error token is \"%s\")\n", ap->expr,
+                    ap->p);
+            ap->failed = 1;
+        }
+        return -1;
+    }
+    ap->p += len;
+    int right = parse_assign(ap);
+    if (right < 0)
+    {
+        return -1;
+    }
+    // the variable node turns into the assignment, it already owns the name
+    ArithNode *node = &ap->ar->nodes[left];
+    node->op = A_ASSIGN;
+    node->sub = sub;
+    node->b = right;
+    return left;
+}
+
+static int parse_comma(ArithParser *ap)
+{
+    int left = parse_assign(ap);
+    skip_space(ap);
+    while (left >= 0 && *ap->p == ',')
+    {
+        ap->p++;
+        int right = parse_assign(ap);
+        if (right < 0)
+        {
+            return -1;
+        }
+        int node = add_node(ap, A_COMMA);
+        ap->ar->nodes[node].a = left;
+        ap->ar->nodes[node].b = right;
+        left = node;
+        skip_space(ap);
+    }
+    return left;
+}
+
+static void arith_free(Arith *ar)
+{
+    for (int i = 0; i < ar->n; i++)
+    {
+        free(ar->nodes[i].name);
+    }
+    free(ar->nodes);
+    free(ar);
+}
+
+// Parses an expression, NULL after reporting a syntax error. An empty expression is 0.
+static Arith *arith_compile(const char *expr)
+{
+    Arith *ar = calloc(1, sizeof(Arith));
+    if (!ar)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    ArithParser ap = {expr, expr, ar, 0};
+
+    skip_space(&ap);
+    if (*ap.p == '\0')
+    {
+        ar->root = add_node(&ap, A_NUM);
+        return ar;
+    }
+    ar->root = parse_comma(&ap);
+    skip_space(&ap);
+    if (ar->root >= 0 && *ap.p != '\0')
+    {
+        arith_error(&ap);
+        ar->root = -1;
+    }
+    if (ar->root < 0)
+    {
+        arith_free(ar);
+        return NULL;
+    }
+    return ar;
+}
+
+static int binary(int op, int64_t l, int64_t r, int64_t *out, const char *expr)
+{
+    // + - * ** wrap around like the machine does instead of overflowing into undefined behaviour
+    switch (op)
+    {
+    case B_MUL:
+        *out = (int64_t)((uint64_t)l * (uint64_t)r);
+        break;
+    case B_ADD:
+        *out = (int64_t)((uint64_t)l + (uint64_t)r);
+        break;
+    case B_SUB:
+        *out = (int64_t)((uint64_t)l - (uint64_t)r);
+        break;
+    case B_DIV:
+    case B_MOD:
+        if (r == 0)
+        {
+            fprintf(stderr, "psh: %s: division by 0\n", expr);
+            return -1;
+        }
+        if (r == -1)
+        {
+            // INT64_MIN / -1 traps on x86
+            *out = op == B_DIV ? (int64_t)(0 - (uint64_t)l) : 0;
+            break;
+        }
+        *out = op == B_DIV ? l / r : l % r;
+        break;
+    case B_SHL:
+        *out = (int64_t)((uint64_t)l << (r & 63));
+        break;
+    case B_SHR:
+        *out = l >> (r & 63);
+        break;
+    case B_LT:
+        *out = l < r;
+        break;
+    case B_LE:
+        *out = l <= r;
+        break;
+    case B_GT:
+        *out = l > r;
+        break;
+    case B_GE:
+        *out = l >= r;
+        break;
+    case B_EQ:
+        *out = l == r;
+        break;
+    case B_NE:
+        *out = l != r;
+        break;
+    case B_BITAND:
+        *out = l & r;
+        break;
+    case B_BITXOR:
+        *out = l ^ r;
+        break;
+    case B_BITOR:
+        *out = l | r;
+        break;
+    case B_POW:
+    {
+        if (r < 0)
+        {
+            fprintf(stderr, "psh: %s: exponent less than 0\n", expr);
+            return -1;
+        }
+        uint64_t result = 1, base = (uint64_t)l;
+        for (; r > 0; r >>= 1)
+        {
+            if (r & 1)
+            {
+                result *= base;
+            }
+            base *= base;
+        }
+        *out = (int64_t)result;
+        break;
+    }
+    }
+    return 0;
+}
+
+// Numeric value of a variable. Unset or empty is 0, and a value that is itself an
+// expression is evaluated, as in `a=b+1; echo $((a))`.
+static int var_value(const char *name, int64_t *out)
+{
+    if (var_get_number(name, out) == 0)
+    {
+        return 0; // declare -i, no text involved
+    }
+    const char *value = var_get(name);
+    if (value == NULL)
+    {
+        *out = 0;
+        return 0;
+    }
+    const char *s = value;
+    while (isspace((unsigned char)*s))
+    {
+        s++;
+    }
+    int negative = *s == '-';
+    s += *s == '-' || *s == '+';
+    if (*s == '\0' && s == value)
+    {
+        *out = 0;
+        return 0;
+    }
+    int64_t number;
+    const char *end = s;
+    if (parse_number(&end, &number) == 0)
+    {
+        while (isspace((unsigned char)*end))
+        {
+            end++;
+        }
+        if (*end == '\0')
+        {
+            *out = negative ? (int64_t)(0 - (uint64_t)number) : number;
+            return 0;
+        }
+    }
+    if (arith_nesting >= 64)
+    {
+        fprintf(stderr, "psh: %s: expression recursion level exceeded\n", value);
+        return -1;
+    }
+    arith_nesting++;
+    int ret = arith_eval(value, out);
+    arith_nesting--;
+    return ret;
+}
+
+static int eval(const Arith *ar, int at, int64_t *out, const char *expr)
+{
+    const ArithNode *node = &ar->nodes[at];
+    int64_t a, b;
+
+    switch (node->op)
+    {
+    case A_NUM:
+        *out = node->value;
+        return 0;
+    case A_VAR:
+        return var_value(node->name, out);
+    case A_NEG:
+    case A_NOT:
+    case A_BITNOT:
+        if (eval(ar, node->a, &a, expr) == -1)
+        {
+            return -1;
+        }
+        *out = node->op == A_NEG ? (int64_t)(0 - (uint64_t)a) : node->op == A_NOT ? !a : ~a;
+        return 0;
+    case A_PREINC:
+    case A_PREDEC:
+    case A_POSTINC:
+    case A_POSTDEC:
+    {
+        if (var_value(node->name, &a) == -1)
+        {
+            return -1;
+        }
+        int up = node->op == A_PREINC || node->op == A_POSTINC;
+        b = (int64_t)((uint64_t)a + (up ? 1 : (uint64_t)-1));
+        var_set_number(node->name, b);
+        *out = node->op == A_PREINC || node->op == A_PREDEC ? b : a;
+        return 0;
+    }
+    case A_BINARY:
+        if (eval(ar, node->a, &a, expr) == -1 || eval(ar, node->b, &b, expr) == -1)
+        {
+            return -1;
+        }
+        return binary(node->sub, a, b, out, expr);
+    case A_AND:
+    case A_OR:
+        if (eval(ar, node->a, &a, expr) == -1)
+        {
+            return -1;
+        }
+        if ((node->op == A_AND) == (a == 0))
+        {
+            // short circuit, the right side is not evaluated
+            *out = node->op == A_OR;
+            return 0;
+        }
+        if (eval(ar, node->b, &b, expr) == -1)
+        {
+            return -1;
+        }
+        *out = b != 0;
+        return 0;
+    case A_COND:
+        if (eval(ar, node->a, &a, expr) == -1)
+        {
+            return -1;
+        }
+        return eval(ar, a != 0 ? node->b : node->c, out, expr);
+    case A_ASSIGN:
+        if (eval(ar, node->b, &b, expr) == -1)
+        {
+            return -1;
+        }
+        if (node->sub >= 0 && (var_value(node->name, &a) == -1 || binary(node->sub, a, b, &b, expr) == -1))
+        {
+            return -1;
+        }
+        var_set_number(node->name, b);
+        *out = b;
+        return 0;
+    case A_COMMA:
+        if (eval(ar, node->a, &a, expr) == -1)
+        {
+            return -1;
+        }
+        return eval(ar, node->b, out, expr);
+    }
+    return -1;
+}
+
+// A bare integer, which compiles to a single node and would only crowd out real entries
+static int is_number(const char *expr)
+{
+    const char *p = expr + strspn(expr, " \t\n");
+    p += (*p == '-' || *p == '+');
+    if (!isdigit((unsigned char)*p))
+    {
+        return 0;
+    }
+    p += strspn(p, "0123456789");
+    return p[strspn(p, " \t\n")] == '\0';
+}
+
+// Compiles and evaluates `expr`, remembering the parse when `cache` is set
+static int arith_run(const char *expr, int64_t *result, int cache)
+{
+    unsigned int index = hash(expr, ARITH_CACHE_SIZE);
+    ArithEntry *entry = arith_cache[index];
+    while (entry != NULL && strcmp(entry->text, expr) != 0)
+    {
+        entry = entry->next;
+    }
+
+    if (entry != NULL)
+    {
+        return eval(entry->arith, entry->arith->root, result, expr);
+    }
+
+    Arith *ar = arith_compile(expr);
+    if (ar == NULL)
+    {
+        return -1;
+    }
+    int ret = eval(ar, ar->root, result, expr);
+    if (cache && arith_cached < ARITH_CACHE_MAX)
+    {
+        entry = malloc(sizeof(ArithEntry));
+        if (!entry)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        entry->text = strdup(expr);
+        entry->arith = ar;
+        entry->next = arith_cache[index];
+        arith_cache[index] = entry;
+        arith_cached++;
+    }
+    else
+    {
+        arith_free(ar);
+    }
+    return ret;
+}
+
+// Evaluates an expression that needs no further expansion, such as a variable's value.
+// Returns -1 after reporting an error.
+int arith_eval(const char *expr, int64_t *result)
+{
+    return arith_run(expr, result, 0);
+}
+
+// Evaluates an expression as written in the script: $parameters and quotes are expanded
+// first, which makes the text differ between runs, so only plain expressions are cached.
+int arith_expand(const char *expr, int64_t *result)
+{
+    if (strpbrk(expr, "$'\"\\`") == NULL)
+    {
+        return arith_run(expr, result, !is_number(expr));
+    }
+    char *text = expand_word_single(expr);
+    int ret = arith_eval(text, result);
+    free(text);
+    return ret;
+}
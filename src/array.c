@@ -0,0 +1,265 @@
+// array.c
+#include "psh.h"
+
+// The value of an array variable. Indexed arrays are a vector with NULL holes, so a[i] is a
+// single load. Associative arrays keep their elements in insertion order and find them
+// through an open-addressing index, so lookups are O(1) and ${!map[@]} lists keys in the
+// order they were added.
+typedef struct ArrayEntry
+{
+    char *key; // NULL once the element was unset
+    char *value;
+    uint32_t hash;
+} ArrayEntry;
+
+struct VarArray
+{
+    int assoc;
+    size_t count; // elements that are set
+    size_t len;   // indexed: one past the highest element; associative: entries in use
+    size_t cap;
+    char **items;         // indexed
+    ArrayEntry *entries;  // associative
+    size_t *slots;        // associative: entry number + 1, 0 for a free slot
+    size_t n_slots;       // a power of two
+};
+
+static void *array_alloc(void *old, size_t size)
+{
+    void *mem = realloc(old, size);
+    if (!mem)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return mem;
+}
+
+VarArray *array_new(int assoc)
+{
+    VarArray *array = calloc(1, sizeof(VarArray));
+    if (!array)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    array->assoc = assoc;
+    return array;
+}
+
+void array_free(VarArray *array)
+{
+    if (array == NULL)
+    {
+        return;
+    }
+    for (size_t i = 0; i < array->len; i++)
+    {
+        if (array->assoc)
+        {
+            free(array->entries[i].key);
+            free(array->entries[i].value);
+        }
+        else
+        {
+            free(array->items[i]);
+        }
+    }
+    free(array->items);
+    free(array->entries);
+    free(array->slots);
+    free(array);
+}
+
+size_t array_count(const VarArray *array)
+{
+    return array->count;
+}
+
+// Index after the highest element of an indexed array, where `arr+=(x)` puts x
+int64_t array_next_index(const VarArray *array)
+{
+    return array->assoc ? 0 : (int64_t)array->len;
+}
+
+const char *array_get(const VarArray *array, int64_t index)
+{
+    return index >= 0 && (size_t)index < array->len ? array->items[index] : NULL;
+}
+
+// Sets element `index`. Returns -1 for an index beyond ARRAY_MAX_INDEX, the elements up to
+// the highest one are allocated.
+int array_set(VarArray *array, int64_t index, const char *value)
+{
+    if (index < 0 || index > ARRAY_MAX_INDEX)
+    {
+        return -1;
+    }
+    if ((size_t)index >= array->cap)
+    {
+        size_t cap = array->cap ? array->cap : 8;
+        while (cap <= (size_t)index)
+        {
+            cap *= 2;
+        }
+        array->items = array_alloc(array->items, cap * sizeof(char *));
+        memset(array->items + array->cap, 0, (cap - array->cap) * sizeof(char *));
+        array->cap = cap;
+    }
+    if (array->items[index] == NULL)
+    {
+        array->count++;
+    }
+    free(array->items[index]);
+    array->items[index] = strdup(value);
+    if ((size_t)index >= array->len)
+    {
+        array->len = index + 1;
+    }
+    return 0;
+}
+
+void array_unset(VarArray *array, int64_t index)
+{
+    if (index < 0 || (size_t)index >= array->len || array->items[index] == NULL)
+    {
+        return;
+    }
+    free(array->items[index]);
+    array->items[index] = NULL;
+    array->count--;
+    while (array->len > 0 && array->items[array->len - 1] == NULL)
+    {
+        array->len--;
+    }
+}
+
+// Slot of `key` in the index, or the free slot where it would go
+static size_t find_slot(const VarArray *array, const char *key, uint32_t h)
+{
+    size_t at = h & (array->n_slots - 1);
+    for (; array->slots[at] != 0; at = (at + 1) & (array->n_slots - 1))
+    {
+        ArrayEntry *entry = &array->entries[array->slots[at] - 1];
+        if (entry->key != NULL && entry->hash == h && strcmp(entry->key, key) == 0)
+        {
+            break;
+        }
+    }
+    return at;
+}
+
+// Drops unset entries and rebuilds the index at a size that leaves room to grow
+static void rehash(VarArray *array)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < array->len; i++)
+    {
+        if (array->entries[i].key != NULL)
+        {
+            array->entries[n++] = array->entries[i];
+        }
+    }
+    array->len = n;
+    if (array->cap < 2 * n + 8)
+    {
+        array->cap = 2 * n + 8;
+        array->entries = array_alloc(array->entries, array->cap * sizeof(ArrayEntry));
+    }
+
+    array->n_slots = 16;
+    while (array->n_slots < 2 * array->cap)
+    {
+        array->n_slots *= 2;
+    }
+    free(array->slots);
+    array->slots = calloc(array->n_slots, sizeof(size_t));
+    if (!array->slots)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        array->slots[find_slot(array, array->entries[i].key, array->entries[i].hash)] = i + 1;
+    }
+}
+
+const char *array_get_key(const VarArray *array, const char *key)
+{
+    if (array->n_slots == 0)
+    {
+        return NULL;
+    }
+    size_t slot = array->slots[find_slot(array, key, var_hash(key))];
+    return slot != 0 ? array->entries[slot - 1].value : NULL;
+}
+
+void array_set_key(VarArray *array, const char *key, const char *value)
+{
+    uint32_t h = var_hash(key);
+    if (array->n_slots != 0)
+    {
+        size_t slot = array->slots[find_slot(array, key, h)];
+        if (slot != 0)
+        {
+            free(array->entries[slot - 1].value);
+            array->entries[slot - 1].value = strdup(value);
+            return;
+        }
+    }
+    if (array->len == array->cap)
+    {
+        rehash(array);
+    }
+    array->entries[array->len] = (ArrayEntry){strdup(key), strdup(value), h};
+    array->slots[find_slot(array, key, h)] = ++array->len;
+    array->count++;
+}
+
+// The entry stays in the index as a tombstone until the next rehash
+void array_unset_key(VarArray *array, const char *key)
+{
+    if (array->n_slots == 0)
+    {
+        return;
+    }
+    size_t slot = array->slots[find_slot(array, key, var_hash(key))];
+    if (slot != 0)
+    {
+        ArrayEntry *entry = &array->entries[slot - 1];
+        free(entry->key);
+        free(entry->value);
+        entry->key = NULL;
+        entry->value = NULL;
+        array->count--;
+    }
+}
+
+// The values, or with `keys` set the subscripts, of every element in order. The list is
+// malloc'd, free it with free_double_pointer().
+char **array_list(const VarArray *array, int keys)
+{
+    char **list = malloc((array->count + 1) * sizeof(char *));
+    size_t n = 0;
+    if (!list)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < array->len; i++)
+    {
+        if (array->assoc && array->entries[i].key != NULL)
+        {
+            list[n++] = strdup(keys ? array->entries[i].key : array->entries[i].value);
+        }
+        else if (!array->assoc && array->items[i] != NULL)
+        {
+            char num[32];
+            snprintf(num, sizeof(num), "%zu", i);
+            list[n++] = strdup(keys ? num : array->items[i]);
+        }
+    }
+    list[n] = NULL;
+    return list;
+}
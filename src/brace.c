@@ -0,0 +1,566 @@
+// brace.c
+#include "psh.h"
+
+// Brace expansion: a{b,c}d gives abd acd, {1..10..3} gives 1 4 7 10, {01..03} gives 01 02 03
+// and {a..e} the letters a to e. It works on the words as written, before any other
+// expansion, and only braces outside quotes, ${ } and $( ) count. A generator produces the
+// expansions of a word one at a time, so `for i in {1..10000000}` holds one number at a time;
+// an argv gets them all at once, in a single allocation.
+
+// One brace expression being walked: the word it sits in and where its alternatives stand
+typedef struct BraceLevel
+{
+    char *word;
+    size_t open, close; // offsets of the { and the } in word
+    int range;
+    size_t next_alt;    // list: offset of the next alternative
+    int64_t value;      // range: the next value
+    int64_t last;
+    int64_t step;       // range: signed, towards last
+    int width;          // range: zero-padded width, 0 for none
+    int letters;        // range over characters instead of numbers
+    int done;
+} BraceLevel;
+
+struct BraceGen
+{
+    BraceLevel *levels; // the innermost expression being walked is on top
+    int depth;
+    int cap;
+};
+
+static size_t group_end(const char *word, size_t at, char open, char close, int *comma);
+
+// Index just past the escape, quoted string, `...`, ${ } or $( ) at `i`, or `i` itself when
+// the character there is an ordinary one. An unterminated part runs to the end of the word.
+static size_t skip_part(const char *word, size_t i)
+{
+    const char *p = word + i;
+    switch (*p)
+    {
+    case '\\':
+        return i + (p[1] != '\0' ? 2 : 1);
+    case '\'':
+    {
+        const char *q = strchr(p + 1, '\'');
+        return q != NULL ? (size_t)(q - word) + 1 : strlen(word);
+    }
+    case '"':
+    case '`':
+        for (p++; *p != '\0' && *p != word[i]; p++)
+        {
+            if (*p == '\\' && p[1] != '\0')
+            {
+                p++;
+            }
+        }
+        return (size_t)(p - word) + (*p != '\0');
+    case '$':
+        if (p[1] == '{' || p[1] == '(')
+        {
+            size_t end = group_end(word, i + 1, p[1], p[1] == '{' ? '}' : ')', NULL);
+            return end != 0 ? end + 1 : strlen(word);
+        }
+        return i + 1;
+    default:
+        return i;
+    }
+}
+
+// Offset of the `close` matching the `open` at `at`, passing over quoted parts; 0 when it
+// does not close. *comma is set for a comma at the top level of a { }.
+static size_t group_end(const char *word, size_t at, char open, char close, int *comma)
+{
+    int depth = 0;
+    size_t i = at;
+    while (word[i] != '\0')
+    {
+        size_t next = skip_part(word, i);
+        if (next != i)
+        {
+            i = next;
+            continue;
+        }
+        if (word[i] == open)
+        {
+            depth++;
+        }
+        else if (word[i] == close && --depth == 0)
+        {
+            return i;
+        }
+        else if (word[i] == ',' && depth == 1 && comma != NULL)
+        {
+            *comma = 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+// An optionally signed decimal number, as a range end or step
+static int is_number(const char *s)
+{
+    s += (*s == '-' || *s == '+');
+    return *s != '\0' && strspn(s, "0123456789") == strlen(s);
+}
+
+static int zero_padded(const char *s)
+{
+    s += (*s == '-' || *s == '+');
+    return s[0] == '0' && s[1] != '\0';
+}
+
+// x..y or x..y..step between the braces, numbers or single letters
+static int parse_range(const char *text, size_t len, BraceLevel *level)
+{
+    char buf[96];
+    if (len >= sizeof(buf))
+    {
+        return 0;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    char *dots = strstr(buf, "..");
+    if (dots == NULL)
+    {
+        return 0;
+    }
+    *dots = '\0';
+    char *first = buf, *last = dots + 2, *step_text = strstr(last, "..");
+    int64_t step = 1;
+    if (step_text != NULL)
+    {
+        *step_text = '\0';
+        step_text += 2;
+        if (!is_number(step_text))
+        {
+            return 0;
+        }
+        step = llabs(strtoll(step_text, NULL, 10));
+        step = step == 0 ? 1 : step;
+    }
+
+    level->width = 0;
+    if (is_number(first) && is_number(last))
+    {
+        errno = 0;
+        level->value = strtoll(first, NULL, 10);
+        level->last = strtoll(last, NULL, 10);
+        if (errno == ERANGE)
+        {
+            return 0;
+        }
+        level->letters = 0;
+        if (zero_padded(first) || zero_padded(last))
+        {
+            level->width = strlen(first) > strlen(last) ? strlen(first) : strlen(last);
+        }
+    }
+    else if (isalpha((unsigned char)first[0]) && first[1] == '\0' && isalpha((unsigned char)last[0]) &&
+             last[1] == '\0')
+    {
+        level->value = (unsigned char)first[0];
+        level->last = (unsigned char)last[0];
+        level->letters = 1;
+    }
+    else
+    {
+        return 0;
+    }
+    level->range = 1;
+    level->step = level->value <= level->last ? step : -step;
+    return 1;
+}
+
+// Finds the first brace expression in `word` at or after `from`: a { } with a comma at its
+// top level, or a range. Braces that are neither are ordinary characters.
+static int find_group(const char *word, size_t from, BraceLevel *level)
+{
+    size_t i = from;
+    while (word[i] != '\0')
+    {
+        size_t next = skip_part(word, i);
+        if (next != i)
+        {
+            i = next;
+            continue;
+        }
+        if (word[i] == '{')
+        {
+            int comma = 0;
+            size_t close = group_end(word, i, '{', '}', &comma);
+            if (close != 0 && (comma || parse_range(word + i + 1, close - i - 1, level)))
+            {
+                level->open = i;
+                level->close = close;
+                level->next_alt = i + 1;
+                level->done = 0;
+                level->range = !comma;
+                return 1;
+            }
+        }
+        i++;
+    }
+    return 0;
+}
+
+// The next alternative of `level`: a range value formatted into `num`, or a piece of the word
+static const char *next_alternative(BraceLevel *level, char *num, size_t size, size_t *len)
+{
+    if (level->range)
+    {
+        if (level->letters)
+        {
+            num[0] = (char)level->value;
+            num[1] = '\0';
+        }
+        else
+        {
+            snprintf(num, size, "%0*" PRId64, level->width, level->value);
+        }
+        *len = strlen(num);
+        int64_t next;
+        if (__builtin_add_overflow(level->value, level->step, &next) ||
+            (level->step > 0 ? next > level->last : next < level->last))
+        {
+            level->done = 1;
+        }
+        level->value = next;
+        return num;
+    }
+
+    // up to the next comma at this level, or the closing brace after the last alternative
+    const char *word = level->word;
+    size_t start = level->next_alt, i = start;
+    int depth = 0;
+    while (i < level->close)
+    {
+        size_t next = skip_part(word, i);
+        if (next != i)
+        {
+            i = next;
+            continue;
+        }
+        if (word[i] == '{')
+        {
+            depth++;
+        }
+        else if (word[i] == '}')
+        {
+            depth--;
+        }
+        else if (word[i] == ',' && depth == 0)
+        {
+            break;
+        }
+        i++;
+    }
+    *len = i - start;
+    level->next_alt = i + 1;
+    level->done = i >= level->close;
+    return word + start;
+}
+
+// The word with the braces of `level` replaced by `alt`
+static char *replace_group(const BraceLevel *level, const char *alt, size_t alt_len)
+{
+    size_t tail = strlen(level->word + level->close + 1);
+    char *child = malloc(level->open + alt_len + tail + 1);
+    if (!child)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(child, level->word, level->open);
+    memcpy(child + level->open, alt, alt_len);
+    memcpy(child + level->open + alt_len, level->word + level->close + 1, tail + 1);
+    return child;
+}
+
+static void push_level(BraceGen *gen, const BraceLevel *level)
+{
+    if (gen->depth == gen->cap)
+    {
+        gen->cap = gen->cap ? gen->cap * 2 : 4;
+        gen->levels = realloc(gen->levels, gen->cap * sizeof(BraceLevel));
+        if (!gen->levels)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    gen->levels[gen->depth++] = *level;
+}
+
+// A generator over the brace expansions of `word`, or NULL when it has no brace expression
+BraceGen *brace_new(const char *word)
+{
+    BraceLevel level;
+    if (strchr(word, '{') == NULL || !find_group(word, 0, &level))
+    {
+        return NULL;
+    }
+    BraceGen *gen = calloc(1, sizeof(BraceGen));
+    if (!gen)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    level.word = strdup(word);
+    push_level(gen, &level);
+    return gen;
+}
+
+// The next expansion, malloc'd and still to be expanded as a word, or NULL after the last
+char *brace_next(BraceGen *gen)
+{
+    while (gen->depth > 0)
+    {
+        BraceLevel *top = &gen->levels[gen->depth - 1];
+        if (top->done)
+        {
+            free(top->word);
+            gen->depth--;
+            continue;
+        }
+        char num[32];
+        size_t len;
+        const char *alt = next_alternative(top, num, sizeof(num), &len);
+        char *child = replace_group(top, alt, len);
+
+        // what came before the braces has no expression of its own, the rest may have
+        BraceLevel inner;
+        if (!find_group(child, top->open, &inner))
+        {
+            return child;
+        }
+        inner.word = child;
+        push_level(gen, &inner);
+    }
+    return NULL;
+}
+
+void brace_free(BraceGen *gen)
+{
+    if (gen == NULL)
+    {
+        return;
+    }
+    while (gen->depth > 0)
+    {
+        free(gen->levels[--gen->depth].word);
+    }
+    free(gen->levels);
+    free(gen);
+}
+
+// Brace-expands a word list for an argv. Returns NULL when no word has a brace expression,
+// else the expanded list in one block, pointers first and the text after them, which a single
+// free() releases.
+char **brace_expand(char **words)
+{
+    int any = 0;
+    for (int i = 0; words != NULL && words[i] != NULL && !any; i++)
+    {
+        any = strchr(words[i], '{') != NULL;
+    }
+    if (!any)
+    {
+        return NULL;
+    }
+
+    // the text goes into one growing arena first; offsets survive its reallocation
+    char *arena = NULL;
+    size_t used = 0, size = 0;
+    size_t *offsets = NULL;
+    size_t n = 0, n_cap = 0, expanded = 0;
+    for (int i = 0; words[i] != NULL; i++)
+    {
+        BraceGen *gen = brace_new(words[i]);
+        char *word = gen != NULL ? brace_next(gen) : words[i];
+        expanded |= gen != NULL;
+        while (word != NULL)
+        {
+            size_t len = strlen(word) + 1;
+            if (used + len > size)
+            {
+                size = (used + len) * 2;
+                arena = realloc(arena, size);
+            }
+            if (n == n_cap)
+            {
+                n_cap = n_cap ? n_cap * 2 : 16;
+                offsets = realloc(offsets, n_cap * sizeof(size_t));
+            }
+            if (!arena || !offsets)
+            {
+                fprintf(stderr, "psh: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(arena + used, word, len);
+            offsets[n++] = used;
+            used += len;
+            if (gen == NULL)
+            {
+                break;
+            }
+            free(word);
+            word = brace_next(gen);
+        }
+        brace_free(gen);
+    }
+    if (!expanded)
+    {
+        free(arena);
+        free(offsets);
+        return NULL;
+    }
+
+    char **list = malloc((n + 1) * sizeof(char *) + used);
+    if (!list)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    char *text = (char *)(list + n + 1);
+    memcpy(text, arena, used);
+    for (size_t i = 0; i < n; i++)
+    {
+        list[i] = text + offsets[i];
+    }
+    list[n] = NULL;
+    free(arena);
+    free(offsets);
+    return list;
+}
+
+// The words of a `for`. Plain words are expanded when the loop starts, as in any shell; the
+// expansions of a brace word are made and expanded one at a time as the loop asks for them.
+typedef struct StreamItem
+{
+    char **fields; // expanded plain words
+    BraceGen *gen; // or a brace word
+} StreamItem;
+
+struct WordStream
+{
+    StreamItem *items;
+    int n_items;
+    int item;
+    int field;
+    char **pending; // fields of the last word from a generator
+    char *current;  // the value returned last, when the stream owns it
+};
+
+// Words whose expansion is the word itself can skip the expander
+static int is_literal(const char *word)
+{
+    return strpbrk(word, "$'\"\\`<>*?[") == NULL;
+}
+
+static int has_brace_expression(const char *word)
+{
+    BraceLevel level;
+    return strchr(word, '{') != NULL && find_group(word, 0, &level);
+}
+
+WordStream *word_stream_new(char **words)
+{
+    int n = 0;
+    while (words[n] != NULL)
+    {
+        n++;
+    }
+    WordStream *stream = calloc(1, sizeof(WordStream));
+    StreamItem *items = calloc(n + 1, sizeof(StreamItem));
+    if (!stream || !items)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    stream->items = items;
+    for (int i = 0; i < n; i++)
+    {
+        StreamItem *item = &items[stream->n_items++];
+        item->gen = brace_new(words[i]);
+        if (item->gen != NULL)
+        {
+            continue;
+        }
+        // a run of plain words is expanded as one list
+        int end = i + 1;
+        while (end < n && !has_brace_expression(words[end]))
+        {
+            end++;
+        }
+        char **run = malloc((end - i + 1) * sizeof(char *));
+        if (!run)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(run, words + i, (end - i) * sizeof(char *));
+        run[end - i] = NULL;
+        item->fields = expand_words(run);
+        free(run);
+        i = end - 1;
+    }
+    return stream;
+}
+
+// The next value, valid until the following call, or NULL after the last
+const char *word_stream_next(WordStream *stream)
+{
+    free(stream->current);
+    stream->current = NULL;
+    while (stream->item < stream->n_items)
+    {
+        StreamItem *item = &stream->items[stream->item];
+        char **fields = item->gen != NULL ? stream->pending : item->fields;
+        if (fields != NULL && fields[stream->field] != NULL)
+        {
+            return fields[stream->field++];
+        }
+        stream->field = 0;
+        if (item->gen == NULL)
+        {
+            stream->item++;
+            continue;
+        }
+        free_double_pointer(stream->pending);
+        stream->pending = NULL;
+        char *word = brace_next(item->gen);
+        if (word == NULL)
+        {
+            stream->item++;
+            continue;
+        }
+        if (is_literal(word))
+        {
+            stream->current = word;
+            return word;
+        }
+        char *single[] = {word, NULL};
+        stream->pending = expand_words(single);
+        free(word);
+    }
+    return NULL;
+}
+
+void word_stream_free(WordStream *stream)
+{
+    if (stream == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < stream->n_items; i++)
+    {
+        free_double_pointer(stream->items[i].fields);
+        brace_free(stream->items[i].gen);
+    }
+    free(stream->items);
+    free_double_pointer(stream->pending);
+    free(stream->current);
+    free(stream);
+}
@@ -2,29 +2,33 @@
 // variables
 
 // char cwd[PATH_MAX];
-char *builtin_str[] = {"exit", "cd", "echo", "pwd", "fc", "export", "for", "type", "read", "alias", "unalias"};
-int (*builtin_func[])(char **) = {&PSH_EXIT, &PSH_CD, &PSH_ECHO, &PSH_PWD, &PSH_FC, &PSH_EXPORT, &PSH_FOR, &PSH_TYPE, &PSH_READ_SHELL, &PSH_ALIAS, &PSH_UNALIAS};
+char *builtin_str[] = {"exit", "cd", "echo", "pwd", "fc", "export", "type", "read", "alias", "unalias", "hash", "jobs", "fg", "bg", "wait", "parallel", "break", "continue", "local", "return", "shift", "declare", "typeset", "readonly", "unset", "test", "[", "shopt"};
+int (*builtin_func[])(char **) = {&PSH_EXIT, &PSH_CD, &PSH_ECHO, &PSH_PWD, &PSH_FC, &PSH_EXPORT, &PSH_TYPE, &PSH_READ_SHELL, &PSH_ALIAS, &PSH_UNALIAS, &PSH_HASH, &PSH_JOBS, &PSH_FG, &PSH_BG, &PSH_WAIT, &PSH_PARALLEL, &PSH_BREAK, &PSH_CONTINUE, &PSH_LOCAL, &PSH_RETURN, &PSH_SHIFT, &PSH_DECLARE, &PSH_DECLARE, &PSH_READONLY, &PSH_UNSET, &PSH_TEST, &PSH_TEST, &PSH_SHOPT};
 
 int size_builtin_str = sizeof(builtin_str) / sizeof(builtin_str[0]);
-struct Variable global_vars[MAX_VARS];
 int num_vars = 0;
 char PATH[PATH_MAX];
 
 int PSH_EXIT(char **token_arr)
 {
     char path_session[PATH_MAX];
+    if (jobs_in_subshell())
+    {
+        // leaving a subshell such as $(...) ends only that process
+        fflush(stdout);
+        fflush(stderr);
+        _exit((token_arr[1] ? atoi(token_arr[1]) : last_status) & 0xff);
+    }
     get_session_path(path_session, sizeof(path_session), cwd);
 
     if (!token_arr[1])
     {
         printf("bye bye PSH :D\n");
         delete_file(path_session);
-        free_double_pointer(token_arr); // now handled in process commands
         exit(0);
     }
     printf("bye bye PSH :D\n");
     int exit_code = atoi(token_arr[1]);
-    free_double_pointer(token_arr);
     delete_file(path_session);
     exit(exit_code);
 }
@@ -32,7 +36,7 @@ int PSH_EXIT(char **token_arr)
 int PSH_CD(char **token_arr)
 {
     char *localdir = malloc(PATH_MAX);
-    char *home = NULL;                   // for ~ and empty cases
+    const char *home = NULL;                  // for ~ and empty cases
     static char PREV_DIR[PATH_MAX] = ""; // for - cases
     char *pathtoken = malloc(PATH_MAX);
 
@@ -64,7 +68,7 @@ int PSH_CD(char **token_arr)
 
     if (pathtoken == NULL || strcmp(pathtoken, "~") == 0)
     {
-        home = getenv("HOME");
+        home = var_get("HOME");
         if (home == NULL)
         {
             fprintf(stderr, "PSH: HOME environment variable not set\n");
@@ -176,12 +180,14 @@ int PSH_ECHO(char **token_arr)
 {
     bool newline = true;
     bool interpret_escapes = false;
-    FILE *output = stdout;
+    FILE *output = stdout; // redirections are applied to fd 1 before echo runs
     int arg_index = 1;
 
     for (; token_arr[arg_index] != NULL; arg_index++)
     {
-        if (token_arr[arg_index][0] != '-')
+        // only words made of option letters are options, so `echo -5` prints -5
+        if (token_arr[arg_index][0] != '-' || token_arr[arg_index][1] == '\0' ||
+            token_arr[arg_index][strspn(token_arr[arg_index] + 1, "neE") + 1] != '\0')
         {
             break;
         }
@@ -204,50 +210,15 @@ int PSH_ECHO(char **token_arr)
         }
     }
 
-    char **output_tokens = token_arr;
-    int output_token_count = 0;
-    while (output_tokens[output_token_count] != NULL)
-    {
-        if (strcmp(output_tokens[output_token_count], ">") == 0)
-        {
-            if (output_tokens[output_token_count + 1] != NULL)
-            {
-                output = fopen(output_tokens[output_token_count + 1], "w");
-                if (output == NULL)
-                {
-                    perror("Error opening file");
-                    return 1;
-                }
-                output_tokens[output_token_count] = NULL;
-            }
-            break;
-        }
-        output_token_count++;
-    }
-
     for (int i = arg_index; token_arr[i] != NULL; i++)
     {
-        char *arg = malloc(PATH_MAX);
-        // char *arg = strdup(token_arr[i]);
-        strcpy(arg, token_arr[i]);
-
-        // Remove all quotes from the argument
-        char *src = arg;
-        char *dst = arg;
-        while (*src)
-        {
-            if (*src != '\'' && *src != '"')
-            {
-                *dst++ = *src;
-            }
-            src++;
-        }
-        *dst = '\0';
+        // expansions can make words of any length, quotes are already gone
+        char *arg = strdup(token_arr[i]);
 
         if (interpret_escapes)
         {
-            char expanded_arg[1024];
-            char *exp_write_pos = expanded_arg;
+            // escapes only ever shrink the text, so it is rewritten in place
+            char *exp_write_pos = arg;
 
             for (char *read_pos = arg; *read_pos != '\0'; read_pos++)
             {
@@ -276,30 +247,6 @@ int PSH_ECHO(char **token_arr)
                 }
             }
             *exp_write_pos = '\0';
-            strcpy(arg, expanded_arg);
-        }
-
-        // Variable expansion
-        if (arg[0] == '$')
-        {
-            const char *var_name = arg + 1; // Skip the '$' sign
-            const char *var_value = getenv(var_name);
-
-            if (var_value != NULL)
-            {
-                // mallocing so that huge variables get enough space and seg fault gets avoided
-                size_t len = strlen(var_value);
-                char *buffer = (char *)malloc(len + 1);
-                strcpy(buffer, var_value);
-                strcpy(arg, buffer);
-                // printf("%s", buffer);
-                free(buffer);
-            }
-            else
-            {
-                // Variable not found, handle accordingly (e.g., print nothing)
-                arg[0] = '\0'; // Empty string
-            }
         }
 
         if (i > arg_index)
@@ -315,11 +262,6 @@ int PSH_ECHO(char **token_arr)
         fputc('\n', output);
     }
 
-    if (output != stdout)
-    {
-        fclose(output);
-    }
-
     return 1;
 }
 
@@ -936,23 +878,7 @@ int PSH_EXPORT(char **token_arr)
     if (token_arr[1] == NULL ||
         strcmp(token_arr[1], "-p") == 0) // default null or -p option
     {
-        extern char **environ;
-
-        // find no of entries in environ
-        int env_length = 0;
-        while (environ[env_length] != NULL)
-        {
-            env_length++;
-        }
-
-        sort_strings(environ, env_length); // sort environment variables
-
-        int i = 0;
-        while (environ[i] != NULL)
-        {
-            printf("declare -x %s\n", environ[i]); // print all env variables
-            i++;
-        }
+        var_print_all(VAR_EXPORTED); // sorted by name
     }
     else if (strcmp(token_arr[1], "-f") == 0) // functions
     {
@@ -1015,56 +941,32 @@ int PSH_EXPORT(char **token_arr)
         //     }
         // }
     }
-    else if (strcmp(token_arr[1], "-n") == 0) // removing and env variable
+    else if (strcmp(token_arr[1], "-n") == 0) // stop passing a variable to children
     {
-        if (token_arr[2] != NULL)
+        for (int i = 2; token_arr[i] != NULL; i++)
         {
-            if (unsetenv(token_arr[2]) != 0)
-            {
-                perror("PSH: unsetenv() error");
-            }
+            var_declare(token_arr[i], 0, VAR_EXPORTED);
         }
     }
     else
     {
-        // setting a variable as an env variable
-        int found = 0;
-        for (int i = 0; i < num_vars; i++)
+        for (int i = 1; token_arr[i] != NULL; i++)
         {
-            if (strcmp(token_arr[1], global_vars[i].var_name) == 0)
+            char *eq = strchr(token_arr[i], '=');
+            if (eq != NULL)
             {
-                if (setenv(global_vars[i].var_name, global_vars[i].var_value, 1) != 0)
+                // export NAME=value sets the variable, then marks it
+                *eq = '\0';
+                if (var_set(token_arr[i], eq + 1) == -1)
                 {
-                    perror("PSH: setenv() error");
-                }
-                found = 1;
-                break;
-            }
-        }
-
-        if (!found)
-        {
-            if (strchr(token_arr[1], '='))
-            {
-                char *var_name = strtok(token_arr[1], "=");
-                char *var_value = strtok(NULL, "=");
-
-                if (var_value != NULL)
-                {
-                    // Set the environment variable
-                    if (setenv(var_name, var_value, 1) != 0)
-                    {
-                        perror("PSH: setenv() error");
-                    }
-                }
-                else
-                {
-                    fprintf(stderr, "PSH: Invalid variable assignment\n");
+                    last_status = 1;
                 }
+                var_export(token_arr[i]);
+                *eq = '=';
             }
             else
             {
-                fprintf(stderr, "Unknown option: %s\n", token_arr[1]);
+                var_export(token_arr[i]);
             }
         }
     }
@@ -1072,31 +974,6 @@ int PSH_EXPORT(char **token_arr)
     return 1;
 }
 
-// Define the PSH_FOR function
-int PSH_FOR(char **token_arr)
-{
-    size_t bufsize = 1024;
-    char *loop_command = malloc(bufsize * sizeof(char));
-    loop_command[0] = '\0';
-
-    for (int i = 0; token_arr[i] != NULL; i++)
-    {
-        if (strlen(loop_command) + strlen(token_arr[i]) + 1 >= bufsize)
-        {
-            bufsize *= 2;
-            loop_command = realloc(loop_command, bufsize * sizeof(char));
-        }
-        strcat(loop_command, token_arr[i]);
-        strcat(loop_command, " ");
-    }
-
-    int run = 1;                              // Initialize run for the loop
-    process_nested_loops(loop_command, &run); // Pass run to process_nested_loops
-
-    free(loop_command);
-    return run;
-}
-
 int PSH_TYPE(char **token_arr) // usage type <command>
 {
     /* METHOD 1 */
@@ -1131,49 +1008,36 @@ int PSH_TYPE(char **token_arr) // usage type <command>
 
     /* BETTER METHOD */
 
-    // handling pwd, echo as in PSH they are built-ins
-    if ((strcmp(token_arr[1], "pwd") == 0) || (strcmp(token_arr[1], "echo") == 0))
+    if (is_reserved_word(token_arr[1]))
     {
-        printf("%s is a PSH shell builtn\n", token_arr[1]);
+        printf("%s is a shell keyword\n", token_arr[1]);
         return 1;
     }
 
-    char buff1[1024];
-    char buff2[1024];
-    struct stat stats;
-    int perms = 0; // default is shell builtin
-
-    snprintf(buff1, sizeof(buff1), "/usr/bin/%s", token_arr[1]);
-    snprintf(buff2, sizeof(buff2), "/bin/%s", token_arr[1]);
-
-    char *common_buff = malloc(1024 * 4);
-    // printf("Checking: %s\n", buff1); //debug check
-
-    if (stat(buff1, &stats) == 0)
+    if (func_exists(token_arr[1]))
     {
-        // printf("Found in /usr/bin\n");
-        perms = (stats.st_mode & S_IXUSR); // perms = 0 if command is a shell built-in
-        // printf("%d\n",perms);
-        strcpy(common_buff, buff1);
+        printf("%s is a function\n", token_arr[1]);
+        return 1;
     }
-    else if (stat(buff2, &stats) == 0)
+
+    for (int i = 0; i < size_builtin_str; i++)
     {
-        // printf("Found in /bin\n");
-        perms = (stats.st_mode & S_IXUSR);
-        // printf("%d\n",perms);
-        strcpy(common_buff, buff2);
+        if (strcmp(token_arr[1], builtin_str[i]) == 0)
+        {
+            printf("%s is a PSH shell builtn\n", token_arr[1]);
+            return 1;
+        }
     }
 
-    // printf("%d this is perms\n",perms);
-    if (perms == 0)
+    // same resolved-path cache the launcher uses, so type agrees with what would run
+    const char *location = cmdhash_lookup(token_arr[1], 0);
+    if (location == NULL)
     {
-        printf("%s is a PSH shell builtn\n", token_arr[1]);
-        free(common_buff);
+        fprintf(stderr, "psh: type: %s: not found\n", token_arr[1]);
     }
     else
     {
-        printf("%s is shell external in %s\n", token_arr[1], common_buff);
-        free(common_buff);
+        printf("%s is shell external in %s\n", token_arr[1], location);
     }
     return 1;
 }
@@ -1189,10 +1053,6 @@ int PSH_READ_SHELL(char **token_arr)
     { // read
         n = 1;
     }
-    else if (strcmp(token_arr[1], "<<<") == 0)
-    { // read <<< "hello, world"
-        n = 2;
-    }
     else if (strcmp(token_arr[1], "-p") == 0)
     { // read -p "Enter prompt" var1
         n = 3;
@@ -1208,27 +1068,31 @@ int PSH_READ_SHELL(char **token_arr)
     case 1:
     {
         char *buff = malloc(PATH_MAX);
-        fgets(buff, PATH_MAX, stdin);
+        if (fgets(buff, PATH_MAX, stdin) == NULL)
+        {
+            // end of input: the status is what ends a `while read` loop
+            free(buff);
+            last_status = 1;
+            return 1;
+        }
         buff[strcspn(buff, "\n")] = '\0';
-        setenv("REPLY", buff, 1);
+        var_set("REPLY", buff);
         free(buff);
         return 1;
     }
 
-    case 2: // bug : also works if it is not in quotes
-    {
-        setenv("REPLY", token_arr[2], 1);
-
-        return 1;
-    }
-
     case 3:
     {
         char *buff = malloc(PATH_MAX);
         printf("%s ", token_arr[2]); // read -p "Enter your name: " name
-        fgets(buff, PATH_MAX, stdin);
+        if (fgets(buff, PATH_MAX, stdin) == NULL)
+        {
+            free(buff);
+            last_status = 1;
+            return 1;
+        }
         buff[strcspn(buff, "\n")] = '\0';
-        setenv(token_arr[3], buff, 1);
+        var_set(token_arr[3], buff);
         free(buff);
         return 1;
     }
@@ -1237,20 +1101,25 @@ int PSH_READ_SHELL(char **token_arr)
     {
 
         char *buff = malloc(PATH_MAX);
-        char **arr_vars = malloc(PATH_MAX);
+        char *saveptr;
 
-        fgets(buff, PATH_MAX, stdin);
+        if (fgets(buff, PATH_MAX, stdin) == NULL)
+        {
+            free(buff);
+            last_status = 1;
+            return 1;
+        }
         buff[strcspn(buff, "\n")] = '\0';
-        arr_vars = PSH_TOKENIZER(buff);
+        // input fields are split on blanks only, nothing in them is shell syntax
+        char *field = strtok_r(buff, " \t", &saveptr);
         int k = 0;
-        while (arr_vars[k] != NULL) // printing arr_vars
+        while (field != NULL && token_arr[k + 1] != NULL)
         {
-            // printf("%s\n",arr_vars[k]);
-            setenv(token_arr[k + 1], arr_vars[k], 1);
+            var_set(token_arr[k + 1], field);
+            field = strtok_r(NULL, " \t", &saveptr);
             k++;
         }
         free(buff);
-        free(arr_vars);
         return 1;
     }
 
@@ -1274,13 +1143,7 @@ int PSH_ALIAS(char **token_arr)
 
     get_alias_path(ALIAS, sizeof(ALIAS), cwd);
     // printf("ALIAS PATH: %s\n", ALIAS);
-    // Initializing HashMap
-    HashMap *map = create_map(HASHMAP_SIZE);
-    if (!map)
-    {
-        perror("Failed to create HashMap");
-    }
-    load_aliases(map, ALIAS);
+    HashMap *map = alias_map();
     if (token_arr[1] == NULL || strcmp(token_arr[1], "-p") == 0)
     {
         for (int i = 0; i < map->size; i++)
@@ -1318,9 +1181,6 @@ int PSH_ALIAS(char **token_arr)
     }
     // Save Aliases to file
     save_aliases(map, ALIAS);
-
-    // Free memory
-    free_map(map);
     return 1;
 }
 
@@ -1328,13 +1188,7 @@ int PSH_UNALIAS(char **token_arr)
 {
     char ALIAS[PATH_MAX];
     get_alias_path(ALIAS, sizeof(ALIAS), cwd);
-    // Initializing HashMap
-    HashMap *map = create_map(HASHMAP_SIZE);
-    if (!map)
-    {
-        perror("Failed to create HashMap");
-    }
-    load_aliases(map, ALIAS);
+    HashMap *map = alias_map();
     if (token_arr[1] == NULL)
     {
         fprintf(stderr, "Must have flag or alias name to be removed\n");
@@ -1354,8 +1208,588 @@ int PSH_UNALIAS(char **token_arr)
     // Save Aliases to file
     save_aliases(map, ALIAS);
 
-    // Free memory
-    free_map(map);
+    return 1;
+}
+
+int PSH_HASH(char **token_arr) // usage hash [-r] [-d name] [-t name] [-p path name] [name ...]
+{
+    if (token_arr[1] == NULL)
+    {
+        cmdhash_print();
+        return 1;
+    }
+
+    if (strcmp(token_arr[1], "-r") == 0)
+    {
+        cmdhash_clear();
+    }
+    else if (strcmp(token_arr[1], "-p") == 0)
+    {
+        if (token_arr[2] == NULL || token_arr[3] == NULL)
+        {
+            fprintf(stderr, "Usage: hash -p <path> <name>\n");
+            return 1;
+        }
+        cmdhash_insert(token_arr[3], token_arr[2]);
+    }
+    else if (strcmp(token_arr[1], "-d") == 0)
+    {
+        for (int i = 2; token_arr[i] != NULL; i++)
+        {
+            cmdhash_forget(token_arr[i]);
+        }
+    }
+    else if (strcmp(token_arr[1], "-t") == 0)
+    {
+        for (int i = 2; token_arr[i] != NULL; i++)
+        {
+            const char *location = cmdhash_lookup(token_arr[i], 0);
+            if (location == NULL)
+            {
+                fprintf(stderr, "psh: hash: %s: not found\n", token_arr[i]);
+            }
+            else
+            {
+                printf("%s\n", location);
+            }
+        }
+    }
+    else
+    {
+        for (int i = 1; token_arr[i] != NULL; i++)
+        {
+            // force a fresh $PATH search, the same way a launch would
+            cmdhash_forget(token_arr[i]);
+            if (cmdhash_lookup(token_arr[i], 0) == NULL)
+            {
+                fprintf(stderr, "psh: hash: %s: not found\n", token_arr[i]);
+            }
+        }
+    }
+    return 1;
+}
+
+int PSH_JOBS(char **token_arr) // usage jobs [-l | -p]
+{
+    int show_pids = 0, pids_only = 0;
+    for (int i = 1; token_arr[i] != NULL; i++)
+    {
+        if (strcmp(token_arr[i], "-l") == 0)
+        {
+            show_pids = 1;
+        }
+        else if (strcmp(token_arr[i], "-p") == 0)
+        {
+            pids_only = 1;
+        }
+        else
+        {
+            fprintf(stderr, "psh: jobs: %s: invalid option\n", token_arr[i]);
+            last_status = 2;
+            return 1;
+        }
+    }
+    jobs_print(show_pids, pids_only);
+    return 1;
+}
+
+int PSH_FG(char **token_arr) // usage fg [%job]
+{
+    Job *job = job_find(token_arr[1]);
+    if (job == NULL)
+    {
+        fprintf(stderr, "psh: fg: %s: no such job\n", token_arr[1] ? token_arr[1] : "current");
+        last_status = 1;
+        return 1;
+    }
+    printf("%s\n", job->command);
+    last_status = job_foreground(job, 1);
+    return 1;
+}
+
+int PSH_BG(char **token_arr) // usage bg [%job ...]
+{
+    int n_specs = token_arr[1] == NULL ? 1 : size_token_arr(token_arr) - 1;
+    for (int i = 1; i <= n_specs; i++)
+    {
+        // with no arguments token_arr[1] is NULL, which job_find takes as the current job
+        Job *job = job_find(token_arr[i]);
+        if (job == NULL)
+        {
+            fprintf(stderr, "psh: bg: %s: no such job\n", token_arr[i] ? token_arr[i] : "current");
+            last_status = 1;
+            continue;
+        }
+        job_background(job, 1);
+    }
+    return 1;
+}
+
+int PSH_WAIT(char **token_arr) // usage wait [%job | pid ...]
+{
+    if (token_arr[1] == NULL)
+    {
+        // plain `wait` waits for every job and always succeeds
+        Job *job = jobs_first();
+        while (job != NULL)
+        {
+            Job *next = job->next;
+            if (job_state(job) != JOB_STOPPED)
+            {
+                job_wait_and_remove(job);
+            }
+            job = next;
+        }
+        return 1;
+    }
+    for (int i = 1; token_arr[i] != NULL; i++)
+    {
+        Job *job = job_find(token_arr[i]);
+        if (job == NULL)
+        {
+            fprintf(stderr, "psh: wait: %s: no such job\n", token_arr[i]);
+            last_status = 127;
+            continue;
+        }
+        last_status = job_wait_and_remove(job);
+    }
+    return 1;
+}
+
+// Adds `word` to the argument list; words after ::: were already globbed like any argv
+static void parallel_add_arg(char ***args, int *n_args, int *cap, const char *word)
+{
+    if (*n_args == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 64;
+        *args = realloc(*args, *cap * sizeof(char *));
+        if (!*args)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*args)[(*n_args)++] = strdup(word);
+}
+
+int PSH_PARALLEL(char **token_arr) // usage parallel [-j N] [-l LOAD] command [{}] [::: arg ...]
+{
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    double max_load = 0;
+    int i = 1;
+
+    for (; token_arr[i] != NULL && token_arr[i][0] == '-'; i++)
+    {
+        const char *value = NULL;
+        char option = token_arr[i][1];
+        if (strcmp(token_arr[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        if ((option == 'j' || option == 'l') && token_arr[i][2] != '\0')
+        {
+            value = token_arr[i] + 2;
+        }
+        else if ((option == 'j' || option == 'l') && token_arr[i + 1] != NULL)
+        {
+            value = token_arr[++i];
+        }
+        if (value == NULL)
+        {
+            fprintf(stderr, "psh: parallel: %s: invalid option\n", token_arr[i]);
+            fprintf(stderr, "Usage: parallel [-j N] [-l LOAD] command [{}] [::: arg ...]\n");
+            last_status = 2;
+            return 1;
+        }
+        if (option == 'j')
+        {
+            char *end;
+            errno = 0;
+            slots = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || errno == ERANGE || slots < 1 || slots > PARALLEL_MAX_JOBS)
+            {
+                fprintf(stderr, "psh: parallel: %s: invalid job count, expected 1-%d\n", value, PARALLEL_MAX_JOBS);
+                last_status = 2;
+                return 1;
+            }
+        }
+        else
+        {
+            max_load = atof(value);
+        }
+    }
+
+    int template_start = i;
+    while (token_arr[i] != NULL && strcmp(token_arr[i], ":::") != 0)
+    {
+        i++;
+    }
+    if (i == template_start || slots < 1)
+    {
+        fprintf(stderr, "Usage: parallel [-j N] [-l LOAD] command [{}] [::: arg ...]\n");
+        last_status = 2;
+        return 1;
+    }
 
+    char **args = NULL;
+    int n_args = 0, cap = 0;
+    int from_stdin = token_arr[i] == NULL;
+    if (from_stdin)
+    {
+        // one argument per input line
+        char *line = NULL;
+        size_t len = 0;
+        ssize_t read;
+        while ((read = getline(&line, &len, stdin)) != -1)
+        {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0] != '\0')
+            {
+                parallel_add_arg(&args, &n_args, &cap, line);
+            }
+        }
+        free(line);
+        clearerr(stdin);
+    }
+    else
+    {
+        for (int j = i + 1; token_arr[j] != NULL; j++)
+        {
+            parallel_add_arg(&args, &n_args, &cap, token_arr[j]);
+        }
+    }
+
+    // the template is the words between the options and `:::`
+    char *stop = token_arr[i];
+    token_arr[i] = NULL;
+    last_status = parallel_run(token_arr + template_start, args, n_args, (int)slots, max_load, from_stdin);
+    token_arr[i] = stop;
+
+    for (int j = 0; j < n_args; j++)
+    {
+        free(args[j]);
+    }
+    free(args);
+    return 1;
+}
+
+// Shared by break and continue: how many enclosing loops the jump covers, 0 on error
+static int loop_levels(char **token_arr, const char *name)
+{
+    if (loop_depth == 0)
+    {
+        fprintf(stderr, "psh: %s: only meaningful in a `for', `while', or `until' loop\n", name);
+        return 0;
+    }
+    int levels = 1;
+    if (token_arr[1] != NULL)
+    {
+        char *end;
+        levels = (int)strtol(token_arr[1], &end, 10);
+        if (*end != '\0' || levels < 1)
+        {
+            fprintf(stderr, "psh: %s: %s: loop count out of range\n", name, token_arr[1]);
+            last_status = 1;
+            return 0;
+        }
+    }
+    return levels < loop_depth ? levels : loop_depth;
+}
+
+int PSH_BREAK(char **token_arr) // usage break [n]
+{
+    loop_break = loop_levels(token_arr, "break");
+    return 1;
+}
+
+int PSH_CONTINUE(char **token_arr) // usage continue [n]
+{
+    int levels = loop_levels(token_arr, "continue");
+    if (levels > 0)
+    {
+        // leave the inner loops, then start the next pass of the n-th one
+        loop_break = levels - 1;
+        loop_continue = 1;
+    }
+    return 1;
+}
+
+// Shared by declare, typeset and local: applies attributes and values to each name.
+// Inside a function every name becomes local to it.
+// The value of declare NAME=value, NAME=(...) assigns a whole array
+static int declare_value(const char *name, const char *value)
+{
+    size_t len = strlen(value);
+    if (value[0] == '(' && len >= 2 && value[len - 1] == ')')
+    {
+        return assign_array(name, value, 0);
+    }
+    return var_set(name, value);
+}
+
+static int declare_vars(char **token_arr, const char *cmd, int set)
+{
+    int clear = 0, print = 0;
+    int i = 1;
+
+    for (; token_arr[i] != NULL && (token_arr[i][0] == '-' || token_arr[i][0] == '+') && token_arr[i][1] != '\0'; i++)
+    {
+        if (strcmp(token_arr[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        for (const char *opt = token_arr[i] + 1; *opt; opt++)
+        {
+            int on = token_arr[i][0] == '-';
+            switch (*opt)
+            {
+            case 'i':
+                if (on)
+                {
+                    set |= VAR_INTEGER;
+                }
+                else
+                {
+                    clear |= VAR_INTEGER;
+                }
+                break;
+            case 'x':
+                if (on)
+                {
+                    set |= VAR_EXPORTED;
+                }
+                else
+                {
+                    clear |= VAR_EXPORTED;
+                }
+                break;
+            case 'r':
+                if (!on)
+                {
+                    fprintf(stderr, "psh: %s: +r: readonly cannot be removed\n", cmd);
+                    last_status = 1;
+                    return 1;
+                }
+                set |= VAR_READONLY;
+                break;
+            case 'a':
+            case 'A':
+                if (on)
+                {
+                    set |= *opt == 'a' ? VAR_ARRAY : VAR_ASSOC;
+                }
+                break;
+            case 'p':
+                print = 1;
+                break;
+            default:
+                fprintf(stderr, "psh: %s: %c%c: invalid option\n", cmd, token_arr[i][0], *opt);
+                last_status = 2;
+                return 1;
+            }
+        }
+    }
+    if (token_arr[i] == NULL)
+    {
+        var_print_all(set); // only the variables with the given attributes
+        return 1;
+    }
+
+    for (; token_arr[i] != NULL; i++)
+    {
+        char *name = token_arr[i];
+        char *eq = strchr(name, '=');
+        if (eq != NULL)
+        {
+            *eq = '\0';
+        }
+        if (!isalpha((unsigned char)name[0]) && name[0] != '_')
+        {
+            fprintf(stderr, "psh: %s: `%s': not a valid identifier\n", cmd, name);
+            last_status = 1;
+        }
+        else if (print)
+        {
+            if (var_print(name) == -1)
+            {
+                fprintf(stderr, "psh: %s: %s: not found\n", cmd, name);
+                last_status = 1;
+            }
+        }
+        else
+        {
+            // func_local() is a no-op outside a function; the value goes in before readonly takes effect
+            if (func_local(name) == -1 || var_declare(name, set & ~VAR_READONLY, clear) == -1 || (eq != NULL && declare_value(name, eq + 1) == -1))
+            {
+                last_status = 1;
+            }
+            else if (set & VAR_READONLY)
+            {
+                var_declare(name, VAR_READONLY, 0);
+            }
+        }
+        if (eq != NULL)
+        {
+            *eq = '=';
+        }
+    }
+    return 1;
+}
+
+int PSH_DECLARE(char **token_arr) // usage declare [-aAipx] [+ix] [name[=value] ...]
+{
+    return declare_vars(token_arr, token_arr[0], 0);
+}
+
+int PSH_READONLY(char **token_arr) // usage readonly [-ip] [name[=value] ...]
+{
+    return declare_vars(token_arr, "readonly", VAR_READONLY);
+}
+
+int PSH_UNSET(char **token_arr) // usage unset [-v] name ...
+{
+    int i = 1;
+    if (token_arr[i] != NULL && strcmp(token_arr[i], "-v") == 0)
+    {
+        i++;
+    }
+    for (; token_arr[i] != NULL; i++)
+    {
+        if (var_unset(token_arr[i]) == -1)
+        {
+            last_status = 1;
+        }
+    }
+    return 1;
+}
+
+int PSH_LOCAL(char **token_arr) // usage local [-aAi] name[=value] ...
+{
+    if (func_depth() == 0)
+    {
+        fprintf(stderr, "psh: local: can only be used in a function\n");
+        last_status = 1;
+        return 1;
+    }
+    return declare_vars(token_arr, "local", 0);
+}
+
+int PSH_RETURN(char **token_arr) // usage return [n]
+{
+    if (func_depth() == 0)
+    {
+        fprintf(stderr, "psh: return: can only `return' from a function\n");
+        last_status = 1;
+        return 1;
+    }
+    if (token_arr[1] != NULL)
+    {
+        char *end;
+        long status = strtol(token_arr[1], &end, 10);
+        if (*end != '\0' || end == token_arr[1])
+        {
+            fprintf(stderr, "psh: return: %s: numeric argument required\n", token_arr[1]);
+            status = 2;
+        }
+        last_status = (int)(status & 0xff);
+    }
+    else
+    {
+        last_status = caller_status; // keep the status of the previous command
+    }
+    func_returning = 1;
+    return 1;
+}
+
+int PSH_SHIFT(char **token_arr) // usage shift [n]
+{
+    int n = 1;
+    if (token_arr[1] != NULL)
+    {
+        char *end;
+        n = (int)strtol(token_arr[1], &end, 10);
+        if (*end != '\0' || end == token_arr[1])
+        {
+            fprintf(stderr, "psh: shift: %s: numeric argument required\n", token_arr[1]);
+            last_status = 1;
+            return 1;
+        }
+    }
+    if (positional_shift(n) == -1)
+    {
+        last_status = 1;
+    }
+    return 1;
+}
+
+// Shell options for shopt
+static const struct
+{
+    const char *name;
+    int *value;
+} shell_options[] = {{"globstar", &glob_star}, {"globfollow", &glob_follow}, {"globcache", &glob_cache}};
+
+int PSH_SHOPT(char **token_arr) // usage shopt [-s|-u|-q] [name ...]
+{
+    int set = -1, quiet = 0, i = 1;
+    for (; token_arr[i] != NULL && token_arr[i][0] == '-'; i++)
+    {
+        if (strcmp(token_arr[i], "-s") == 0 || strcmp(token_arr[i], "-u") == 0)
+        {
+            set = token_arr[i][1] == 's';
+        }
+        else if (strcmp(token_arr[i], "-q") == 0)
+        {
+            quiet = 1;
+        }
+        else
+        {
+            fprintf(stderr, "Usage: shopt [-s|-u|-q] [name ...]\n");
+            last_status = 2;
+            return 1;
+        }
+    }
+    int n_options = sizeof(shell_options) / sizeof(shell_options[0]);
+    last_status = 0;
+    for (int j = 0; j < n_options; j++)
+    {
+        // without names, list every option
+        int listed = token_arr[i] == NULL;
+        for (int k = i; token_arr[k] != NULL && !listed; k++)
+        {
+            listed = strcmp(token_arr[k], shell_options[j].name) == 0;
+        }
+        if (!listed)
+        {
+            continue;
+        }
+        if (set >= 0)
+        {
+            *shell_options[j].value = set;
+        }
+        else if (!quiet)
+        {
+            printf("%-15s\t%s\n", shell_options[j].name, *shell_options[j].value ? "on" : "off");
+        }
+        else if (!*shell_options[j].value)
+        {
+            last_status = 1;
+        }
+    }
+    for (; token_arr[i] != NULL; i++)
+    {
+        int known = 0;
+        for (int j = 0; j < n_options; j++)
+        {
+            known |= strcmp(token_arr[i], shell_options[j].name) == 0;
+        }
+        if (!known)
+        {
+            fprintf(stderr, "psh: shopt: %s: invalid shell option name\n", token_arr[i]);
+            last_status = 1;
+        }
+    }
     return 1;
 }
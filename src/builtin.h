@@ -9,10 +9,25 @@ int PSH_ECHO(char **);
 int PSH_PWD(char **);
 int PSH_FC(char **);
 int PSH_EXPORT(char **);
-int PSH_FOR(char **);
 int PSH_TYPE(char **);
 int PSH_READ_SHELL(char **);
 int PSH_ALIAS(char **);
 int PSH_UNALIAS(char **);
+int PSH_HASH(char **);
+int PSH_JOBS(char **);
+int PSH_FG(char **);
+int PSH_BG(char **);
+int PSH_WAIT(char **);
+int PSH_PARALLEL(char **);
+int PSH_BREAK(char **);
+int PSH_CONTINUE(char **);
+int PSH_LOCAL(char **);
+int PSH_RETURN(char **);
+int PSH_SHIFT(char **);
+int PSH_DECLARE(char **);
+int PSH_READONLY(char **);
+int PSH_UNSET(char **);
+int PSH_TEST(char **);
+int PSH_SHOPT(char **);
 
 #endif
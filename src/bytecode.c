@@ -0,0 +1,534 @@
+// bytecode.c
+#include "psh.h"
+
+// Compound commands are flattened once into a list of instructions with resolved jump
+// targets. Simple commands and pipelines stay tree nodes that OP_RUN hands to the executor.
+
+#define FRAME_LOOP 0
+#define FRAME_REDIRECT 1
+#define FRAME_CASE 2
+
+// Runtime state of a loop, redirection or case that the program is currently inside
+typedef struct Frame
+{
+    int kind;         // FRAME_*
+    int resume;       // FRAME_LOOP: where `continue` starts the next pass
+    int end;          // FRAME_LOOP: index of the OP_END_LOOP
+    int status;       // FRAME_LOOP: $? of the last body command, 0 if none ran
+    WordStream *values; // FRAME_LOOP: the words of a for, expanded as they are bound
+    Redirect *redirs; // FRAME_REDIRECT: the applied redirections
+    char *subject;    // FRAME_CASE: the expanded case word
+} Frame;
+
+static int emit(Code *code, int op, Node *node, int target)
+{
+    if (code->n == code->cap)
+    {
+        code->cap = code->cap ? code->cap * 2 : 16;
+        code->ops = realloc(code->ops, code->cap * sizeof(Instr));
+        if (!code->ops)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    code->ops[code->n] = (Instr){op, target, node};
+    return code->n++;
+}
+
+// Points the jump at `at` to the next instruction to be emitted
+static void patch(Code *code, int at)
+{
+    code->ops[at].target = code->n;
+}
+
+static void compile_into(Code *code, Node *node);
+
+// while/until: the condition runs first on every pass; OP_SAVE keeps the body's status
+static void compile_loop(Code *code, Node *node)
+{
+    int loop = emit(code, OP_LOOP, NULL, 0);
+    int top = code->n;
+    compile_into(code, node->children[0]);
+    int exit_jump = emit(code, node->type == NODE_WHILE ? OP_JUMP_NONZERO : OP_JUMP_ZERO, NULL, 0);
+    compile_into(code, node->children[1]);
+    emit(code, OP_SAVE, NULL, 0);
+    emit(code, OP_JUMP, NULL, top);
+    patch(code, exit_jump);
+    patch(code, loop);
+    emit(code, OP_END_LOOP, NULL, top);
+}
+
+static void compile_for(Code *code, Node *node)
+{
+    int loop = emit(code, OP_LOOP, node, 0);
+    int next = emit(code, OP_NEXT, node, 0);
+    compile_into(code, node->children[0]);
+    emit(code, OP_SAVE, NULL, 0);
+    emit(code, OP_JUMP, NULL, next);
+    patch(code, next);
+    patch(code, loop);
+    emit(code, OP_END_LOOP, NULL, next);
+}
+
+// for ((init; cond; step)): empty parts are left out, a missing condition is always true.
+// `continue` resumes at the step.
+static void compile_arith_for(Code *code, Node *node)
+{
+    if (node->words[0][strspn(node->words[0], " \t\n")] != '\0')
+    {
+        emit(code, OP_ARITH, node, 0);
+    }
+    int loop = emit(code, OP_LOOP, NULL, 0);
+    int top = code->n;
+    int exit_jump = -1;
+    if (node->words[1][strspn(node->words[1], " \t\n")] != '\0')
+    {
+        emit(code, OP_ARITH, node, 1);
+        exit_jump = emit(code, OP_JUMP_NONZERO, NULL, 0);
+    }
+    compile_into(code, node->children[0]);
+    emit(code, OP_SAVE, NULL, 0);
+    int step = code->n;
+    if (node->words[2][strspn(node->words[2], " \t\n")] != '\0')
+    {
+        emit(code, OP_ARITH, node, 2);
+    }
+    emit(code, OP_JUMP, NULL, top);
+    if (exit_jump != -1)
+    {
+        patch(code, exit_jump);
+    }
+    patch(code, loop);
+    emit(code, OP_END_LOOP, NULL, step);
+}
+
+static void compile_if(Code *code, Node *node)
+{
+    int *to_end = malloc(node->n_children * sizeof(int));
+    int n_to_end = 0;
+    int i;
+
+    if (!to_end)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i + 1 < node->n_children; i += 2)
+    {
+        compile_into(code, node->children[i]);
+        int skip = emit(code, OP_JUMP_NONZERO, NULL, 0);
+        compile_into(code, node->children[i + 1]);
+        to_end[n_to_end++] = emit(code, OP_JUMP, NULL, 0);
+        patch(code, skip);
+    }
+    if (i < node->n_children)
+    {
+        compile_into(code, node->children[i]); // else
+    }
+    else
+    {
+        emit(code, OP_STATUS, NULL, 0); // no branch taken
+    }
+    for (int j = 0; j < n_to_end; j++)
+    {
+        patch(code, to_end[j]);
+    }
+    free(to_end);
+}
+
+// All patterns are tested up front; each match jumps to its body, bodies jump to the end
+static void compile_case(Code *code, Node *node)
+{
+    int *matches = malloc((node->n_children + 1) * sizeof(int));
+    int *to_end = malloc((node->n_children + 1) * sizeof(int));
+
+    if (!matches || !to_end)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    emit(code, OP_CASE, node, 0);
+    for (int i = 0; i < node->n_children; i++)
+    {
+        matches[i] = emit(code, OP_MATCH, node->children[i], 0);
+    }
+    emit(code, OP_STATUS, NULL, 0);
+    to_end[node->n_children] = emit(code, OP_JUMP, NULL, 0);
+    for (int i = 0; i < node->n_children; i++)
+    {
+        Node *item = node->children[i];
+        patch(code, matches[i]);
+        if (item->n_children > 0)
+        {
+            compile_into(code, item->children[0]);
+        }
+        else
+        {
+            emit(code, OP_STATUS, NULL, 0);
+        }
+        to_end[i] = emit(code, OP_JUMP, NULL, 0);
+    }
+    for (int i = 0; i <= node->n_children; i++)
+    {
+        patch(code, to_end[i]);
+    }
+    emit(code, OP_END_CASE, NULL, 0);
+    free(matches);
+    free(to_end);
+}
+
+static void compile_into(Code *code, Node *node)
+{
+    int redirect = -1;
+    // a subshell applies its redirections itself, in the child, see launch_subshell
+    if (node->type != NODE_SIMPLE && node->type != NODE_SUBSHELL && node->redirs != NULL)
+    {
+        redirect = emit(code, OP_REDIRECT, node, 0);
+    }
+
+    switch (node->type)
+    {
+    case NODE_SIMPLE:
+    case NODE_SUBSHELL:
+        emit(code, OP_RUN, node, 0);
+        break;
+    case NODE_PIPELINE:
+        if (node->n_children == 1 && node->children[0]->type != NODE_SIMPLE)
+        {
+            compile_into(code, node->children[0]);
+        }
+        else
+        {
+            emit(code, OP_RUN, node, 0);
+        }
+        if (node->negate)
+        {
+            emit(code, OP_NOT, NULL, 0);
+        }
+        break;
+    case NODE_AND:
+    case NODE_OR:
+    {
+        // a skipped right side leaves $? alone, so `a && b || c` runs c when a fails
+        compile_into(code, node->children[0]);
+        int skip = emit(code, node->type == NODE_AND ? OP_JUMP_NONZERO : OP_JUMP_ZERO, NULL, 0);
+        compile_into(code, node->children[1]);
+        patch(code, skip);
+        break;
+    }
+    case NODE_LIST:
+        for (int i = 0; i < node->n_children; i++)
+        {
+            if (node->children[i]->background)
+            {
+                emit(code, OP_BACKGROUND, node->children[i], 0);
+            }
+            else
+            {
+                compile_into(code, node->children[i]);
+            }
+        }
+        break;
+    case NODE_GROUP:
+        compile_into(code, node->children[0]);
+        break;
+    case NODE_FOR:
+        compile_for(code, node);
+        break;
+    case NODE_WHILE:
+    case NODE_UNTIL:
+        compile_loop(code, node);
+        break;
+    case NODE_IF:
+        compile_if(code, node);
+        break;
+    case NODE_CASE:
+        compile_case(code, node);
+        break;
+    case NODE_FUNCTION:
+        emit(code, OP_DEFINE, node, 0);
+        break;
+    case NODE_ARITH:
+        emit(code, OP_ARITH, node, 0);
+        break;
+    case NODE_COND:
+        emit(code, OP_COND, node, 0);
+        break;
+    case NODE_ARITH_FOR:
+        compile_arith_for(code, node);
+        break;
+    }
+
+    if (redirect != -1)
+    {
+        patch(code, redirect);
+        emit(code, OP_RESTORE, NULL, 0);
+    }
+}
+
+Code *compile_node(Node *node)
+{
+    Code *code = calloc(1, sizeof(Code));
+    if (!code)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    compile_into(code, node);
+    return code;
+}
+
+void free_code(Code *code)
+{
+    if (code != NULL)
+    {
+        free(code->ops);
+        free(code);
+    }
+}
+
+static int case_matches(Node *item, const char *subject)
+{
+    for (int i = 0; item->words[i] != NULL; i++)
+    {
+        char *pattern = expand_pattern(item->words[i]);
+        int match = fnmatch(pattern, subject, 0) == 0;
+        free(pattern);
+        if (match)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static Frame *push_frame(Frame **frames, int *depth, int *cap, int kind)
+{
+    if (*depth == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 8;
+        *frames = realloc(*frames, *cap * sizeof(Frame));
+        if (!*frames)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Frame *frame = &(*frames)[(*depth)++];
+    memset(frame, 0, sizeof(Frame));
+    frame->kind = kind;
+    return frame;
+}
+
+static void drop_frame(Frame *frame)
+{
+    switch (frame->kind)
+    {
+    case FRAME_LOOP:
+        word_stream_free(frame->values);
+        loop_depth--;
+        break;
+    case FRAME_REDIRECT:
+        redirect_restore(frame->redirs);
+        free_redirections(frame->redirs);
+        break;
+    case FRAME_CASE:
+        free(frame->subject);
+        break;
+    }
+}
+
+// A break, continue or return is pending: pops frames up to the loop it targets and returns
+// where to resume. When that loop is not in this program, or on return, everything is popped
+// and the caller (a function or an outer program) carries on unwinding.
+static int unwind(Frame *frames, int *depth, int n_ops)
+{
+    while (*depth > 0)
+    {
+        if (func_returning)
+        {
+            drop_frame(&frames[--(*depth)]);
+            continue;
+        }
+        Frame *frame = &frames[*depth - 1];
+        if (frame->kind != FRAME_LOOP)
+        {
+            drop_frame(frame);
+            (*depth)--;
+            continue;
+        }
+        frame->status = last_status;
+        if (loop_break > 0)
+        {
+            loop_break--;
+            if (loop_break == 0 && !loop_continue)
+            {
+                return frame->end; // OP_END_LOOP pops the frame
+            }
+            drop_frame(frame);
+            (*depth)--;
+            continue;
+        }
+        loop_continue = 0;
+        return frame->resume;
+    }
+    return n_ops;
+}
+
+// Executes compiled instructions until the end, or until `exit` clears *run
+void run_code(Code *code, int *run)
+{
+    Frame *frames = NULL;
+    int depth = 0, cap = 0;
+    int pc = 0;
+
+    while (pc < code->n && *run != 0)
+    {
+        Instr *in = &code->ops[pc++];
+        switch (in->op)
+        {
+        case OP_RUN:
+            if (in->node->type == NODE_SIMPLE)
+            {
+                exec_simple(in->node, run);
+            }
+            else if (in->node->type == NODE_SUBSHELL)
+            {
+                run_pipeline(&in->node, 1, in->node->text, 0);
+            }
+            else if (in->node->n_children == 1)
+            {
+                exec_simple(in->node->children[0], run);
+            }
+            else
+            {
+                run_pipeline(in->node->children, in->node->n_children, in->node->text, 0);
+            }
+            break;
+        case OP_BACKGROUND:
+            exec_background(in->node);
+            break;
+        case OP_JUMP:
+            pc = in->target;
+            break;
+        case OP_JUMP_ZERO:
+            if (last_status == 0)
+            {
+                pc = in->target;
+            }
+            break;
+        case OP_JUMP_NONZERO:
+            if (last_status != 0)
+            {
+                pc = in->target;
+            }
+            break;
+        case OP_NOT:
+            set_exit_status(last_status == 0);
+            break;
+        case OP_STATUS:
+            set_exit_status(in->target);
+            break;
+        case OP_LOOP:
+        {
+            Frame *frame = push_frame(&frames, &depth, &cap, FRAME_LOOP);
+            frame->resume = code->ops[in->target].target;
+            frame->end = in->target;
+            if (in->node != NULL)
+            {
+                // `for name; do` walks the positional parameters
+                static char *all_params[] = {"\"$@\"", NULL};
+                frame->values = word_stream_new(in->node->words != NULL ? in->node->words : all_params);
+            }
+            loop_depth++;
+            break;
+        }
+        case OP_NEXT:
+        {
+            const char *value = word_stream_next(frames[depth - 1].values);
+            if (value == NULL)
+            {
+                pc = in->target;
+                break;
+            }
+            var_set(in->node->name, value);
+            break;
+        }
+        case OP_SAVE:
+            frames[depth - 1].status = last_status;
+            break;
+        case OP_END_LOOP:
+        {
+            int status = frames[depth - 1].status;
+            drop_frame(&frames[--depth]);
+            set_exit_status(status);
+            break;
+        }
+        case OP_REDIRECT:
+        {
+            int mark = procsub_mark();
+            Redirect *redirs = redirect_expand(in->node->redirs);
+            int applied = redirect_apply(redirs);
+            procsub_release(mark); // `done < <(cmd)` reads from its own copy of the pipe
+            if (applied == -1)
+            {
+                // the whole command is skipped, including its OP_RESTORE
+                free_redirections(redirs);
+                set_exit_status(1);
+                pc = in->target + 1;
+                break;
+            }
+            push_frame(&frames, &depth, &cap, FRAME_REDIRECT)->redirs = redirs;
+            break;
+        }
+        case OP_RESTORE:
+            drop_frame(&frames[--depth]);
+            break;
+        case OP_CASE:
+            push_frame(&frames, &depth, &cap, FRAME_CASE)->subject = expand_word_single(in->node->words[0]);
+            break;
+        case OP_MATCH:
+            if (case_matches(in->node, frames[depth - 1].subject))
+            {
+                pc = in->target;
+            }
+            break;
+        case OP_END_CASE:
+            drop_frame(&frames[--depth]);
+            break;
+        case OP_DEFINE:
+            func_define(in->node->name, in->node->children[0]);
+            set_exit_status(0);
+            break;
+        case OP_ARITH:
+        {
+            int64_t value;
+            if (arith_expand(in->node->words[in->target], &value) == -1)
+            {
+                set_exit_status(1);
+            }
+            else
+            {
+                set_exit_status(value == 0);
+            }
+            break;
+        }
+        case OP_COND:
+            set_exit_status(cond_eval(in->node->words));
+            break;
+        }
+
+        if (loop_break > 0 || loop_continue || func_returning)
+        {
+            pc = unwind(frames, &depth, code->n);
+        }
+    }
+
+    // left early through `exit` or an unwinding break: pop whatever is still open
+    while (depth > 0)
+    {
+        drop_frame(&frames[--depth]);
+    }
+    free(frames);
+}
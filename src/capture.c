@@ -0,0 +1,432 @@
+// capture.c
+#include "psh.h"
+
+// Builtins that only print. $( ) runs them inside the shell with stdout pointed at a memory
+// buffer; anything that could change the shell's state runs in a forked copy instead.
+static const char *printing_builtins[] = {"echo", "pwd", "type"};
+
+static int prints_only(char **argv, Redirect *redirs)
+{
+    if (redirs != NULL || argv[0] == NULL || func_exists(argv[0]))
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(printing_builtins) / sizeof(printing_builtins[0]); i++)
+    {
+        if (strcmp(argv[0], printing_builtins[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    // `alias` lists aliases, `alias name=value` would define one in the wrong process
+    if (strcmp(argv[0], "alias") == 0)
+    {
+        for (int i = 1; argv[i] != NULL; i++)
+        {
+            if (strchr(argv[i], '=') != NULL)
+            {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Drops the trailing newlines, as every shell does with captured output
+static char *trim_newlines(char *text, size_t len)
+{
+    while (len > 0 && text[len - 1] == '\n')
+    {
+        len--;
+    }
+    text[len] = '\0';
+    return text;
+}
+
+// Reads `fd` to the end into one growing buffer, starting at `hint` bytes
+static char *read_all(int fd, size_t hint, size_t *len)
+{
+    size_t cap = hint + 1 > 256 ? hint + 1 : 256;
+    char *data = malloc(cap);
+    ssize_t n;
+    *len = 0;
+    if (!data)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    while (1)
+    {
+        if (*len + 1 == cap)
+        {
+            cap *= 2;
+            data = realloc(data, cap);
+            if (!data)
+            {
+                fprintf(stderr, "psh: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        n = read(fd, data + *len, cap - *len - 1);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        *len += n;
+    }
+    data[*len] = '\0';
+    return data;
+}
+
+// $(<file): the contents of the file, read by the shell itself instead of running cat
+static char *read_file(const char *word)
+{
+    char *path = expand_word_single(word);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat stats;
+    size_t len;
+    if (fd == -1)
+    {
+        fprintf(stderr, "psh: %s: %s\n", path, strerror(errno));
+        free(path);
+        set_exit_status(1);
+        return strdup("");
+    }
+    char *data = read_all(fd, fstat(fd, &stats) == 0 && S_ISREG(stats.st_mode) ? (size_t)stats.st_size : 0, &len);
+    close(fd);
+    free(path);
+    set_exit_status(0);
+    return trim_newlines(data, len);
+}
+
+// Single word after `<` and nothing else, as in $(< file)
+static const char *redirect_only(const char *text)
+{
+    const char *s = text + strspn(text, " \t\n");
+    if (*s != '<' || s[1] == '<' || s[1] == '(')
+    {
+        return NULL;
+    }
+    s += 1 + strspn(s + 1, " \t\n");
+    TokenList list;
+    if (*s == '\0' || lex_line(s, &list) != PARSE_OK)
+    {
+        return NULL;
+    }
+    int single = list.n == 1 && list.tokens[0].type == TOK_WORD;
+    lex_free(&list);
+    return single ? s : NULL;
+}
+
+// Runs a printing builtin with stdout swapped for a memory stream, no fork and no pipe
+static char *capture_builtin(char **argv)
+{
+    char *data = NULL;
+    size_t len = 0;
+    FILE *saved = stdout;
+    FILE *memory = open_memstream(&data, &len);
+    if (memory == NULL)
+    {
+        return NULL;
+    }
+    fflush(stdout);
+    stdout = memory;
+    run_builtin(find_builtin(argv[0]), argv, NULL);
+    fclose(memory);
+    stdout = saved;
+    return trim_newlines(data, len);
+}
+
+// Starts the substituted commands with `plumbing` applied first: a simple command is
+// launched directly, anything else in a forked copy of the shell. Returns the child's pid or -1.
+static pid_t launch_capture(Node *node, char **argv, Redirect *redirs, const FdAction *plumbing, int n_plumbing,
+                            const sigset_t *mask)
+{
+    int n_actions = n_plumbing + count_redirections(redirs);
+    FdAction *actions = malloc(n_actions * sizeof(FdAction));
+    pid_t pid = -1;
+    if (!actions)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(actions, plumbing, n_plumbing * sizeof(FdAction));
+    // the command's own redirections come after the pipe, so $(cmd 2>&1) captures stderr
+    int n_redir = redirect_prepare(redirs, actions + n_plumbing);
+    if (n_redir == -1)
+    {
+        last_status = 1;
+    }
+    else
+    {
+        SpawnOptions opts = {mask, actions, n_plumbing + n_redir, -1, 0, NULL};
+        pid = argv != NULL ? launch_command(argv, &opts) : launch_subshell(node, &opts);
+    }
+    redirect_close(redirs);
+    free(actions);
+    return pid;
+}
+
+// The command a substitution runs directly: its outermost single command without `&`. Every
+// command comes wrapped in a pipeline, which has nothing to do when it has one stage and no `!`.
+static Node *single_command(Node *program)
+{
+    Node *node = program;
+    for (;;)
+    {
+        if (node->type == NODE_LIST && node->n_children == 1 && !node->children[0]->background)
+        {
+            node = node->children[0];
+        }
+        else if (node->type == NODE_PIPELINE && node->n_children == 1 && !node->negate && !node->background)
+        {
+            node = node->children[0];
+        }
+        else
+        {
+            return node;
+        }
+    }
+}
+
+// $(text) and `text`: runs the commands and returns what they wrote to stdout, without the
+// trailing newlines. $? is the status of the commands. External output streams through a
+// pipe into a growing buffer; printing builtins and $(<file) never start a process.
+char *command_output(const char *text)
+{
+    const char *file = redirect_only(text);
+    if (file != NULL)
+    {
+        return read_file(file);
+    }
+
+    Node *program;
+    int parsed = parse_program(text, &program);
+    if (parsed != PARSE_OK)
+    {
+        if (parsed == PARSE_INCOMPLETE)
+        {
+            fprintf(stderr, "psh: command substitution: unexpected end of file\n");
+        }
+        set_exit_status(2);
+        return strdup("");
+    }
+
+    Node *node = single_command(program);
+    char **argv = NULL;
+    Redirect *redirs = NULL;
+    int mark = procsub_mark();
+    if (node->type == NODE_SIMPLE && node->words != NULL && !is_assignment(node->words[0]))
+    {
+        int outer_error = expand_error; // this may be part of a bigger expansion
+        expand_error = 0;
+        argv = expand_words(node->words);
+        redirs = redirect_expand(node->redirs);
+        int failed = expand_error;
+        char *output = NULL;
+        expand_error = outer_error;
+        if (failed || argv[0] == NULL)
+        {
+            set_exit_status(failed);
+            output = strdup("");
+        }
+        else if (prints_only(argv, redirs))
+        {
+            output = capture_builtin(argv);
+        }
+        if (output != NULL)
+        {
+            procsub_release(mark);
+            free_double_pointer(argv);
+            free_redirections(redirs);
+            free_node(program);
+            return output;
+        }
+    }
+
+    int pipefd[2];
+    char *data;
+    size_t len = 0;
+    if (pipe2(pipefd, O_CLOEXEC) == -1)
+    {
+        perror("psh: pipe");
+        set_exit_status(1);
+        data = strdup("");
+    }
+    else
+    {
+        sigset_t sigset, oldset;
+        sigemptyset(&sigset);
+        sigaddset(&sigset, SIGINT);
+        sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+        FdAction out = {STDOUT_FILENO, pipefd[1]};
+        pid_t pid = launch_capture(node, argv, redirs, &out, 1, &oldset);
+        close(pipefd[1]);
+        procsub_release(mark);
+        data = read_all(pipefd[0], 0, &len);
+        close(pipefd[0]);
+
+        int status = 0;
+        pid_t done = pid;
+        while (pid > 0 && (done = jobs_wait_untracked(&status)) != pid && done != -1)
+        {
+            // another untracked child, not ours
+        }
+        if (pid > 0 && done == pid)
+        {
+            last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+        sigprocmask(SIG_SETMASK, &oldset, NULL);
+        set_exit_status(last_status);
+    }
+    procsub_release(mark);
+    free_double_pointer(argv);
+    free_redirections(redirs);
+    free_node(program);
+    return trim_newlines(data, len);
+}
+
+// Process substitution. The shell's ends of the pipes stay open, without close-on-exec, from
+// the expansion until the command that names them as /dev/fd/N has been started; the
+// children are reaped once they exit, whenever a command releases its substitutions.
+static int *procsub_fds = NULL;
+static int n_procsub_fds = 0;
+static pid_t *procsub_pids = NULL;
+static int n_procsub_pids = 0;
+static int procsub_cap = 0;
+
+static void procsub_reserve(void)
+{
+    if (n_procsub_fds < procsub_cap && n_procsub_pids < procsub_cap)
+    {
+        return;
+    }
+    procsub_cap = procsub_cap ? procsub_cap * 2 : 8;
+    procsub_fds = realloc(procsub_fds, procsub_cap * sizeof(int));
+    procsub_pids = realloc(procsub_pids, procsub_cap * sizeof(pid_t));
+    if (!procsub_fds || !procsub_pids)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Number of substitution fds open now, for procsub_release() once the command has run
+int procsub_mark(void)
+{
+    return n_procsub_fds;
+}
+
+// Closes the fds of the substitutions opened since `mark` and reaps the ones that finished
+void procsub_release(int mark)
+{
+    while (n_procsub_fds > mark)
+    {
+        close(procsub_fds[--n_procsub_fds]);
+    }
+    int n = 0;
+    for (int i = 0; i < n_procsub_pids; i++)
+    {
+        int status;
+        if (waitpid(procsub_pids[i], &status, WNOHANG) == 0)
+        {
+            procsub_pids[n++] = procsub_pids[i]; // still running
+        }
+    }
+    n_procsub_pids = n;
+}
+
+// <(text) and >(text): starts the commands with a pipe on their stdout, or with `output` on
+// their stdin, and returns the path of the shell's end as /dev/fd/N. They run alongside the
+// command that opens the path. The result is malloc'd.
+char *process_substitution(const char *text, int output)
+{
+    Node *program;
+    int parsed = parse_program(text, &program);
+    if (parsed != PARSE_OK)
+    {
+        if (parsed == PARSE_INCOMPLETE)
+        {
+            fprintf(stderr, "psh: process substitution: unexpected end of file\n");
+        }
+        set_exit_status(2);
+        return strdup("/dev/null");
+    }
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1)
+    {
+        perror("psh: pipe");
+        free_node(program);
+        set_exit_status(1);
+        return strdup("/dev/null");
+    }
+    int child_end = output ? pipefd[0] : pipefd[1];
+    int shell_end = output ? pipefd[1] : pipefd[0];
+
+    // the child gets its end of the pipe and none of the shell's ends, or a >( ) reader
+    // would hold a writer open and never see end of file
+    FdAction *plumbing = malloc((2 + n_procsub_fds) * sizeof(FdAction));
+    if (!plumbing)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    int n_plumbing = 0;
+    plumbing[n_plumbing++] = (FdAction){output ? STDIN_FILENO : STDOUT_FILENO, child_end};
+    plumbing[n_plumbing++] = (FdAction){shell_end, -1};
+    for (int i = 0; i < n_procsub_fds; i++)
+    {
+        plumbing[n_plumbing++] = (FdAction){procsub_fds[i], -1};
+    }
+
+    Node *node = single_command(program);
+    char **argv = NULL;
+    Redirect *redirs = NULL;
+    if (node->type == NODE_SIMPLE && node->words != NULL && !is_assignment(node->words[0]))
+    {
+        argv = expand_words(node->words);
+        redirs = redirect_expand(node->redirs);
+        if (argv[0] == NULL)
+        {
+            // nothing to run, the pipe just ends
+            free_double_pointer(argv);
+            argv = NULL;
+            node = NULL;
+        }
+    }
+
+    sigset_t current;
+    sigprocmask(SIG_SETMASK, NULL, &current);
+    pid_t pid = node != NULL ? launch_capture(node, argv, redirs, plumbing, n_plumbing, &current) : -1;
+    close(child_end);
+    free(plumbing);
+    free_double_pointer(argv);
+    free_redirections(redirs);
+    free_node(program);
+    procsub_reserve(); // the expansion above may have started substitutions of its own
+    if (pid > 0)
+    {
+        procsub_pids[n_procsub_pids++] = pid;
+    }
+
+    // above the low descriptors a redirection may target, and inherited by the command
+    int fd = fcntl(shell_end, F_DUPFD, 10);
+    close(shell_end);
+    if (fd == -1)
+    {
+        perror("psh: process substitution");
+        return strdup("/dev/null");
+    }
+    procsub_fds[n_procsub_fds++] = fd;
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+    return strdup(path);
+}
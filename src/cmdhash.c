@@ -0,0 +1,222 @@
+// cmdhash.c
+#include "psh.h"
+
+// Resolved command locations keyed by command name. A NULL path is a negative entry.
+typedef struct CmdHashEntry
+{
+    char *name;
+    char *path;
+    int hits;
+    struct CmdHashEntry *next;
+} CmdHashEntry;
+
+static CmdHashEntry *cmd_table[CMDHASH_SIZE];
+
+static int is_executable_file(const char *path)
+{
+    struct stat stats;
+    return stat(path, &stats) == 0 && S_ISREG(stats.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walks $PATH once, returns a malloc'd path or NULL if no directory has an executable `name`
+static char *search_path(const char *name)
+{
+    const char *path_env = var_get("PATH");
+    if (path_env == NULL)
+    {
+        path_env = "/usr/local/bin:/usr/bin:/bin";
+    }
+
+    size_t name_len = strlen(name);
+    char candidate[PATH_MAX];
+    const char *dir = path_env;
+    while (1)
+    {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        if (dir_len == 0)
+        {
+            // an empty $PATH component means the current directory
+            if (name_len + 3 <= sizeof(candidate))
+            {
+                snprintf(candidate, sizeof(candidate), "./%s", name);
+                if (is_executable_file(candidate))
+                {
+                    return strdup(candidate);
+                }
+            }
+        }
+        else if (dir_len + name_len + 2 <= sizeof(candidate))
+        {
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '/';
+            memcpy(candidate + dir_len + 1, name, name_len + 1);
+            if (is_executable_file(candidate))
+            {
+                return strdup(candidate);
+            }
+        }
+
+        if (end == NULL)
+        {
+            break;
+        }
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+static CmdHashEntry *cmdhash_find(const char *name)
+{
+    CmdHashEntry *entry = cmd_table[hash(name, CMDHASH_SIZE)];
+    while (entry != NULL)
+    {
+        if (strcmp(entry->name, name) == 0)
+        {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static CmdHashEntry *cmdhash_store(const char *name, char *path)
+{
+    CmdHashEntry *entry = cmdhash_find(name);
+    if (entry == NULL)
+    {
+        unsigned int index = hash(name, CMDHASH_SIZE);
+        entry = malloc(sizeof(CmdHashEntry));
+        if (entry == NULL)
+        {
+            perror("psh: malloc");
+            free(path);
+            return NULL;
+        }
+        entry->name = strdup(name);
+        entry->path = NULL;
+        entry->next = cmd_table[index];
+        cmd_table[index] = entry;
+    }
+    free(entry->path);
+    entry->path = path;
+    entry->hits = 0;
+    return entry;
+}
+
+// Returns the resolved location of `name`, or NULL when it is not on $PATH.
+// Names with a '/' are returned as-is. `launch` counts a hit and re-checks negative entries
+// so a freshly installed command is found; the prompt colouring trusts them as they are.
+// Only launches record misses, the colouring would leave one for every partial word typed.
+const char *cmdhash_lookup(const char *name, int launch)
+{
+    if (strchr(name, '/') != NULL)
+    {
+        return name;
+    }
+    if (name[0] == '\0')
+    {
+        return NULL;
+    }
+
+    CmdHashEntry *entry = cmdhash_find(name);
+    if (entry == NULL || (launch && entry->path == NULL))
+    {
+        char *path = search_path(name);
+        if (path == NULL && !launch)
+        {
+            return NULL;
+        }
+        entry = cmdhash_store(name, path);
+        if (entry == NULL)
+        {
+            return NULL;
+        }
+    }
+    if (launch && entry->path != NULL)
+    {
+        entry->hits++;
+    }
+    return entry->path;
+}
+
+void cmdhash_insert(const char *name, const char *path)
+{
+    char *copy = strdup(path);
+    if (copy != NULL)
+    {
+        cmdhash_store(name, copy);
+    }
+}
+
+void cmdhash_forget(const char *name)
+{
+    unsigned int index = hash(name, CMDHASH_SIZE);
+    CmdHashEntry *entry = cmd_table[index];
+    CmdHashEntry *prev = NULL;
+
+    while (entry != NULL)
+    {
+        if (strcmp(entry->name, name) == 0)
+        {
+            if (prev == NULL)
+            {
+                cmd_table[index] = entry->next;
+            }
+            else
+            {
+                prev->next = entry->next;
+            }
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        prev = entry;
+        entry = entry->next;
+    }
+}
+
+// Called whenever PATH is reassigned, every cached location may now be wrong
+void cmdhash_clear(void)
+{
+    for (int i = 0; i < CMDHASH_SIZE; i++)
+    {
+        CmdHashEntry *entry = cmd_table[i];
+        while (entry != NULL)
+        {
+            CmdHashEntry *delete = entry;
+            entry = entry->next;
+            free(delete->name);
+            free(delete->path);
+            free(delete);
+        }
+        cmd_table[i] = NULL;
+    }
+}
+
+void cmdhash_print(void)
+{
+    int printed = 0;
+    for (int i = 0; i < CMDHASH_SIZE; i++)
+    {
+        for (CmdHashEntry *entry = cmd_table[i]; entry != NULL; entry = entry->next)
+        {
+            if (entry->path == NULL)
+            {
+                continue; // negative entries are an internal detail
+            }
+            if (!printed)
+            {
+                printf("hits\tcommand\n");
+                printed = 1;
+            }
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+    if (!printed)
+    {
+        printf("psh: hash table empty\n");
+    }
+}
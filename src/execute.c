@@ -9,6 +9,14 @@ char session_id[32];
 char *history[PATH_MAX];
 int history_count = 0;
 int current_history = -1;
+int last_status = 0;
+int caller_status = 0; // $? from before the running builtin, which starts with last_status = 0
+
+// `break N` / `continue N` in flight: loops still to leave, and whether the loop reached
+// after that continues instead of stopping
+int loop_depth = 0;
+int loop_break = 0;
+int loop_continue = 0;
 
 //reverse search variables initialization
 reverse_search_state_t search_state = {0};
@@ -17,216 +25,425 @@ reverse_search_state_t search_state = {0};
 vim_state_t vim_state = {0};
 
 
-// Helper function to split the input line by ';'
-char **split_commands(char *input)
+void set_exit_status(int status)
 {
-    size_t bufsize = 64;
-    size_t position = 0;
-    char **commands = malloc(bufsize * sizeof(char *));
-    char *command_start = input;
-    int in_single_quote = 0;
-    int in_double_quote = 0;
+    last_status = status;
+}
 
-    if (!commands)
+// Resolves and starts one external command. Reports its own errors, returns -1 on failure
+// with last_status set to 127 (not found) or 126 (found but not runnable).
+static pid_t launch_external(char **token_arr, const SpawnOptions *opts)
+{
+    pid_t pid;
+    const char *path = cmdhash_lookup(token_arr[0], 1);
+    if (path == NULL)
     {
-        fprintf(stderr, "psh: allocation error\n");
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "psh: %s: command not found\n", token_arr[0]);
+        last_status = 127;
+        return -1;
     }
 
-    for (char *c = input; *c != '\0'; c++)
+    fflush(NULL); // keep our buffered output ahead of the child's
+    pid = psh_spawn(path, token_arr, opts);
+    if (pid < 0 && errno == ENOENT && path != token_arr[0])
     {
-        // Handle quotes
-        if (*c == '\'' && !in_double_quote)
+        // the remembered location has gone away, search $PATH once more
+        cmdhash_forget(token_arr[0]);
+        path = cmdhash_lookup(token_arr[0], 1);
+        if (path != NULL)
         {
-            in_single_quote = !in_single_quote;
-        }
-        else if (*c == '\"' && !in_single_quote)
-        {
-            in_double_quote = !in_double_quote;
+            pid = psh_spawn(path, token_arr, opts);
         }
+    }
+    if (pid < 0)
+    {
+        int err = path ? errno : ENOENT;
+        fprintf(stderr, "psh: %s: %s\n", token_arr[0], strerror(err));
+        last_status = err == ENOENT ? 127 : 126;
+    }
+    return pid;
+}
 
-        // Handle end of command
-        if (!in_single_quote && !in_double_quote && *c == ';')
+// Job text for `jobs`: the words joined back together
+static char *join_words(char **words, const char *separator)
+{
+    size_t len = 1;
+    for (int i = 0; words[i] != NULL; i++)
+    {
+        len += strlen(words[i]) + strlen(separator);
+    }
+    char *text = malloc(len);
+    if (!text)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    char *end = text;
+    for (int i = 0; words[i] != NULL; i++)
+    {
+        if (i > 0)
         {
-            commands[position] = malloc((c - command_start + 1) * sizeof(char));
-            if (!commands[position])
-            {
-                fprintf(stderr, "psh: allocation error\n");
-                exit(EXIT_FAILURE);
-            }
-            strncpy(commands[position], command_start, c - command_start);
-            commands[position][c - command_start] = '\0';
-            position++;
-
-            if (position >= bufsize)
-            {
-                bufsize += 64;
-                commands = realloc(commands, bufsize * sizeof(char *));
-                if (!commands)
-                {
-                    fprintf(stderr, "psh: allocation error\n");
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            command_start = c + 1;
+            end = stpcpy(end, separator);
         }
+        end = stpcpy(end, words[i]);
     }
+    *end = '\0';
+    return text;
+}
+
+// Runs an external command in the foreground. envp is the environment for `VAR=x cmd`,
+// NULL for the shell's exported variables.
+int PSH_EXEC_EXTERNAL(char **token_arr, Redirect *redirs, char **envp)
+{
+    pid_t pid;
+    sigset_t sigset, oldset;
+    int n_actions = count_redirections(redirs);
+    FdAction *actions = NULL;
 
-    // Handle the last command
-    if (command_start != input + strlen(input))
+    if (n_actions > 0)
     {
-        commands[position] = strdup(command_start);
-        if (!commands[position])
+        actions = malloc(n_actions * sizeof(FdAction));
+        if (!actions)
         {
             fprintf(stderr, "psh: allocation error\n");
             exit(EXIT_FAILURE);
         }
-        position++;
+        // files are opened here in the shell, the child only dup2()s them into place
+        n_actions = redirect_prepare(redirs, actions);
+        if (n_actions == -1)
+        {
+            free(actions);
+            set_exit_status(1);
+            return 1;
+        }
+    }
+
+    // Blocking SIGINT in the parent process
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGINT);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    char *command = join_words(token_arr, " ");
+    Job *job = job_new(command);
+    free(command);
+
+    SpawnOptions opts = {&oldset, actions, n_actions, job_spawn_pgid(job), 1, envp};
+    pid = launch_external(token_arr, &opts);
+    redirect_close(redirs);
+    free(actions);
+    if (pid < 0)
+    {
+        job->launch_status = last_status;
+    }
+    else
+    {
+        job_add_process(job, pid);
     }
 
-    commands[position] = NULL;
-    return commands;
+    // waits until it exits, or parks it in the job table if it is stopped
+    last_status = job_foreground(job, 0);
+
+    // Restoring the old signal mask
+    sigprocmask(SIG_SETMASK, &oldset, NULL);
+
+    set_exit_status(last_status);
+    return 1;
 }
-char **PSH_TOKENIZER(char *line)
+
+// Runs builtin `index` inside the shell process. Its redirections are applied to the shell's
+// own fds and undone afterwards, so `echo hi > file` never forks. Sets $?: a builtin that
+// returns 1 (keep running) reports failure by setting last_status.
+int run_builtin(int index, char **token_arr, Redirect *redirs)
 {
-    size_t bufsize = 64, position = 0, i;
-    char **token_arr = malloc(bufsize * sizeof(char *));
-    char *token;
-    int qstring = 0, has_quote = 0;
-    const char *delimiters = " \t\n";
-    char quote = '\0';
+    if (redirect_apply(redirs) == -1)
+    {
+        set_exit_status(1);
+        return 1;
+    }
+    caller_status = last_status;
+    last_status = 0;
+    int ret = (*builtin_func[index])(token_arr);
+    redirect_restore(redirs);
+    set_exit_status(ret == 1 ? last_status : ret);
+    return ret;
+}
 
-    if (!token_arr)
+// Opt-in bigger pipe buffers for high-throughput stages, e.g. PSH_PIPE_SIZE=1048576
+static void apply_pipe_size(int fd)
+{
+    const char *size = var_get("PSH_PIPE_SIZE");
+    if (size != NULL && atoi(size) > 0)
     {
-        fprintf(stderr, "psh: allocation error\n");
-        exit(EXIT_FAILURE);
+        // silently keep the default when the size is over /proc/sys/fs/pipe-max-size
+        fcntl(fd, F_SETPIPE_SZ, atoi(size));
     }
+}
 
-    token = strtok(line, " ");
-    while (token != NULL)
+int find_builtin(const char *name)
+{
+    for (int j = 0; j < size_builtin_str; j++)
     {
-        size_t len = strlen(token);
-        for (i = 0; i < strlen(token); i++)
+        if (strcmp(name, builtin_str[j]) == 0)
         {
-            if ((has_quote == 0) && (token[i] == '"' || token[i] == '\''))
-            {
-                quote = token[i];
-                has_quote = 1;
-                break;
-            }
-            else if (token[i] == quote)
-            {
-                has_quote = 1;
-                break;
-            }
-            else
-            {
-                has_quote = 0;
-            }
+            return j;
         }
+    }
+    return -1;
+}
 
-        if (has_quote == 1)
-        {
-            for (size_t j = i + 1; j < strlen(token); j++)
-            {
-                token[j - 1] = token[j];
-            }
-            token[strlen(token) - 1] = '\0';
-            len = strlen(token);
-        }
+// Starts one simple command as a child: externals through launch_external, functions and
+// builtins in a forked copy of the shell so they can stream into a pipe. Used by pipelines
+// and `parallel`.
+pid_t launch_command(char **token_arr, const SpawnOptions *opts)
+{
+    int function = func_exists(token_arr[0]);
+    int builtin = function ? -1 : find_builtin(token_arr[0]);
+    if (!function && builtin < 0)
+    {
+        return launch_external(token_arr, opts);
+    }
 
-        if (qstring == 0)
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        spawn_child_setup(opts);
+        caller_status = last_status;
+        last_status = 0;
+        if (function)
         {
-            token_arr[position] = malloc((len + 1) * sizeof(char));
-            strcpy(token_arr[position], token);
-            position++;
-        }
-        else
-        {
-            size_t prev_len = strlen(token_arr[position - 1]);
-            token_arr[position - 1] = realloc(token_arr[position - 1], (prev_len + len + 2) * sizeof(char));
-            if (token[len - 1] == quote)
-            {
-                token[len - 1] = '\0';
-            }
-            strcat(token_arr[position - 1], " ");
-            strcat(token_arr[position - 1], token);
+            int run = 1;
+            jobs_subshell();
+            func_call(token_arr, NULL, &run);
+            fflush(NULL);
+            _exit(last_status & 0xff);
         }
+        jobs_subshell();
+        int ret = (*builtin_func[builtin])(token_arr);
+        fflush(NULL);
+        _exit((ret == 1 ? last_status : ret) & 0xff);
+    }
+    else if (pid < 0)
+    {
+        perror("psh error");
+        last_status = 126;
+    }
+    else if (opts->pgid >= 0)
+    {
+        setpgid(pid, opts->pgid == 0 ? pid : opts->pgid);
+    }
+    return pid;
+}
 
-        if (position >= bufsize)
+// Forks a copy of the shell to run a compound command, e.g. a `for` loop feeding a pipe
+pid_t launch_subshell(Node *node, const SpawnOptions *opts)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int run = 1;
+        spawn_child_setup(opts);
+        jobs_subshell();
+        if (node->type == NODE_SUBSHELL)
         {
-            bufsize += 64;
-            token_arr = realloc(token_arr, bufsize * sizeof(char *));
-            if (!token_arr)
+            // ( list ) > file: the redirections wrap the list inside this child
+            Redirect *redirs = redirect_expand(node->redirs);
+            if (expand_error || redirect_apply(redirs) == -1)
             {
-                fprintf(stderr, "psh: allocation error\n");
-                exit(EXIT_FAILURE);
+                _exit(1);
             }
+            node = node->children[0];
         }
+        exec_node(node, &run);
+        fflush(NULL);
+        _exit(last_status & 0xff);
+    }
+    else if (pid < 0)
+    {
+        perror("psh error");
+        last_status = 126;
+    }
+    else if (opts->pgid >= 0)
+    {
+        setpgid(pid, opts->pgid == 0 ? pid : opts->pgid);
+    }
+    return pid;
+}
 
-        if (has_quote == 1)
-        {
-            qstring = !(qstring);
-        }
-        token = strtok(NULL, delimiters);
+// Skips the [subscript] at `p`, brackets inside it nest. NULL when it does not close.
+static const char *skip_subscript(const char *p)
+{
+    int depth = 0;
+    do
+    {
+        depth += (*p == '[') - (*p == ']');
+        p++;
+    } while (depth > 0 && *p != '\0');
+    return depth == 0 ? p : NULL;
+}
+
+// The '=' of a NAME=value, NAME+=value or NAME[subscript]=value word, NULL for any other word
+static const char *assignment_op(const char *word)
+{
+    const char *p = word;
+    if (!isalpha((unsigned char)*p) && *p != '_')
+    {
+        return NULL;
+    }
+    while (isalnum((unsigned char)*p) || *p == '_')
+    {
+        p++;
+    }
+    if (*p == '[' && (p = skip_subscript(p)) == NULL)
+    {
+        return NULL;
     }
-    token_arr[position] = NULL;
-    return token_arr;
+    p += p[0] == '+' && p[1] == '=';
+    return *p == '=' ? p : NULL;
 }
 
-int PSH_EXEC_EXTERNAL(char **token_arr)
+int is_assignment(const char *word)
+{
+    return assignment_op(word) != NULL;
+}
+
+// Number of leading NAME=value words of a simple command
+static int count_assignments(char **words)
+{
+    int n = 0;
+    while (words != NULL && words[n] != NULL && is_assignment(words[n]))
+    {
+        n++;
+    }
+    return n;
+}
+
+// Runs `a | b | c` as one job: every stage is started before anything is waited on.
+// Simple stages are expanded here and launched directly, anything else runs in a forked shell.
+// $? is the status of the last stage. A background job is left running with $? = 0.
+void run_pipeline(Node **stages, int n, const char *command, int background)
 {
-    pid_t pid, wpid;
-    int status;
     sigset_t sigset, oldset;
+    int last_failed = 0;
 
     // Blocking SIGINT in the parent process
     sigemptyset(&sigset);
     sigaddset(&sigset, SIGINT);
     sigprocmask(SIG_BLOCK, &sigset, &oldset);
 
-    pid = fork();
-    if (pid == 0)
-    {
-        // Restoring the default SIGINT behavior in the child process
-        sigprocmask(SIG_SETMASK, &oldset, NULL);
-        signal(SIGINT, SIG_DFL);
+    Job *job = job_new(command);
 
-        // Child process
-        if (execvp(token_arr[0], token_arr) == -1)
+    int prev_read = -1;
+    for (int i = 0; i < n; i++)
+    {
+        Node *stage = stages[i];
+        int direct = stage->type == NODE_SIMPLE && count_assignments(stage->words) == 0 && stage->words != NULL;
+        int mark = procsub_mark();
+        expand_error = 0;
+        char **argv = direct ? expand_words(stage->words) : NULL;
+        Redirect *redirs = direct ? redirect_expand(stage->redirs) : NULL;
+        int pipefd[2] = {-1, -1};
+        FdAction *actions = malloc((2 + count_redirections(redirs)) * sizeof(FdAction));
+        int n_actions = 0;
+        pid_t pid;
+
+        if (!actions)
         {
-            perror("psh error");
+            fprintf(stderr, "psh: allocation error\n");
             exit(EXIT_FAILURE);
         }
-    }
-    else if (pid < 0)
-    {
-        // Forking error
-        perror("psh error");
-    }
-    else
-    {
-        // Parent process
-        do
+
+        if (i < n - 1)
         {
-            wpid = waitpid(pid, &status, WUNTRACED);
-            if (wpid == -1)
+            // O_CLOEXEC: only the dup2'd copies survive into the children
+            if (pipe2(pipefd, O_CLOEXEC) == -1)
             {
-                perror("waitpid");
-                exit(EXIT_FAILURE);
+                perror("psh: pipe");
+                pipefd[0] = pipefd[1] = -1;
             }
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+            else
+            {
+                apply_pipe_size(pipefd[1]);
+            }
+        }
+
+        if (prev_read != -1)
+        {
+            actions[n_actions++] = (FdAction){STDIN_FILENO, prev_read};
+        }
+        if (pipefd[1] != -1)
+        {
+            actions[n_actions++] = (FdAction){STDOUT_FILENO, pipefd[1]};
+        }
 
-        // Restoring the old signal mask
-        sigprocmask(SIG_SETMASK, &oldset, NULL);
+        // a stage's own redirections come after the pipe plumbing, so `cmd 2>&1 | less` works
+        int n_redir = redirect_prepare(redirs, actions + n_actions);
+        if (n_redir == -1 || (direct && expand_error))
+        {
+            pid = -1;
+            last_status = 1;
+        }
+        else
+        {
+            // the first stage leads the job's process group, the others join it
+            SpawnOptions opts = {&oldset, actions, n_actions + n_redir, job_spawn_pgid(job), !background, NULL};
+            if (!direct)
+            {
+                pid = launch_subshell(stage, &opts);
+            }
+            else if (argv[0] == NULL)
+            {
+                // every word expanded to nothing: the stage is an empty command
+                pid = -1;
+                last_status = 0;
+            }
+            else
+            {
+                pid = launch_command(argv, &opts);
+            }
+        }
+        redirect_close(redirs);
+        procsub_release(mark); // the stage has its copies of the /dev/fd paths
+        free_redirections(redirs);
+        free_double_pointer(argv);
+        free(actions);
+        if (pid > 0)
+        {
+            job_add_process(job, pid);
+        }
+        else if (i == n - 1)
+        {
+            last_failed = 1;
+            job->launch_status = last_status;
+        }
 
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        if (prev_read != -1)
+        {
+            close(prev_read);
+        }
+        if (pipefd[1] != -1)
         {
-            fprintf(stdout, "psh: Incorrect arguments or no arguments provided. Try \"man %s\" for usage details.\n", token_arr[0]);
+            close(pipefd[1]);
         }
+        prev_read = pipefd[0];
     }
-    return 1;
+
+    int last = job->launch_status;
+    if (background && job->n_procs > 0)
+    {
+        job_background(job, 0);
+        last = last_failed ? last : 0;
+    }
+    else
+    {
+        int status = job_foreground(job, 0);
+        last = last_failed ? last : status;
+    }
+
+    // Restoring the old signal mask
+    sigprocmask(SIG_SETMASK, &oldset, NULL);
+    set_exit_status(last);
 }
 
 void handle_input(char **inputline, size_t *n, const char *PATH)
@@ -257,10 +474,22 @@ void handle_input(char **inputline, size_t *n, const char *PATH)
 
     while (1)
     {
+        if (SIGCHLD_PENDING)
+        {
+            jobs_reap(); // collect finished background jobs without blocking the prompt
+        }
         if (SIGNAL)
         {
             SIGNAL = 0;         // Reset the signal flag
             printf("\r\033[K"); // Clear the current line
+            if (prompt_continuation)
+            {
+                // give up on the open command and go back to the main prompt
+                prompt_continuation = 0;
+                buffer[0] = '\0';
+                printf("\n");
+                break;
+            }
             print_prompt(PATH); // Prompt again
         }
         if (kbhit())
@@ -356,7 +585,7 @@ void handle_input(char **inputline, size_t *n, const char *PATH)
                 if (remove(path_session) == 0)
                 {
                     disableRawMode();
-                    exit(atoi(getenv("?")));
+                    exit(last_status);
                 }
                 else
                 {
@@ -434,16 +663,16 @@ void handle_input(char **inputline, size_t *n, const char *PATH)
                     printf("\r\033[K"); // Clear the current line
                     print_prompt(PATH);
 
-                    char buff1[1024];
-                    char buff2[1024];
-                    struct stat stats;
-                    snprintf(buff1, sizeof(buffer) + 9, "/usr/bin/%s", buffer);
-                    snprintf(buff2, sizeof(buffer) + 5, "/bin/%s", buffer);
+                    // Colour by the first word only, looked up through the shared command cache
+                    char first_word[MAX_LINE_LENGTH];
+                    size_t word_len = strcspn(buffer, " \t");
+                    memcpy(first_word, buffer, word_len);
+                    first_word[word_len] = '\0';
 
                     int is_builtin = 0;
                     for (int i = 0; i < size_builtin_str; i++)
                     {
-                        if (strncmp(buffer, builtin_str[i], strlen(builtin_str[i])) == 0)
+                        if (strcmp(first_word, builtin_str[i]) == 0)
                         {
                             is_builtin = 1;
                             break;
@@ -451,7 +680,7 @@ void handle_input(char **inputline, size_t *n, const char *PATH)
                     }
 
                     // Print the buffer with appropriate color
-                    if (is_builtin || (stat(buff1, &stats) == 0) || (stat(buff2, &stats) == 0))
+                    if (is_builtin || cmdhash_lookup(first_word, 0) != NULL)
                     {
                         // printf(COLOR_GREEN "%s" COLOR_RESET, buffer);
                         printf("%s%s%s", GRN, buffer, reset);
@@ -477,12 +706,6 @@ void handle_input(char **inputline, size_t *n, const char *PATH)
     }
     *n = strlen(*inputline);
 
-    char *comment_pos = strchr(*inputline, '#');
-    if (comment_pos)
-    {
-        *comment_pos = '\0';
-    }
-
     if (strlen(*inputline) > 0)
     {
         if (history_count == PATH_MAX)
@@ -531,133 +754,357 @@ void save_history(const char *inputline, const char *path_session)
     }
 }
 
-void process_commands(char *inputline, int *run)
+// Parses `text` and runs it. Returns PARSE_INCOMPLETE without running anything when the
+// text stops inside a quote or compound command, so the caller can read more lines.
+int process_commands(const char *text, int *run)
 {
-    char **commands = split_commands(inputline);
-
-    for (int i = 0; commands[i] != NULL; i++)
+    Node *program;
+    int result = parse_program(text, &program);
+    if (result == PARSE_ERROR)
     {
-        char **token_arr = PSH_TOKENIZER(commands[i]);
+        set_exit_status(2);
+    }
+    else if (result == PARSE_OK)
+    {
+        exec_node(program, run);
+        free_node(program);
+    }
+    return result;
+}
 
-        if (token_arr[0] != NULL)
+// NAME=(a b [k]=v ...), NAME+=(...) appends. `list` is the text with its parentheses. The
+// words between them are lexed like a command line and expanded into elements, while a
+// [subscript]=value word sets one element. Returns -1 when an element could not be assigned.
+int assign_array(const char *name, const char *list, int append)
+{
+    char *inner = strndup(list + 1, strlen(list) - 2);
+    TokenList tokens;
+    int ret = 0;
+    if (lex_line(inner, &tokens) != PARSE_OK)
+    {
+        fprintf(stderr, "psh: %s: bad array assignment\n", name);
+        free(inner);
+        return -1;
+    }
+    if (!append && var_array_clear(name) == -1)
+    {
+        ret = -1;
+    }
+    for (int i = 0; ret == 0 && i < tokens.n; i++)
+    {
+        const char *word = tokens.tokens[i].text;
+        const char *eq = word[0] == '[' ? skip_subscript(word) : NULL;
+        if (tokens.tokens[i].type != TOK_WORD)
         {
-            if (!strcmp(token_arr[0], "exit"))
+            continue;
+        }
+        if (eq != NULL && *eq != '=')
+        {
+            eq = NULL; // a word that only starts with a bracket
+        }
+        if (eq != NULL)
+        {
+            char *subscript = strndup(word + 1, eq - word - 2);
+            char *key = expand_word_single(subscript);
+            char *value = expand_word_single(eq + 1);
+            char *ref = malloc(strlen(name) + strlen(key) + 3);
+            if (!ref)
             {
-                free(inputline);
-                free_double_pointer(commands);
-                free_history();
+                fprintf(stderr, "psh: allocation error\n");
+                exit(EXIT_FAILURE);
             }
-
-            // color_check(token_arr);
-
-            execute_command(token_arr, run);
+            sprintf(ref, "%s[%s]", name, key);
+            ret = var_set(ref, value);
+            free(ref);
+            free(subscript);
+            free(key);
+            free(value);
+            continue;
         }
-
-        free_double_pointer(token_arr);
+        char *one[] = {(char *)word, NULL};
+        char **values = expand_words(one);
+        for (int j = 0; ret == 0 && values[j] != NULL; j++)
+        {
+            ret = var_array_push(name, values[j]);
+        }
+        free_double_pointer(values);
     }
-
-    free_double_pointer(commands);
-    run = 0;
+    lex_free(&tokens);
+    free(inner);
+    return ret;
 }
 
-void execute_command(char **token_arr, int *run)
+// NAME=value or NAME+=value: the value is expanded but never split. A [subscript] is
+// expanded too, and NAME=( ... ) assigns a whole array. Returns -1 when the assignment
+// failed, e.g. on a readonly variable.
+static int assign_variable(const char *word)
 {
+    const char *eq = assignment_op(word);
+    int append = eq[-1] == '+';
+    char *name = strndup(word, eq - word - append);
+    size_t len = strlen(eq + 1);
+    int ret;
 
-    HashMap *map = create_map(HASHMAP_SIZE);
-    char ALIAS[PATH_MAX];
-    get_alias_path(ALIAS, sizeof(ALIAS), cwd);
-    load_aliases(map, ALIAS);
-
-    if (find(map, token_arr[0]))
+    if (eq[1] == '(' && len >= 2 && eq[len] == ')' && strchr(name, '[') == NULL)
     {
-        int position = 0;
-        char **temp = replace_alias(map, token_arr);
-        int size = 0;
-        size_t bufsize = 64;
-
-        free_double_pointer(token_arr);
-
-        char **token_arr = malloc(bufsize * sizeof(char *));
+        ret = assign_array(name, eq + 1, append);
+        free(name);
+        return ret;
+    }
+    char *open = strchr(name, '[');
+    if (open != NULL)
+    {
+        // name[$i] and name["$key"]: the subscript is expanded, the store evaluates the rest
+        name[strlen(name) - 1] = '\0';
+        *open = '\0';
+        char *key = expand_word_single(open + 1);
+        char *ref = malloc(strlen(name) + strlen(key) + 3);
+        if (!ref)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(ref, "%s[%s]", name, key);
+        free(key);
+        free(name);
+        name = ref;
+    }
+    char *value = expand_word_single(eq + 1);
+    ret = append ? var_append(name, value) : var_set(name, value);
+    free(name);
+    free(value);
+    return ret;
+}
 
-        while (temp[position] != NULL)
+// A variable replaced by a `VAR=x` prefix while a builtin or function runs
+typedef struct PrefixVar
+{
+    char *name;
+    char *value; // NULL when it was unset
+    int attrs;
+    int assigned;
+} PrefixVar;
+
+// `VAR=x cmd` for a builtin or function: they run inside the shell, so the variables are
+// assigned and exported for the duration of the command and put back afterwards
+static void execute_with_prefix(char **words, int n_assign, char **argv, Redirect *redirs, int *run)
+{
+    PrefixVar *saved = malloc(n_assign * sizeof(PrefixVar));
+    int failed = 0;
+    if (!saved)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n_assign; i++)
+    {
+        const char *eq = assignment_op(words[i]);
+        saved[i].name = strndup(words[i], eq - words[i] - (eq[-1] == '+'));
+        const char *value = var_get(saved[i].name);
+        saved[i].value = value != NULL ? strdup(value) : NULL;
+        saved[i].attrs = var_attrs(saved[i].name);
+        saved[i].assigned = assign_variable(words[i]) == 0;
+        if (saved[i].assigned)
         {
-            token_arr[position] = strdup(temp[position]);
-            position++;
+            var_export(saved[i].name);
         }
+        failed |= !saved[i].assigned || expand_error;
+    }
+
+    if (failed)
+    {
+        set_exit_status(1);
+    }
+    else
+    {
+        execute_command(argv, redirs, NULL, run);
+    }
 
-        if (position >= size)
+    // backwards, so in `X=1 X=2 cmd` the value from before the first one is what remains
+    for (int i = n_assign - 1; i >= 0; i--)
+    {
+        PrefixVar *var = &saved[i];
+        if (var->assigned && var->value == NULL)
         {
-            size += 64;
-            token_arr = realloc(token_arr, size * sizeof(char *));
-            if (!token_arr)
+            var_unset(var->name);
+            if (var->attrs != 0)
             {
-                fprintf(stderr, "psh: allocation error\n");
-                for (int i = 0; i < position; i++)
-                {
-                    free(token_arr[i]);
-                }
-                free(token_arr);
-                exit(EXIT_FAILURE);
+                var_declare(var->name, var->attrs, 0);
             }
         }
-        token_arr[position] = '\0';
-        free_double_pointer(temp);
+        else if (var->assigned)
+        {
+            var_declare(var->name, 0, ~var->attrs & (VAR_INTEGER | VAR_EXPORTED));
+            var_set(var->name, var->value);
+        }
+        free(var->name);
+        free(var->value);
     }
+    free(saved);
+}
 
-    free_map(map);
-    if (strchr(token_arr[0], '='))
+// `VAR=x cmd` for an external command: the NAME=value entries of its environment. Returns
+// NULL without running anything when one of the variables is readonly.
+static char **expand_prefix(char **words, int n_assign)
+{
+    char **prefix = malloc((n_assign + 1) * sizeof(char *));
+    if (!prefix)
     {
-        handle_env_variable(token_arr);
-        return;
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
     }
-    for (int j = 0; j < size_builtin_str; j++)
+    for (int i = 0; i < n_assign; i++)
     {
-        if (strcmp(token_arr[0], builtin_str[j]) == 0)
+        const char *eq = assignment_op(words[i]);
+        int append = eq[-1] == '+';
+        char *name = strndup(words[i], eq - words[i] - append);
+        if (var_attrs(name) & VAR_READONLY)
         {
+            fprintf(stderr, "psh: %s: readonly variable\n", name);
+            free(name);
+            prefix[i] = NULL;
+            free_double_pointer(prefix);
+            return NULL;
+        }
+        char *value = expand_word_single(eq + 1);
+        const char *old = append ? var_get(name) : NULL;
+        size_t len = strlen(name) + (old ? strlen(old) : 0) + strlen(value) + 2;
+        prefix[i] = malloc(len);
+        if (!prefix[i])
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(prefix[i], len, "%s=%s%s", name, old ? old : "", value);
+        free(name);
+        free(value);
+    }
+    prefix[n_assign] = NULL;
+    return prefix;
+}
 
-            *run = (*builtin_func[j])(token_arr);
-            char buf[2];
-            if (*run == 1)
-            {
-                buf[0] = (*run - 1 + '0');
-            }
-            else
-            {
-                buf[0] = (*run + '0');
-            }
-            buf[1] = '\0';
-            setenv("?", buf, 1);
-            return;
+// Expands a simple command's words and redirections and runs it in the foreground. Leading
+// assignments change the shell only when there is no command, otherwise they are for the
+// command alone.
+void exec_simple(Node *node, int *run)
+{
+    int n_assign = count_assignments(node->words);
+    int mark = procsub_mark();
+    expand_error = 0;
+    expand_substituted = 0;
+    char **argv = expand_words(node->words != NULL ? node->words + n_assign : NULL);
+    Redirect *redirs = redirect_expand(node->redirs);
+    if (expand_error)
+    {
+        // e.g. ${VAR:?} on an unset VAR, the command does not run
+        set_exit_status(1);
+    }
+    else if (argv[0] == NULL)
+    {
+        int failed = 0;
+        for (int i = 0; i < n_assign; i++)
+        {
+            failed |= assign_variable(node->words[i]) == -1;
+        }
+        if (redirs == NULL || expand_error)
+        {
+            // x=$(cmd) reports the status of cmd
+            set_exit_status(failed || expand_error ? 1 : expand_substituted ? last_status : 0);
         }
+        else
+        {
+            execute_command(argv, redirs, NULL, run);
+        }
+    }
+    else if (n_assign == 0)
+    {
+        execute_command(argv, redirs, NULL, run);
     }
-    if (!contains_wildcard(token_arr))
+    else if (func_exists(argv[0]) || find_builtin(argv[0]) >= 0)
     {
-        char buf[2];
-        *run = PSH_EXEC_EXTERNAL(token_arr);
-        if (*run == 1)
+        execute_with_prefix(node->words, n_assign, argv, redirs, run);
+    }
+    else
+    {
+        // an external command gets the cached environment with the prefixes on top
+        char **prefix = expand_prefix(node->words, n_assign);
+        if (prefix == NULL || expand_error)
         {
-            buf[0] = (*run - 1 + '0');
+            set_exit_status(1);
         }
         else
         {
-            buf[0] = (*run + '0');
+            char **envp = var_environ_with(prefix);
+            execute_command(argv, redirs, envp, run);
+            free(envp);
         }
-        buf[1] = '\0';
-        setenv("?", buf, 1);
+        free_double_pointer(prefix);
     }
+    procsub_release(mark);
+    free_redirections(redirs);
+    free_double_pointer(argv);
+}
 
+// Runs one item of a list in the background as its own job
+void exec_background(Node *node)
+{
+    if (node->type == NODE_PIPELINE)
+    {
+        run_pipeline(node->children, node->n_children, node->text, 1);
+    }
     else
     {
-        if (strchr(token_arr[0], '?') || strchr(token_arr[0], '?'))
+        // `a && b &`: the whole and-or list runs in a forked shell
+        run_pipeline(&node, 1, node->text, 1);
+    }
+}
+
+// The one executor behind scripts and the prompt. Compound commands are compiled to
+// instructions on their first run and the code is kept on the node, so a loop body is
+// parsed and compiled once however often it executes. Words are expanded only when run.
+void exec_node(Node *node, int *run)
+{
+    if (node->type == NODE_SIMPLE)
+    {
+        exec_simple(node, run);
+        return;
+    }
+    if (node->code == NULL)
+    {
+        node->code = compile_node(node);
+    }
+    run_code(node->code, run);
+}
+
+// Runs one foreground simple command; token_arr, redirs and envp belong to the caller.
+// envp is only used by external commands, NULL gives them the shell's exported variables.
+void execute_command(char **token_arr, Redirect *redirs, char **envp, int *run)
+{
+    if (token_arr[0] == NULL)
+    {
+        // a bare `> file` just creates/truncates the file
+        if (redirect_apply(redirs) == 0)
         {
-            fprintf(stdout, "psh: No command found: %s\n", token_arr[0]);
+            redirect_restore(redirs);
+            set_exit_status(0);
         }
         else
         {
-            // func to handle wildcards
-            handle_wildcard(token_arr[1]);
+            set_exit_status(1);
         }
     }
+    else if (func_call(token_arr, redirs, run))
+    {
+        // ran as a shell function
+    }
+    else if (find_builtin(token_arr[0]) >= 0)
+    {
+        *run = run_builtin(find_builtin(token_arr[0]), token_arr, redirs);
+    }
+    else
+    {
+        *run = PSH_EXEC_EXTERNAL(token_arr, redirs, envp);
+    }
 }
 
 char* reverse_search() {
@@ -0,0 +1,1165 @@
+// expand.c
+#include "psh.h"
+
+// Growable output for one word being expanded
+typedef struct ExpandBuf
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} ExpandBuf;
+
+int expand_error = 0;       // an expansion failed, the command using it should not run
+int expand_substituted = 0; // a command substitution ran, $? is its status
+
+// Growable NULL-terminated field list
+typedef struct FieldList
+{
+    char **fields;
+    int n;
+    int cap;
+    int glob; // fields are glob patterns: expand them to the matching paths
+} FieldList;
+
+static void buf_reserve(ExpandBuf *buf, size_t extra)
+{
+    if (buf->len + extra + 1 <= buf->cap)
+    {
+        return;
+    }
+    while (buf->len + extra + 1 > buf->cap)
+    {
+        buf->cap = buf->cap ? buf->cap * 2 : 64;
+    }
+    buf->data = realloc(buf->data, buf->cap);
+    if (!buf->data)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void buf_append(ExpandBuf *buf, const char *text, size_t len)
+{
+    buf_reserve(buf, len);
+    memcpy(buf->data + buf->len, text, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+static void buf_putc(ExpandBuf *buf, char c)
+{
+    buf_append(buf, &c, 1);
+}
+
+// What quoted text turns into: itself, or a glob or extended regex matching only itself
+#define PATTERN_NONE 0
+#define PATTERN_GLOB 1
+#define PATTERN_REGEX 2
+
+// Appends text that came from a quoted part. In a pattern its special characters are escaped
+// so that they only match themselves.
+static void buf_append_literal(ExpandBuf *buf, const char *text, size_t len, int pattern)
+{
+    if (pattern == PATTERN_NONE)
+    {
+        buf_append(buf, text, len);
+        return;
+    }
+    const char *special = pattern == PATTERN_REGEX ? "\\.[]()*+?{}|^$" : "*?[]\\";
+    for (size_t i = 0; i < len; i++)
+    {
+        if (strchr(special, text[i]) != NULL)
+        {
+            buf_putc(buf, '\\');
+        }
+        buf_putc(buf, text[i]);
+    }
+}
+
+static void fields_add(FieldList *list, char *field)
+{
+    if (list->n + 1 >= list->cap)
+    {
+        list->cap = list->cap ? list->cap * 2 : 8;
+        list->fields = realloc(list->fields, list->cap * sizeof(char *));
+        if (!list->fields)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->fields[list->n++] = field;
+    list->fields[list->n] = NULL;
+}
+
+// Ends the field in `buf`. A glob field becomes its sorted matches, or, when nothing matches
+// or it is no pattern at all, itself with the quoting backslashes removed.
+static void fields_push(FieldList *list, ExpandBuf *buf)
+{
+    char *field = strndup(buf->data ? buf->data : "", buf->len);
+    buf->len = 0;
+    if (!list->glob || strpbrk(field, "*?[\\") == NULL)
+    {
+        fields_add(list, field);
+        return;
+    }
+    char **matches = glob_is_pattern(field) ? glob_expand(field) : NULL;
+    if (matches != NULL)
+    {
+        for (int i = 0; matches[i] != NULL; i++)
+        {
+            fields_add(list, matches[i]);
+        }
+        free(matches);
+        free(field);
+        return;
+    }
+    char *to = field;
+    for (const char *from = field; *from; from++)
+    {
+        if (*from == '\\' && from[1] != '\0')
+        {
+            from++;
+        }
+        *to++ = *from;
+    }
+    *to = '\0';
+    fields_add(list, field);
+}
+
+static int is_name_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static const char *parameter(const char **p, ExpandBuf *scratch);
+
+// ${name[subscript]}: one element, or for name[@] and name[*] all of them joined by spaces
+static const char *element(const char *name, const char *open, ExpandBuf *scratch)
+{
+    char *base = strndup(name, open - name);
+    char *subscript = strndup(open + 1, strlen(open) - 2);
+    const char *value;
+    if (strcmp(subscript, "@") == 0 || strcmp(subscript, "*") == 0)
+    {
+        char **list = var_array_list(base, 0);
+        scratch->len = 0;
+        buf_reserve(scratch, 0);
+        scratch->data[0] = '\0';
+        for (int i = 0; list != NULL && list[i] != NULL; i++)
+        {
+            if (i > 0)
+            {
+                buf_putc(scratch, ' ');
+            }
+            buf_append(scratch, list[i], strlen(list[i]));
+        }
+        value = list != NULL ? scratch->data : NULL;
+        free_double_pointer(list);
+    }
+    else
+    {
+        // $i, "$key" and friends in the subscript; an indexed array evaluates the rest
+        char *key = expand_word_single(subscript);
+        char *ref = malloc(strlen(base) + strlen(key) + 3);
+        if (!ref)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        sprintf(ref, "%s[%s]", base, key);
+        value = var_get(ref);
+        free(ref);
+        free(key);
+    }
+    free(base);
+    free(subscript);
+    return value;
+}
+
+// Value of the parameter called `name`: a variable, an array element, $1 ... or one of the
+// special ones such as $? or $@. Computed values are built in `scratch`.
+static const char *lookup(const char *name, ExpandBuf *scratch)
+{
+    const char *open = strchr(name, '[');
+    if (open != NULL)
+    {
+        return element(name, open, scratch);
+    }
+    if (name[0] != '\0' && name[1] == '\0' && strchr("?$!#@*", name[0]) != NULL)
+    {
+        char fake[3] = {'$', name[0], '\0'};
+        const char *f = fake;
+        return parameter(&f, scratch);
+    }
+    if (isdigit((unsigned char)name[0]))
+    {
+        return strcmp(name, "0") == 0 ? "psh" : positional(atoi(name));
+    }
+    return var_get(name);
+}
+
+// Length of the parameter name at the start of `s`: an identifier, a number or a single
+// special character. 0 when there is none.
+static size_t name_length(const char *s)
+{
+    size_t len = 0;
+    if (is_name_start(*s))
+    {
+        while (is_name_char(s[len]))
+        {
+            len++;
+        }
+    }
+    else if (isdigit((unsigned char)*s))
+    {
+        len = strspn(s, "0123456789");
+    }
+    else if (*s != '\0' && strchr("?$!#@*", *s) != NULL)
+    {
+        len = 1;
+    }
+    return len;
+}
+
+// name_length() plus a [subscript] after a variable name, as in ${arr[i]}
+static size_t ref_length(const char *s)
+{
+    size_t len = name_length(s);
+    if (is_name_start(*s) && s[len] == '[')
+    {
+        int depth = 0;
+        size_t end = len;
+        do
+        {
+            depth += (s[end] == '[') - (s[end] == ']');
+            end++;
+        } while (depth > 0 && s[end] != '\0');
+        len = depth == 0 ? end : len;
+    }
+    return len;
+}
+
+// True for a name[@] or name[*] reference
+static int is_whole_array(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 3 && name[len - 1] == ']' && (name[len - 2] == '@' || name[len - 2] == '*') && name[len - 3] == '[';
+}
+
+// Finds the `close` that matches the `open` at `s`, passing over quotes and nested groups,
+// as for the '}' of ${ } or the ')' of $( )
+static const char *group_close(const char *s, char open, char close)
+{
+    int depth = 0;
+    for (; *s; s++)
+    {
+        if (*s == '\\' && s[1] != '\0')
+        {
+            s++;
+        }
+        else if (*s == '\'')
+        {
+            s = strchr(s + 1, '\'');
+            if (s == NULL)
+            {
+                return NULL;
+            }
+        }
+        else if (*s == '"')
+        {
+            for (s++; *s != '"'; s++)
+            {
+                if (*s == '\0')
+                {
+                    return NULL;
+                }
+                if (*s == '\\' && s[1] != '\0')
+                {
+                    s++;
+                }
+            }
+        }
+        else if (*s == open)
+        {
+            depth++;
+        }
+        else if (*s == close && --depth == 0)
+        {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// What the literal ends of a pattern pin down about the text it matches, so the searches
+// below only call fnmatch() where a match is possible. psh runs in the C locale, where `?`
+// and a bracket expression each match exactly one byte.
+typedef struct PatternShape
+{
+    char *prefix;   // literal text every match starts with
+    char *suffix;   // and ends with
+    size_t min_len; // bytes in the shortest match
+    int fixed;      // no `*`, every match is exactly min_len bytes
+} PatternShape;
+
+// Length of the bracket expression at `p`, 0 when it does not close
+static size_t bracket_len(const char *p)
+{
+    const char *q = p + 1;
+    q += *q == '!' || *q == '^';
+    q += *q == ']'; // a leading ']' is literal
+    for (; *q != ']'; q++)
+    {
+        if (*q == '\0')
+        {
+            return 0;
+        }
+        if (*q == '[' && (q[1] == ':' || q[1] == '.' || q[1] == '='))
+        {
+            char end[3] = {q[1], ']', '\0'};
+            const char *close = strstr(q + 2, end);
+            if (close == NULL)
+            {
+                return 0;
+            }
+            q = close + 1;
+        }
+    }
+    return q + 1 - p;
+}
+
+// Fills `shape` for `pattern`. Anything unusual, such as an unclosed bracket, leaves the
+// shape empty, which still finds every match.
+static void pattern_shape(const char *pattern, PatternShape *shape)
+{
+    size_t size = strlen(pattern) + 1;
+    size_t prefix_len = 0, suffix_len = 0;
+    int wild = 0;
+    shape->prefix = malloc(size);
+    shape->suffix = malloc(size);
+    if (!shape->prefix || !shape->suffix)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    shape->min_len = 0;
+    shape->fixed = 1;
+
+    for (const char *p = pattern; *p != '\0';)
+    {
+        size_t n = 0;
+        if (*p == '*')
+        {
+            shape->fixed = 0;
+            p++;
+        }
+        else if (*p == '?' || (*p == '[' && (n = bracket_len(p)) > 0))
+        {
+            shape->min_len++;
+            p += *p == '?' ? 1 : n;
+        }
+        else if (*p == '[' || (*p == '\\' && p[1] == '\0'))
+        {
+            prefix_len = suffix_len = shape->min_len = 0;
+            shape->fixed = 0;
+            break;
+        }
+        else
+        {
+            p += *p == '\\';
+            if (!wild)
+            {
+                shape->prefix[prefix_len++] = *p;
+            }
+            shape->suffix[suffix_len++] = *p;
+            shape->min_len++;
+            p++;
+            continue;
+        }
+        wild = 1;
+        suffix_len = 0;
+    }
+    shape->prefix[prefix_len] = '\0';
+    shape->suffix[suffix_len] = '\0';
+}
+
+// Whether value[from, to) can match: long enough and carrying the literal ends
+static int shape_allows(const PatternShape *shape, const char *value, size_t from, size_t to)
+{
+    size_t n = to - from;
+    size_t prefix_len = strlen(shape->prefix), suffix_len = strlen(shape->suffix);
+    return n >= shape->min_len && (!shape->fixed || n == shape->min_len) && n >= prefix_len &&
+           n >= suffix_len && memcmp(value + from, shape->prefix, prefix_len) == 0 &&
+           memcmp(value + to - suffix_len, shape->suffix, suffix_len) == 0;
+}
+
+// ${v#pat} ${v##pat} ${v%pat} ${v%%pat}: appends `value` without the shortest (with
+// `longest` the longest) prefix or suffix that matches `pattern`
+static void trim_match(ExpandBuf *out, const char *value, const char *pattern, int suffix, int longest)
+{
+    size_t len = strlen(value);
+    char *copy = strdup(value);
+    PatternShape shape;
+    pattern_shape(pattern, &shape);
+    for (size_t k = 0; k <= len; k++)
+    {
+        size_t n = longest ? len - k : k; // length of the part that would be removed
+        int match;
+        if (suffix ? !shape_allows(&shape, value, len - n, len) : !shape_allows(&shape, value, 0, n))
+        {
+            continue;
+        }
+        if (suffix)
+        {
+            match = fnmatch(pattern, copy + len - n, 0) == 0;
+        }
+        else
+        {
+            char c = copy[n];
+            copy[n] = '\0';
+            match = fnmatch(pattern, copy, 0) == 0;
+            copy[n] = c;
+        }
+        if (match)
+        {
+            buf_append(out, suffix ? value : value + n, len - n);
+            len = 0;
+            break;
+        }
+    }
+    buf_append(out, value, len);
+    free(shape.prefix);
+    free(shape.suffix);
+    free(copy);
+}
+
+// ${v/pat/rep}: appends `value` with the longest match of `pattern` replaced, every
+// non-overlapping one with `all`. An `anchor` of '#' or '%' only matches at the start or end.
+static void replace_match(ExpandBuf *out, const char *value, const char *pattern, const char *rep,
+                          int all, char anchor)
+{
+    size_t len = strlen(value);
+    char *copy = strdup(value);
+    size_t i = 0;
+    PatternShape shape;
+    pattern_shape(pattern, &shape);
+    size_t prefix_len = strlen(shape.prefix);
+    while (i < len)
+    {
+        if (prefix_len > 0 && anchor != '#')
+        {
+            // a match can only start where the literal prefix does
+            const char *next = memmem(value + i, len - i, shape.prefix, prefix_len);
+            size_t at = next != NULL ? (size_t)(next - value) : len;
+            buf_append(out, value + i, at - i);
+            i = at;
+            if (i == len)
+            {
+                break;
+            }
+        }
+        size_t stop = anchor == '%' ? len : i + 1; // empty matches never count
+        size_t j = len;
+        int found = 0;
+        if (shape.fixed && anchor != '%')
+        {
+            j = stop = i + (shape.min_len > 0 ? shape.min_len : 1); // the only length that can match
+        }
+        for (; j >= stop && j <= len; j--)
+        {
+            if (!shape_allows(&shape, value, i, j))
+            {
+                continue;
+            }
+            char c = copy[j];
+            copy[j] = '\0';
+            found = fnmatch(pattern, copy + i, 0) == 0;
+            copy[j] = c;
+            if (found)
+            {
+                break;
+            }
+        }
+        if (found)
+        {
+            buf_append(out, rep, strlen(rep));
+            i = j;
+            if (!all)
+            {
+                break;
+            }
+            continue;
+        }
+        if (anchor == '#')
+        {
+            break;
+        }
+        buf_putc(out, copy[i]);
+        i++;
+    }
+    buf_append(out, value + i, len - i);
+    free(shape.prefix);
+    free(shape.suffix);
+    free(copy);
+}
+
+// ${v:offset} and ${v:offset:length}, both arithmetic; negative ones count from the end
+static int substring(ExpandBuf *out, const char *value, const char *spec)
+{
+    int64_t len = strlen(value), offset, count = len;
+    const char *colon = strchr(spec, ':');
+    char *text = strndup(spec, colon ? (size_t)(colon - spec) : strlen(spec));
+    int ret = arith_expand(text, &offset);
+    free(text);
+    if (ret == -1 || (colon != NULL && arith_expand(colon + 1, &count) == -1))
+    {
+        return -1;
+    }
+    if (offset < 0)
+    {
+        offset = offset < -len ? len : len + offset;
+    }
+    offset = offset > len ? len : offset;
+    if (count < 0)
+    {
+        count = len + count - offset;
+        if (count < 0)
+        {
+            fprintf(stderr, "psh: %s: substring expression < 0\n", colon + 1);
+            return -1;
+        }
+    }
+    buf_append(out, value + offset, count < len - offset ? count : len - offset);
+    return 0;
+}
+
+// Applies the operator of ${name<op><word>} to `value` (NULL when unset) into `out`.
+// Returns -1 after reporting an error.
+static int brace_operator(ExpandBuf *out, const char *name, const char *value, const char *op)
+{
+    char c = op[0];
+    int colon = c == ':' && op[1] != '\0' && strchr("-=+?", op[1]) != NULL;
+    if (c == '\0')
+    {
+        buf_append(out, value ? value : "", value ? strlen(value) : 0);
+        return 0;
+    }
+    if (c == ':' && !colon)
+    {
+        return substring(out, value ? value : "", op + 1);
+    }
+
+    const char *word = op + 1 + colon;
+    int missing = value == NULL || (colon && *value == '\0');
+    c = op[colon];
+    if (c == '-' || c == '=' || c == '+' || c == '?')
+    {
+        if ((c == '+') == missing)
+        {
+            // ${v:-word} with v set keeps v, ${v:+word} with v missing is empty
+            if (c != '+')
+            {
+                buf_append(out, value, strlen(value));
+            }
+            return 0;
+        }
+        char *text = expand_word_single(word);
+        int ret = 0;
+        if (c == '?')
+        {
+            fprintf(stderr, "psh: %s: %s\n", name, *text ? text : "parameter null or not set");
+            ret = -1;
+        }
+        else if (c == '=' && !is_name_start(*name))
+        {
+            fprintf(stderr, "psh: $%s: cannot assign in this way\n", name);
+            ret = -1;
+        }
+        else if (c == '=' && var_set(name, text) == -1)
+        {
+            ret = -1;
+        }
+        else
+        {
+            buf_append(out, text, strlen(text));
+        }
+        free(text);
+        return ret;
+    }
+    if (c == '#' || c == '%')
+    {
+        int longest = op[1] == c;
+        char *pattern = expand_pattern(op + 1 + longest);
+        trim_match(out, value ? value : "", pattern, c == '%', longest);
+        free(pattern);
+        return 0;
+    }
+    if (c == '/')
+    {
+        // ${v/pat/rep}, ${v//pat/rep}, ${v/#pat/rep} and ${v/%pat/rep}
+        int all = op[1] == '/';
+        char anchor = op[1] == '#' || op[1] == '%' ? op[1] : '\0';
+        const char *pat = op + 1 + (all || anchor);
+        const char *sep = pat;
+        while (*sep != '\0' && *sep != '/')
+        {
+            sep += *sep == '\\' && sep[1] != '\0' ? 2 : 1;
+        }
+        char *pat_text = strndup(pat, sep - pat);
+        char *pattern = expand_pattern(pat_text);
+        char *rep = expand_word_single(*sep == '/' ? sep + 1 : "");
+        if (*pattern == '\0')
+        {
+            buf_append(out, value ? value : "", value ? strlen(value) : 0);
+        }
+        else
+        {
+            replace_match(out, value ? value : "", pattern, rep, all, anchor);
+        }
+        free(pat_text);
+        free(pattern);
+        free(rep);
+        return 0;
+    }
+    return -1;
+}
+
+// Expands the ${ ... } at *p and advances past it: ${name}, ${#name} and ${name<op>word}
+// with the operators -, =, +, ?, #, ##, %, %%, /, // and :offset:length. The result is
+// built in `scratch`. Returns NULL when the braces do not close, keeping the '$' literal.
+static const char *braced(const char **p, ExpandBuf *scratch)
+{
+    const char *open = *p + 1;
+    const char *close = group_close(open, '{', '}');
+    if (close == NULL)
+    {
+        return NULL;
+    }
+    char *body = strndup(open + 1, close - open - 1);
+    *p = close + 1;
+
+    // ${#name} is a length, ${!name} an indirection and ${!arr[@]} the subscripts of arr
+    char prefix = (body[0] == '#' || body[0] == '!') && body[1] != '\0' && ref_length(body + 1) == strlen(body + 1) ? body[0] : '\0';
+    size_t len = ref_length(body + (prefix != '\0'));
+    char *name = strndup(body + (prefix != '\0'), len);
+    const char *op = body + (prefix != '\0') + len;
+    int ret = 0;
+
+    const char *value = len > 0 ? lookup(name, scratch) : NULL;
+    char *copy = value != NULL ? strdup(value) : NULL; // the operator may reuse `scratch`
+    scratch->len = 0;
+    buf_reserve(scratch, 0);
+    scratch->data[0] = '\0';
+    if (len == 0 || (*op != '\0' && strchr(":-=+?#%/", *op) == NULL))
+    {
+        fprintf(stderr, "psh: ${%s}: bad substitution\n", body);
+        ret = -1;
+    }
+    else if (prefix == '#')
+    {
+        char num[32];
+        size_t n = copy ? strlen(copy) : 0;
+        if (strcmp(name, "@") == 0 || strcmp(name, "*") == 0)
+        {
+            n = positional_count();
+        }
+        else if (is_whole_array(name))
+        {
+            name[strlen(name) - 3] = '\0';
+            n = var_array_count(name);
+        }
+        snprintf(num, sizeof(num), "%zu", n);
+        buf_append(scratch, num, strlen(num));
+    }
+    else if (prefix == '!' && is_whole_array(name))
+    {
+        name[strlen(name) - 3] = '\0';
+        char **keys = var_array_list(name, 1);
+        for (int i = 0; keys != NULL && keys[i] != NULL; i++)
+        {
+            if (i > 0)
+            {
+                buf_putc(scratch, ' ');
+            }
+            buf_append(scratch, keys[i], strlen(keys[i]));
+        }
+        free_double_pointer(keys);
+    }
+    else if (prefix == '!')
+    {
+        // the value names the variable to expand
+        const char *target = copy != NULL && ref_length(copy) == strlen(copy) && *copy ? lookup(copy, scratch) : NULL;
+        char *text = target != NULL ? strdup(target) : NULL;
+        scratch->len = 0;
+        scratch->data[0] = '\0';
+        if (text != NULL)
+        {
+            buf_append(scratch, text, strlen(text));
+        }
+        free(text);
+    }
+    else
+    {
+        ret = brace_operator(scratch, name, copy, op);
+    }
+    if (ret == -1)
+    {
+        set_exit_status(1);
+        expand_error = 1;
+    }
+    free(copy);
+    free(name);
+    free(body);
+    return scratch->data;
+}
+
+// Looks up the parameter after a '$' at *p and advances past it. Returns NULL when the
+// '$' does not start an expansion and should be kept literally. Computed values such as
+// $? or $* are built in `scratch`.
+static const char *parameter(const char **p, ExpandBuf *scratch)
+{
+    const char *s = *p + 1;
+    char name[256];
+    size_t len = 0;
+
+    scratch->len = 0;
+    if (*s == '?' || *s == '$' || *s == '#')
+    {
+        snprintf(name, sizeof(name), "%d",
+                 *s == '?' ? last_status : *s == '$' ? (int)getpid() : positional_count());
+        buf_append(scratch, name, strlen(name));
+        *p = s + 1;
+        return scratch->data;
+    }
+    if (*s == '!')
+    {
+        *p = s + 1;
+        return var_get("!");
+    }
+    if (*s == '@' || *s == '*')
+    {
+        // all positional parameters joined by spaces; "$@" is split up by expand_into
+        char **args = positional_all();
+        buf_reserve(scratch, 0);
+        for (int i = 0; args[i] != NULL; i++)
+        {
+            if (i > 0)
+            {
+                buf_putc(scratch, ' ');
+            }
+            buf_append(scratch, args[i], strlen(args[i]));
+        }
+        *p = s + 1;
+        return scratch->data;
+    }
+    if (isdigit((unsigned char)*s))
+    {
+        *p = s + 1;
+        return *s == '0' ? "psh" : positional(*s - '0');
+    }
+    if (*s == '{')
+    {
+        return braced(p, scratch);
+    }
+    if (!is_name_start(*s))
+    {
+        return NULL;
+    }
+    while (is_name_char(s[len]) && len < sizeof(name) - 1)
+    {
+        name[len] = s[len];
+        len++;
+    }
+    name[len] = '\0';
+    *p = s + len;
+    return var_get(name);
+}
+
+// Recognises "${arr[@]}" and "${!arr[@]}" at `p`, which expand to one field per element.
+// Returns the length of the reference with the values (or subscripts) in *list, NULL for an
+// unset array, or 0 when `p` holds something else.
+static size_t array_fields(const char *p, char ***list)
+{
+    const char *s = p + 2;
+    int keys = *s == '!';
+    if (p[1] != '{' || !is_name_start(s[keys]))
+    {
+        return 0;
+    }
+    size_t len = name_length(s + keys);
+    if (strncmp(s + keys + len, "[@]}", 4) != 0)
+    {
+        return 0;
+    }
+    char *name = strndup(s + keys, len);
+    *list = var_array_list(name, keys);
+    free(name);
+    return 2 + keys + len + 4;
+}
+
+// Evaluates the $(( )) at *p into `scratch` and advances past it. An invalid expression is
+// reported and expands to nothing with $? = 1. Returns NULL when the parentheses do not
+// close as $(( )).
+static const char *arithmetic(const char **p, ExpandBuf *scratch)
+{
+    const char *end = *p + 1;
+    int depth = 0;
+    do
+    {
+        depth += (*end == '(') - (*end == ')');
+        end++;
+    } while (depth > 0 && *end != '\0');
+    if (depth > 0 || end[-2] != ')')
+    {
+        return NULL;
+    }
+
+    char *expr = strndup(*p + 3, end - *p - 5);
+    int64_t value;
+    char num[32];
+    scratch->len = 0;
+    buf_reserve(scratch, 0);
+    scratch->data[0] = '\0';
+    if (arith_expand(expr, &value) == 0)
+    {
+        snprintf(num, sizeof(num), "%" PRId64, value);
+        buf_append(scratch, num, strlen(num));
+    }
+    else
+    {
+        set_exit_status(1);
+        expand_error = 1;
+    }
+    free(expr);
+    *p = end;
+    return scratch->data;
+}
+
+// Runs the $( ) at *p and advances past it; the output lands in `scratch`. NULL when the
+// parenthesis does not close.
+static const char *substitution(const char **p, ExpandBuf *scratch)
+{
+    const char *close = group_close(*p + 1, '(', ')');
+    if (close == NULL)
+    {
+        return NULL;
+    }
+    char *text = strndup(*p + 2, close - *p - 2);
+    char *output = command_output(text);
+    scratch->len = 0;
+    buf_append(scratch, output, strlen(output));
+    expand_substituted = 1;
+    free(text);
+    free(output);
+    *p = close + 1;
+    return scratch->data;
+}
+
+// The old form `cmd`. Inside the backquotes a backslash only escapes $, ` and \ (and " within
+// double quotes), the rest of the text is run as with $( ). NULL when there is no closing one.
+static const char *backquoted(const char **p, ExpandBuf *scratch, int in_double)
+{
+    ExpandBuf text = {NULL, 0, 0};
+    const char *s = *p + 1;
+    buf_reserve(&text, 0);
+    text.data[0] = '\0';
+    for (; *s != '`'; s++)
+    {
+        if (*s == '\0')
+        {
+            free(text.data);
+            return NULL;
+        }
+        if (*s == '\\' && s[1] != '\0' && (strchr("$`\\", s[1]) != NULL || (in_double && s[1] == '"')))
+        {
+            s++;
+        }
+        buf_putc(&text, *s);
+    }
+    char *output = command_output(text.data);
+    scratch->len = 0;
+    buf_append(scratch, output, strlen(output));
+    expand_substituted = 1;
+    free(text.data);
+    free(output);
+    *p = s + 1;
+    return scratch->data;
+}
+
+// Expands the `cmd`, $(( )), $( ) or parameter at *p and advances past it. A '$' or '`'
+// that starts none of them is appended to `out` as it is, and like an unset parameter
+// gives NULL.
+static const char *expansion(const char **p, ExpandBuf *out, ExpandBuf *scratch, int in_double)
+{
+    const char *value;
+    if (**p == '`')
+    {
+        value = backquoted(p, scratch, in_double);
+        if (value == NULL)
+        {
+            buf_putc(out, '`'); // unterminated, kept as it is
+            (*p)++;
+        }
+        return value;
+    }
+    if ((*p)[1] == '(' && (*p)[2] == '(' && (value = arithmetic(p, scratch)) != NULL)
+    {
+        return value; // $(( expression )), already evaluated
+    }
+    if ((*p)[1] == '(' && (value = substitution(p, scratch)) != NULL)
+    {
+        return value; // $( commands ), already run
+    }
+    const char *dollar = *p;
+    value = parameter(p, scratch);
+    if (*p == dollar)
+    {
+        // not an expansion, a lone '$'
+        buf_putc(out, '$');
+        (*p)++;
+        return NULL;
+    }
+    return value;
+}
+
+// Expands one word: quote removal, $parameters and command substitution. With `fields` set, results of unquoted
+// expansions are split on blanks into separate fields; otherwise everything lands in `out`.
+// With a `pattern` kind the result is a glob or regex in which the quoted parts match literally.
+static void expand_into(const char *word, ExpandBuf *out, FieldList *fields, int pattern)
+{
+    int in_double = 0;
+    int quoted = 0;    // a quoted part keeps an otherwise empty field alive
+    int no_params = 0; // "$@" without parameters, which leaves no field at all
+    const char *p = word;
+    ExpandBuf scratch = {NULL, 0, 0};
+
+    while (*p)
+    {
+        // copy plain runs in one go
+        size_t run = strcspn(p, in_double ? "\"\\$`" : "'\"\\$`<>");
+        buf_append_literal(out, p, run, in_double ? pattern : PATTERN_NONE);
+        p += run;
+
+        switch (*p)
+        {
+        case '\0':
+            break;
+        case '\'':
+        {
+            const char *close = strchr(p + 1, '\'');
+            size_t len = close ? (size_t)(close - p - 1) : strlen(p + 1);
+            buf_append_literal(out, p + 1, len, pattern);
+            p += len + (close ? 2 : 1);
+            quoted = 1;
+            break;
+        }
+        case '"':
+            in_double = !in_double;
+            quoted = 1;
+            p++;
+            break;
+        case '<':
+        case '>':
+        {
+            const char *close = p[1] == '(' ? group_close(p + 1, '(', ')') : NULL;
+            if (close == NULL)
+            {
+                buf_append_literal(out, p, 1, pattern);
+                p++;
+                break;
+            }
+            // <(cmd) and >(cmd) become a /dev/fd path, never split
+            char *text = strndup(p + 2, close - p - 2);
+            char *path = process_substitution(text, *p == '>');
+            buf_append_literal(out, path, strlen(path), pattern);
+            free(text);
+            free(path);
+            p = close + 1;
+            break;
+        }
+        case '\\':
+            if (p[1] == '\0')
+            {
+                buf_append_literal(out, p, 1, pattern);
+                p++;
+            }
+            else if (in_double && strchr("\\\"$`\n", p[1]) == NULL)
+            {
+                // inside double quotes the backslash stays unless it escapes something
+                buf_append_literal(out, p, 2, pattern);
+                p += 2;
+            }
+            else
+            {
+                buf_append_literal(out, p + 1, 1, pattern);
+                p += 2;
+            }
+            break;
+        case '`':
+        case '$':
+        {
+            size_t skip = 0;
+            char **args = NULL, **owned = NULL;
+            if (in_double && fields != NULL && (strncmp(p, "$@", 2) == 0 || strncmp(p, "${@}", 4) == 0))
+            {
+                args = positional_all();
+                skip = p[1] == '@' ? 2 : 4;
+            }
+            else if (in_double && fields != NULL && (skip = array_fields(p, &owned)) > 0)
+            {
+                static char *none[] = {NULL};
+                args = owned != NULL ? owned : none;
+            }
+            if (skip > 0)
+            {
+                // "$@", "${arr[@]}" and "${!arr[@]}": every element is a field of its own
+                for (int i = 0; args[i] != NULL; i++)
+                {
+                    if (i > 0)
+                    {
+                        fields_push(fields, out);
+                    }
+                    buf_append_literal(out, args[i], strlen(args[i]), pattern);
+                }
+                no_params = args[0] == NULL && out->len == 0;
+                p += skip;
+                free_double_pointer(owned);
+                break;
+            }
+            const char *value = expansion(&p, out, &scratch, in_double);
+            if (value == NULL)
+            {
+                break;
+            }
+            if (fields == NULL || in_double)
+            {
+                buf_append_literal(out, value, strlen(value), in_double ? pattern : PATTERN_NONE);
+                break;
+            }
+            // field splitting on blanks, only for unquoted expansions
+            for (const char *v = value; *v; v++)
+            {
+                if (*v == ' ' || *v == '\t' || *v == '\n')
+                {
+                    if (out->len > 0 || quoted)
+                    {
+                        fields_push(fields, out);
+                        quoted = 0;
+                    }
+                    continue;
+                }
+                if (*v == '\\' && pattern != PATTERN_NONE)
+                {
+                    buf_putc(out, '\\'); // only the unquoted glob characters stay special
+                }
+                buf_putc(out, *v);
+            }
+            break;
+        }
+        }
+    }
+    if (fields != NULL && (out->len > 0 || (quoted && !no_params)))
+    {
+        fields_push(fields, out);
+    }
+    free(scratch.data);
+}
+
+// Expands a word list into a fresh argv (free with free_double_pointer). Brace expansion
+// comes first and works on the words as written, pathname expansion comes last.
+char **expand_words(char **words)
+{
+    FieldList list = {NULL, 0, 0, 1};
+    ExpandBuf buf = {NULL, 0, 0};
+    char **braced = brace_expand(words);
+    if (braced != NULL)
+    {
+        words = braced;
+    }
+
+    list.cap = 8;
+    list.fields = malloc(list.cap * sizeof(char *));
+    if (!list.fields)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    list.fields[0] = NULL;
+    for (int i = 0; words != NULL && words[i] != NULL; i++)
+    {
+        expand_into(words[i], &buf, &list, PATTERN_GLOB);
+    }
+    free(buf.data);
+    free(braced);
+    return list.fields;
+}
+
+// Expands a word that must stay one string: redirection targets, assignments, for variables
+char *expand_word_single(const char *word)
+{
+    ExpandBuf buf = {NULL, 0, 0};
+    expand_into(word, &buf, NULL, PATTERN_NONE);
+    return buf.data ? buf.data : strdup("");
+}
+
+// Expands a word used as a pattern, e.g. a case label, for matching with fnmatch()
+char *expand_pattern(const char *word)
+{
+    ExpandBuf buf = {NULL, 0, 0};
+    expand_into(word, &buf, NULL, PATTERN_GLOB);
+    return buf.data ? buf.data : strdup("");
+}
+
+// Expands the regex after =~ in [[ ]]: quoted parts match themselves
+char *expand_regex(const char *word)
+{
+    ExpandBuf buf = {NULL, 0, 0};
+    expand_into(word, &buf, NULL, PATTERN_REGEX);
+    return buf.data ? buf.data : strdup("");
+}
+
+// Expands the body of a here-document whose delimiter was not quoted. As inside double
+// quotes $parameters, $(( )), $( ) and `cmd` are expanded and a backslash only escapes
+// $, `, \ and newline, but quotes are ordinary characters. No field splitting.
+char *expand_heredoc(const char *body)
+{
+    ExpandBuf out = {NULL, 0, 0};
+    ExpandBuf scratch = {NULL, 0, 0};
+    const char *p = body;
+    while (*p)
+    {
+        size_t run = strcspn(p, "\\$`");
+        buf_append(&out, p, run);
+        p += run;
+        if (*p == '\\')
+        {
+            if (p[1] == '\n')
+            {
+                p += 2; // line continuation
+                continue;
+            }
+            if (p[1] != '\0' && strchr("\\$`", p[1]) != NULL)
+            {
+                p++;
+            }
+            buf_putc(&out, *p++);
+        }
+        else if (*p != '\0')
+        {
+            const char *value = expansion(&p, &out, &scratch, 1);
+            if (value != NULL)
+            {
+                buf_append(&out, value, strlen(value));
+            }
+        }
+    }
+    free(scratch.data);
+    return out.data ? out.data : strdup("");
+}
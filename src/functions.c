@@ -0,0 +1,201 @@
+// functions.c
+#include "psh.h"
+
+// Defined functions keyed by name. The body is a parsed tree shared with the definition
+// (see Node.refs), so calling a function never re-parses it and its compiled code is kept.
+typedef struct Function
+{
+    char *name;
+    Node *body;
+    struct Function *next;
+} Function;
+
+// A variable shadowed by `local`, put back when the call that declared it returns
+typedef struct SavedVar
+{
+    char *name;
+    ShellVar *var; // moved out of the variable table, NULL when the variable was unset
+    struct SavedVar *next;
+} SavedVar;
+
+// One function call: its positional parameters and the locals it declared
+typedef struct CallFrame
+{
+    char **args; // $1 ... borrowed from the caller's argv
+    int n_args;
+    SavedVar *saved;
+    struct CallFrame *prev;
+} CallFrame;
+
+static Function *func_table[FUNCS_SIZE];
+static CallFrame top_frame = {NULL, 0, NULL, NULL}; // the script's own arguments
+static CallFrame *current = &top_frame;
+static int call_depth = 0;
+int func_returning = 0; // `return` ran, unwind to the end of the current call
+
+static Function *find_function(const char *name, Function ***link)
+{
+    Function **slot = &func_table[hash(name, FUNCS_SIZE)];
+    for (; *slot != NULL; slot = &(*slot)->next)
+    {
+        if (strcmp((*slot)->name, name) == 0)
+        {
+            break;
+        }
+    }
+    if (link != NULL)
+    {
+        *link = slot;
+    }
+    return *slot;
+}
+
+// Binds `name` to `body`. The function table becomes one more owner of the body.
+void func_define(const char *name, Node *body)
+{
+    Function **slot;
+    Function *func = find_function(name, &slot);
+    if (func == NULL)
+    {
+        func = calloc(1, sizeof(Function));
+        if (!func)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        func->name = strdup(name);
+        *slot = func;
+    }
+    else
+    {
+        free_node(func->body);
+    }
+    body->refs++;
+    func->body = body;
+}
+
+int func_exists(const char *name)
+{
+    return find_function(name, NULL) != NULL;
+}
+
+// Runs a function in the shell process. argv[0] is the function name, the rest become
+// $1 ... for the duration of the call. Returns 0 if there is no such function.
+int func_call(char **argv, Redirect *redirs, int *run)
+{
+    Function *func = find_function(argv[0], NULL);
+    if (func == NULL)
+    {
+        return 0;
+    }
+    if (redirect_apply(redirs) == -1)
+    {
+        set_exit_status(1);
+        return 1;
+    }
+
+    CallFrame frame = {argv + 1, size_token_arr(argv + 1), NULL, current};
+    Node *body = func->body;
+    int saved_loop_depth = loop_depth;
+
+    // the body stays alive even if the function redefines itself while running
+    body->refs++;
+    current = &frame;
+    call_depth++;
+    loop_depth = 0; // break and continue do not reach loops in the caller
+
+    exec_node(body, run);
+
+    func_returning = 0;
+    loop_break = 0;
+    loop_continue = 0;
+    loop_depth = saved_loop_depth;
+    call_depth--;
+    current = frame.prev;
+    while (frame.saved != NULL)
+    {
+        SavedVar *saved = frame.saved;
+        frame.saved = saved->next;
+        var_restore(saved->name, saved->var);
+        free(saved->name);
+        free(saved);
+    }
+    free_node(body);
+    redirect_restore(redirs);
+    return 1;
+}
+
+// Declares `name` local to the running function: the caller's variable is moved aside
+// whole and put back on return. Returns -1 for a readonly variable, 0 outside a function.
+int func_local(const char *name)
+{
+    if (call_depth == 0)
+    {
+        return 0;
+    }
+    for (SavedVar *saved = current->saved; saved != NULL; saved = saved->next)
+    {
+        if (strcmp(saved->name, name) == 0)
+        {
+            return 0; // already local to this call
+        }
+    }
+    ShellVar *var;
+    if (var_save(name, &var) == -1)
+    {
+        return -1;
+    }
+    SavedVar *saved = malloc(sizeof(SavedVar));
+    if (!saved)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    saved->name = strdup(name);
+    saved->var = var;
+    saved->next = current->saved;
+    current->saved = saved;
+    return 0;
+}
+
+int func_depth(void)
+{
+    return call_depth;
+}
+
+// $1 ... of the innermost call (or the script), NULL past the end
+const char *positional(int n)
+{
+    return n >= 1 && n <= current->n_args ? current->args[n - 1] : NULL;
+}
+
+int positional_count(void)
+{
+    return current->n_args;
+}
+
+// All positional parameters as a NULL-terminated list, valid until they change
+char **positional_all(void)
+{
+    static char *none[] = {NULL};
+    return current->args != NULL ? current->args : none;
+}
+
+// Sets the script's arguments, psh script.psh a b c
+void positional_init(char **args, int n)
+{
+    top_frame.args = args;
+    top_frame.n_args = n;
+}
+
+// `shift n`: drops the first n positional parameters of the current frame
+int positional_shift(int n)
+{
+    if (n < 0 || n > current->n_args)
+    {
+        return -1;
+    }
+    current->args += n;
+    current->n_args -= n;
+    return 0;
+}
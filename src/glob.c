@@ -0,0 +1,1100 @@
+// glob.c
+#include "psh.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+
+// Pathname expansion. Each path component of a pattern is compiled once into a short list of
+// match operations, and directories are read with raw getdents64() calls into one large
+// buffer. The entry type that comes with every name tells directories apart, so a match
+// costs no stat() unless the file system leaves the type unknown or the entry is a symlink.
+// Quoted characters reach us escaped with a backslash, see expand_words().
+
+#define GLOB_CHAR 0 // one given byte
+#define GLOB_ANY 1  // ?
+#define GLOB_STAR 2 // *
+#define GLOB_SET 3  // [...]
+
+#define GLOB_DIRENT_BUF (64 * 1024)
+
+typedef struct GlobOp
+{
+    unsigned char type;
+    unsigned char ch;     // GLOB_CHAR
+    unsigned short set;   // GLOB_SET: index into GlobMatcher.sets
+} GlobOp;
+
+// One compiled path component
+typedef struct GlobMatcher
+{
+    GlobOp *ops;
+    int n_ops;
+    uint8_t (*sets)[32]; // 256-bit membership maps of the bracket expressions
+    int n_sets;
+    const char *suffix;  // literal tail after the last *, checked before anything else
+    size_t suffix_len;
+    int dot;             // starts with a literal '.', so it may match hidden names
+} GlobMatcher;
+
+// The layout of the records getdents64() fills in
+typedef struct DirEntry64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} DirEntry64;
+
+typedef struct PathList
+{
+    char **paths;
+    size_t n;
+    size_t cap;
+} PathList;
+
+static void path_push(PathList *list, char *path)
+{
+    if (list->n + 1 >= list->cap)
+    {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->paths = realloc(list->paths, list->cap * sizeof(char *));
+        if (!list->paths)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->paths[list->n++] = path;
+    list->paths[list->n] = NULL;
+}
+
+// End of the bracket expression opening at `p` (the '['), or NULL when it does not close
+static const char *bracket_end(const char *p, const char *end)
+{
+    p++;
+    if (p < end && (*p == '!' || *p == '^'))
+    {
+        p++;
+    }
+    if (p < end && *p == ']')
+    {
+        p++; // a leading ] is a member
+    }
+    while (p < end && *p != ']')
+    {
+        if (*p == '[' && p + 1 < end && p[1] == ':')
+        {
+            const char *close = strstr(p + 2, ":]");
+            if (close != NULL && close < end)
+            {
+                p = close + 2;
+                continue;
+            }
+        }
+        if (*p == '\\' && p + 1 < end)
+        {
+            p++;
+        }
+        p++;
+    }
+    return p < end ? p : NULL;
+}
+
+// True when `pattern` (one component or a whole path) has an unquoted *, ? or [...]
+int glob_is_pattern(const char *pattern)
+{
+    const char *end = pattern + strlen(pattern);
+    for (const char *p = pattern; *p; p++)
+    {
+        switch (*p)
+        {
+        case '\\':
+            if (p[1] != '\0')
+            {
+                p++;
+            }
+            break;
+        case '*':
+        case '?':
+            return 1;
+        case '[':
+        {
+            const char *slash = memchr(p, '/', end - p);
+            if (bracket_end(p, slash != NULL ? slash : end) != NULL)
+            {
+                return 1;
+            }
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+static void set_class(uint8_t *set, const char *name, size_t len)
+{
+    static const struct
+    {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {{"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+                   {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+                   {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}};
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+    {
+        if (strlen(classes[i].name) == len && strncmp(classes[i].name, name, len) == 0)
+        {
+            for (int c = 0; c < 256; c++)
+            {
+                if (classes[i].test(c))
+                {
+                    set[c / 8] |= 1 << (c % 8);
+                }
+            }
+            return;
+        }
+    }
+}
+
+// Fills the membership map of the bracket expression [start, end]
+static void compile_set(uint8_t *set, const char *p, const char *end)
+{
+    int negate = 0;
+    memset(set, 0, 32);
+    p++;
+    if (*p == '!' || *p == '^')
+    {
+        negate = 1;
+        p++;
+    }
+    int first = 1;
+    while (p < end && (first || *p != ']'))
+    {
+        first = 0;
+        if (*p == '[' && p[1] == ':')
+        {
+            const char *close = strstr(p + 2, ":]");
+            if (close != NULL && close < end)
+            {
+                set_class(set, p + 2, close - p - 2);
+                p = close + 2;
+                continue;
+            }
+        }
+        if (*p == '\\' && p + 1 < end)
+        {
+            p++;
+        }
+        unsigned char lo = *p++, hi = lo;
+        if (*p == '-' && p + 1 < end && p[1] != ']')
+        {
+            p++;
+            if (*p == '\\' && p + 1 < end)
+            {
+                p++;
+            }
+            hi = *p++;
+        }
+        for (int c = lo; c <= hi; c++)
+        {
+            set[c / 8] |= 1 << (c % 8);
+        }
+    }
+    if (negate)
+    {
+        for (int i = 0; i < 32; i++)
+        {
+            set[i] = ~set[i];
+        }
+    }
+}
+
+static void matcher_add(GlobMatcher *m, int type, unsigned char ch)
+{
+    m->ops = realloc(m->ops, (m->n_ops + 1) * sizeof(GlobOp));
+    if (!m->ops)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    m->ops[m->n_ops++] = (GlobOp){type, ch, 0};
+}
+
+static void compile_component(GlobMatcher *m, const char *p, size_t len)
+{
+    const char *end = p + len;
+    memset(m, 0, sizeof(GlobMatcher));
+    m->dot = *p == '.' || (p[0] == '\\' && p[1] == '.');
+    while (p < end)
+    {
+        const char *close;
+        if (*p == '\\' && p + 1 < end)
+        {
+            matcher_add(m, GLOB_CHAR, p[1]);
+            p += 2;
+        }
+        else if (*p == '*')
+        {
+            if (m->n_ops == 0 || m->ops[m->n_ops - 1].type != GLOB_STAR)
+            {
+                matcher_add(m, GLOB_STAR, 0);
+            }
+            p++;
+        }
+        else if (*p == '?')
+        {
+            matcher_add(m, GLOB_ANY, 0);
+            p++;
+        }
+        else if (*p == '[' && (close = bracket_end(p, end)) != NULL)
+        {
+            m->sets = realloc(m->sets, (m->n_sets + 1) * sizeof(*m->sets));
+            if (!m->sets)
+            {
+                fprintf(stderr, "psh: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+            compile_set(m->sets[m->n_sets], p, close);
+            matcher_add(m, GLOB_SET, 0);
+            m->ops[m->n_ops - 1].set = m->n_sets++;
+            p = close + 1;
+        }
+        else
+        {
+            matcher_add(m, GLOB_CHAR, *p++);
+        }
+    }
+
+    // literal characters after the last star must end the name: one memcmp rejects most names
+    int tail = m->n_ops;
+    while (tail > 0 && m->ops[tail - 1].type == GLOB_CHAR)
+    {
+        tail--;
+    }
+    if (tail > 0 && m->ops[tail - 1].type == GLOB_STAR && tail < m->n_ops)
+    {
+        char *suffix = malloc(m->n_ops - tail + 1);
+        if (!suffix)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = tail; i < m->n_ops; i++)
+        {
+            suffix[i - tail] = m->ops[i].ch;
+        }
+        suffix[m->n_ops - tail] = '\0';
+        m->suffix = suffix;
+        m->suffix_len = m->n_ops - tail;
+    }
+}
+
+static void free_matcher(GlobMatcher *m)
+{
+    free(m->ops);
+    free(m->sets);
+    free((char *)m->suffix);
+}
+
+static int op_matches(const GlobMatcher *m, const GlobOp *op, unsigned char c)
+{
+    switch (op->type)
+    {
+    case GLOB_CHAR:
+        return op->ch == c;
+    case GLOB_ANY:
+        return 1;
+    default:
+        return (m->sets[op->set][c / 8] >> (c % 8)) & 1;
+    }
+}
+
+// Matches a file name, with the usual rule that a leading dot has to be matched explicitly
+static int matcher_match(const GlobMatcher *m, const char *name, size_t len)
+{
+    if (name[0] == '.' && !m->dot)
+    {
+        return 0;
+    }
+    if (m->suffix != NULL && (len < m->suffix_len || memcmp(name + len - m->suffix_len, m->suffix, m->suffix_len) != 0))
+    {
+        return 0;
+    }
+
+    // one star at a time is enough to backtrack to: the classic linear-time wildcard walk
+    const unsigned char *s = (const unsigned char *)name;
+    const unsigned char *star_s = NULL;
+    int pi = 0, star_p = -1;
+    while (*s)
+    {
+        if (pi < m->n_ops && m->ops[pi].type == GLOB_STAR)
+        {
+            star_p = ++pi;
+            star_s = s;
+            continue;
+        }
+        if (pi < m->n_ops && op_matches(m, &m->ops[pi], *s))
+        {
+            pi++;
+            s++;
+            continue;
+        }
+        if (star_p < 0)
+        {
+            return 0;
+        }
+        pi = star_p;
+        s = ++star_s;
+    }
+    while (pi < m->n_ops && m->ops[pi].type == GLOB_STAR)
+    {
+        pi++;
+    }
+    return pi == m->n_ops;
+}
+
+// Copies a component without its quoting backslashes
+static char *unescape(const char *p, size_t len)
+{
+    char *out = malloc(len + 1);
+    size_t n = 0;
+    if (!out)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (p[i] == '\\' && i + 1 < len)
+        {
+            i++;
+        }
+        out[n++] = p[i];
+    }
+    out[n] = '\0';
+    return out;
+}
+
+static char *join(const char *dir, const char *name, size_t name_len)
+{
+    size_t dir_len = strlen(dir);
+    char *path = malloc(dir_len + name_len + 1);
+    if (!path)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(path, dir, dir_len);
+    memcpy(path + dir_len, name, name_len);
+    path[dir_len + name_len] = '\0';
+    return path;
+}
+
+static int is_directory(const char *path, unsigned char d_type)
+{
+    struct stat st;
+    if (d_type == DT_DIR)
+    {
+        return 1;
+    }
+    if (d_type != DT_LNK && d_type != DT_UNKNOWN)
+    {
+        return 0;
+    }
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Listings of the directories globbed recently, so that a loop expanding $dir/*.json over and
+// over reads the directory once. An entry is keyed by (dev, ino) and stays valid while the
+// directory's mtime does; ** walks read their trees directly. PSH_GLOB_CACHE_SIZE bounds the
+// number of directories kept, `shopt -u globcache` turns the cache off, and the
+// PSH_GLOB_CACHE_HITS and PSH_GLOB_CACHE_MISSES variables count how it fares.
+
+// A directory's entries as read for globbing: per entry its d_type byte, then its name and NUL
+typedef struct DirListing
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    char *data;
+    size_t len;
+    size_t cap;
+    unsigned long used; // LRU stamp
+    int cached;
+} DirListing;
+
+#define GLOB_CACHE_DEFAULT 64
+
+int glob_cache = 1; // keep directory listings between expansions
+static DirListing **listings;
+static int n_listings;
+static unsigned long listing_clock;
+static int64_t cache_hits, cache_misses;
+
+static void free_listing(DirListing *listing)
+{
+    free(listing->data);
+    free(listing);
+}
+
+// How many listings may be kept, from PSH_GLOB_CACHE_SIZE
+static int glob_cache_limit(void)
+{
+    const char *size = var_get("PSH_GLOB_CACHE_SIZE");
+    if (!glob_cache)
+    {
+        return 0;
+    }
+    return size != NULL && *size != '\0' ? atoi(size) : GLOB_CACHE_DEFAULT;
+}
+
+// Drops the least recently used listings until at most `limit` are left
+static void glob_cache_trim(int limit)
+{
+    while (n_listings > (limit > 0 ? limit : 0))
+    {
+        int victim = 0;
+        for (int i = 1; i < n_listings; i++)
+        {
+            if (listings[i]->used < listings[victim]->used)
+            {
+                victim = i;
+            }
+        }
+        free_listing(listings[victim]);
+        listings[victim] = listings[--n_listings];
+    }
+}
+
+// Reads directory `path` into a fresh listing, NULL when it cannot be opened
+static DirListing *read_listing(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    DirListing *listing = calloc(1, sizeof(DirListing));
+    char *buf = malloc(GLOB_DIRENT_BUF);
+    if (!listing || !buf)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, GLOB_DIRENT_BUF)) > 0)
+    {
+        for (long at = 0; at < n;)
+        {
+            DirEntry64 *entry = (DirEntry64 *)(buf + at);
+            at += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+            size_t name_len = strlen(name);
+            if (listing->len + name_len + 2 > listing->cap)
+            {
+                listing->cap = (listing->len + name_len + 2) * 2;
+                listing->data = realloc(listing->data, listing->cap);
+                if (!listing->data)
+                {
+                    fprintf(stderr, "psh: allocation error\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            listing->data[listing->len] = entry->d_type;
+            memcpy(listing->data + listing->len + 1, name, name_len + 1);
+            listing->len += name_len + 2;
+        }
+    }
+    free(buf);
+    close(fd);
+    return listing;
+}
+
+// The entries of directory `dir` (as written, "" for the current one). A cached listing
+// whose directory still has the same mtime costs one stat(); give the result back with
+// release_listing().
+static DirListing *dir_listing(const char *dir)
+{
+    const char *path = *dir ? dir : ".";
+    int limit = glob_cache_limit();
+    glob_cache_trim(limit);
+    if (limit <= 0)
+    {
+        return read_listing(path);
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1)
+    {
+        return NULL;
+    }
+    int slot = -1;
+    for (int i = 0; i < n_listings; i++)
+    {
+        if (listings[i]->ino == st.st_ino && listings[i]->dev == st.st_dev)
+        {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0 && listings[slot]->mtime.tv_sec == st.st_mtim.tv_sec &&
+        listings[slot]->mtime.tv_nsec == st.st_mtim.tv_nsec)
+    {
+        cache_hits++;
+        listings[slot]->used = ++listing_clock;
+        return listings[slot];
+    }
+    cache_misses++;
+
+    DirListing *listing = read_listing(path);
+    if (listing == NULL)
+    {
+        return NULL;
+    }
+    // a change within the same timestamp tick as our read would go unseen, so a directory
+    // modified in the last second is not trusted yet
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (st.st_mtim.tv_sec + 1 >= now.tv_sec)
+    {
+        if (slot >= 0)
+        {
+            free_listing(listings[slot]);
+            listings[slot] = listings[--n_listings];
+        }
+        return listing;
+    }
+
+    listing->dev = st.st_dev;
+    listing->ino = st.st_ino;
+    listing->mtime = st.st_mtim;
+    listing->used = ++listing_clock;
+    listing->cached = 1;
+    if (slot >= 0)
+    {
+        free_listing(listings[slot]);
+        listings[slot] = listing;
+        return listing;
+    }
+    if (n_listings == limit)
+    {
+        glob_cache_trim(limit - 1);
+    }
+    listings = realloc(listings, (n_listings + 1) * sizeof(DirListing *));
+    if (!listings)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    listings[n_listings++] = listing;
+    return listing;
+}
+
+static void release_listing(DirListing *listing)
+{
+    if (!listing->cached)
+    {
+        free_listing(listing);
+    }
+}
+
+// What a recursive walk for ** collects
+#define TREE_MATCH 0 // entries of every directory that match the component after **/
+#define TREE_DIRS 1  // every directory, for a pattern that goes on after **/
+#define TREE_ALL 2   // every entry, for a trailing **
+
+#define TREE_MAX_THREADS 16
+
+// A directory read while following symlinks, linked to its parent to catch cycles
+typedef struct TreeNode
+{
+    dev_t dev;
+    ino_t ino;
+    struct TreeNode *parent;
+    struct TreeNode *next; // all nodes of one worker, for freeing
+} TreeNode;
+
+// A directory waiting to be read, relative to the root: "" for the root itself, else ending in '/'
+typedef struct TreeDir
+{
+    char *rel;
+    TreeNode *parent;
+} TreeDir;
+
+typedef struct TreeDirList
+{
+    TreeDir *dirs;
+    size_t n;
+    size_t cap;
+} TreeDirList;
+
+// State shared by the threads of one ** walk
+typedef struct TreeWalk
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    TreeDirList queue; // taken from the end
+    int busy;          // threads reading a directory right now
+    int root_fd;
+    const char *prefix; // the root as written
+    int mode;
+    const GlobMatcher *matcher; // TREE_MATCH
+    int want_dir;               // TREE_MATCH: the component had a trailing slash
+} TreeWalk;
+
+// One thread of a walk, with its own buffer and its own results
+typedef struct TreeWorker
+{
+    TreeWalk *walk;
+    pthread_t thread;
+    char *buf;
+    PathList found;
+    TreeDirList subdirs;
+    TreeNode *nodes;
+} TreeWorker;
+
+int glob_star = 1;   // ** matches any number of directories
+int glob_follow = 0; // ** descends into symbolic links to directories
+
+static void tree_dir_push(TreeDirList *list, TreeDir dir)
+{
+    if (list->n == list->cap)
+    {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->dirs = realloc(list->dirs, list->cap * sizeof(TreeDir));
+        if (!list->dirs)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->dirs[list->n++] = dir;
+}
+
+// Reads one directory, collecting results into worker->found and the directories to
+// descend into into worker->subdirs
+static void tree_read(TreeWorker *worker, TreeDir *at_dir)
+{
+    TreeWalk *walk = worker->walk;
+    const char *rel = at_dir->rel;
+    int fd = openat(walk->root_fd, *rel ? rel : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return;
+    }
+    struct stat st;
+    TreeNode *node = NULL;
+    if (glob_follow)
+    {
+        // a symlink back to one of our own ancestors would never end
+        if (fstat(fd, &st) == -1)
+        {
+            close(fd);
+            return;
+        }
+        for (TreeNode *up = at_dir->parent; up != NULL; up = up->parent)
+        {
+            if (up->dev == st.st_dev && up->ino == st.st_ino)
+            {
+                close(fd);
+                return;
+            }
+        }
+        node = malloc(sizeof(TreeNode));
+        if (!node)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        *node = (TreeNode){st.st_dev, st.st_ino, at_dir->parent, worker->nodes};
+        worker->nodes = node;
+    }
+    char *dir = join(walk->prefix, rel, strlen(rel));
+    if (walk->mode == TREE_DIRS)
+    {
+        path_push(&worker->found, strdup(dir));
+    }
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, worker->buf, GLOB_DIRENT_BUF)) > 0)
+    {
+        for (long at = 0; at < n;)
+        {
+            DirEntry64 *entry = (DirEntry64 *)(worker->buf + at);
+            at += entry->d_reclen;
+            const char *name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            {
+                continue;
+            }
+            size_t name_len = strlen(name);
+            int matched = walk->mode == TREE_MATCH && matcher_match(walk->matcher, name, name_len);
+
+            // d_type settles most entries; symlinks are only resolved when it matters
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            {
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_REG;
+            }
+            int is_dir = type == DT_DIR;
+            if (type == DT_LNK && (glob_follow || (matched && walk->want_dir)))
+            {
+                is_dir = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+            }
+
+            // like *, ** leaves hidden directories alone
+            if (name[0] != '.' && is_dir && (type == DT_DIR || glob_follow))
+            {
+                char *sub = malloc(strlen(rel) + name_len + 2);
+                if (!sub)
+                {
+                    fprintf(stderr, "psh: allocation error\n");
+                    exit(EXIT_FAILURE);
+                }
+                sprintf(sub, "%s%s/", rel, name);
+                tree_dir_push(&worker->subdirs, (TreeDir){sub, node});
+            }
+            if (matched && (!walk->want_dir || is_dir))
+            {
+                char *path = join(dir, name, name_len);
+                path_push(&worker->found, walk->want_dir ? join(path, "/", 1) : strdup(path));
+                free(path);
+            }
+            else if (walk->mode == TREE_ALL && name[0] != '.')
+            {
+                path_push(&worker->found, join(dir, name, name_len));
+            }
+        }
+    }
+    close(fd);
+    free(dir);
+}
+
+// Hands the subdirectories found by `worker` to the shared queue; the lock is held
+static void tree_queue_subdirs(TreeWalk *walk, TreeWorker *worker)
+{
+    for (size_t i = 0; i < worker->subdirs.n; i++)
+    {
+        tree_dir_push(&walk->queue, worker->subdirs.dirs[i]);
+    }
+    worker->subdirs.n = 0;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    return strcoll(*(char *const *)a, *(char *const *)b);
+}
+
+// Takes directories off the shared queue until it is empty and no thread can add more
+static void *tree_worker(void *arg)
+{
+    TreeWorker *worker = arg;
+    TreeWalk *walk = worker->walk;
+    pthread_mutex_lock(&walk->lock);
+    for (;;)
+    {
+        while (walk->queue.n == 0 && walk->busy > 0)
+        {
+            pthread_cond_wait(&walk->wake, &walk->lock);
+        }
+        if (walk->queue.n == 0)
+        {
+            break;
+        }
+        TreeDir dir = walk->queue.dirs[--walk->queue.n];
+        walk->busy++;
+        pthread_mutex_unlock(&walk->lock);
+
+        tree_read(worker, &dir);
+        free(dir.rel);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->busy--;
+        if (worker->subdirs.n > 0 || walk->busy == 0)
+        {
+            pthread_cond_broadcast(&walk->wake);
+        }
+        tree_queue_subdirs(walk, worker);
+    }
+    pthread_mutex_unlock(&walk->lock);
+
+    // each thread sorts its own share, the caller only merges
+    if (worker->found.n > 1)
+    {
+        qsort(worker->found.paths, worker->found.n, sizeof(char *), compare_paths);
+    }
+    return NULL;
+}
+
+// Walks the tree under `dir` (as written, "" or ending in '/') with one thread per CPU and
+// adds what `mode` asks for to `out`, in sorted order
+static void tree_walk(const char *dir, int mode, const GlobMatcher *matcher, int want_dir, PathList *out)
+{
+    TreeWalk walk = {.prefix = dir, .mode = mode, .matcher = matcher, .want_dir = want_dir};
+    TreeWorker workers[TREE_MAX_THREADS];
+    walk.root_fd = open(*dir ? dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (walk.root_fd == -1)
+    {
+        return;
+    }
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.wake, NULL);
+    memset(workers, 0, sizeof(workers));
+
+    // the calling thread is worker 0; the others only start when the root has subdirectories
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_workers = 1;
+    workers[0].walk = &walk;
+    workers[0].buf = malloc(GLOB_DIRENT_BUF);
+    if (!workers[0].buf)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    TreeDir root = {"", NULL};
+    tree_read(&workers[0], &root);
+    tree_queue_subdirs(&walk, &workers[0]);
+
+    if (walk.queue.n > 1 && cpus > 1)
+    {
+        // signals stay with the main thread
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        for (; n_workers < cpus && n_workers < TREE_MAX_THREADS; n_workers++)
+        {
+            workers[n_workers].walk = &walk;
+            workers[n_workers].buf = malloc(GLOB_DIRENT_BUF);
+            if (!workers[n_workers].buf)
+            {
+                fprintf(stderr, "psh: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+            if (pthread_create(&workers[n_workers].thread, NULL, tree_worker, &workers[n_workers]) != 0)
+            {
+                free(workers[n_workers].buf);
+                break;
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    tree_worker(&workers[0]);
+    for (int i = 1; i < n_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    // k-way merge of the sorted per-thread results
+    size_t heads[TREE_MAX_THREADS] = {0};
+    for (;;)
+    {
+        int best = -1;
+        for (int i = 0; i < n_workers; i++)
+        {
+            if (heads[i] < workers[i].found.n &&
+                (best < 0 || strcoll(workers[i].found.paths[heads[i]], workers[best].found.paths[heads[best]]) < 0))
+            {
+                best = i;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        path_push(out, workers[best].found.paths[heads[best]++]);
+    }
+    for (int i = 0; i < n_workers; i++)
+    {
+        while (workers[i].nodes != NULL)
+        {
+            TreeNode *next = workers[i].nodes->next;
+            free(workers[i].nodes);
+            workers[i].nodes = next;
+        }
+        free(workers[i].buf);
+        free(workers[i].found.paths);
+        free(workers[i].subdirs.dirs);
+    }
+    free(walk.queue.dirs);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.wake);
+    close(walk.root_fd);
+}
+
+static void glob_walk(const char *, const char *, PathList *);
+
+// A ** component: expands the rest of the pattern in `dir` and every directory below it
+static void globstar_walk(const char *dir, const char *rest, int want_dir, PathList *out)
+{
+    if (rest == NULL || *rest == '\0')
+    {
+        if (*dir)
+        {
+            path_push(out, strdup(dir)); // src/** and src/**/ start with src/ itself
+        }
+        if (want_dir)
+        {
+            // **/ is **/*/, which also lists symlinks to directories
+            GlobMatcher matcher;
+            compile_component(&matcher, "*", 1);
+            tree_walk(dir, TREE_MATCH, &matcher, 1, out);
+            free_matcher(&matcher);
+        }
+        else
+        {
+            tree_walk(dir, TREE_ALL, NULL, 0, out);
+        }
+        return;
+    }
+
+    const char *slash = strchr(rest, '/');
+    size_t len = slash != NULL ? (size_t)(slash - rest) : strlen(rest);
+    if (slash == NULL || slash[strspn(slash, "/")] == '\0')
+    {
+        if (len == 2 && rest[0] == '*' && rest[1] == '*')
+        {
+            globstar_walk(dir, NULL, slash != NULL, out); // **/** is **
+            return;
+        }
+        // the common **/*.c: the walking threads match the last component themselves
+        GlobMatcher matcher;
+        compile_component(&matcher, rest, len);
+        tree_walk(dir, TREE_MATCH, &matcher, slash != NULL, out);
+        free_matcher(&matcher);
+        return;
+    }
+
+    PathList dirs = {NULL, 0, 0};
+    tree_walk(dir, TREE_DIRS, NULL, 0, &dirs);
+    for (size_t i = 0; i < dirs.n; i++)
+    {
+        glob_walk(dirs.paths[i], rest, out);
+        free(dirs.paths[i]);
+    }
+    free(dirs.paths);
+}
+
+// Expands the components of `pattern` from `comp` on, inside directory `dir` as written
+// ("" for the current one, else ending in '/'). Matches are added to `out`.
+static void glob_walk(const char *dir, const char *comp, PathList *out)
+{
+    const char *slash = strchr(comp, '/');
+    size_t len = slash != NULL ? (size_t)(slash - comp) : strlen(comp);
+    const char *rest = slash != NULL ? slash + strspn(slash, "/") : NULL;
+    int last = rest == NULL || *rest == '\0';
+    int want_dir = slash != NULL; // a/ or a/b: only directories can match a
+
+    if (glob_star && len == 2 && comp[0] == '*' && comp[1] == '*')
+    {
+        globstar_walk(dir, rest, want_dir, out);
+        return;
+    }
+
+    char *component = strndup(comp, len);
+    if (!glob_is_pattern(component))
+    {
+        // a literal component needs no directory read
+        char *name = unescape(comp, len);
+        char *path = join(dir, name, strlen(name));
+        struct stat st;
+        if (!last)
+        {
+            char *sub = join(path, "/", 1);
+            glob_walk(sub, rest, out);
+            free(sub);
+        }
+        else if (want_dir ? stat(path, &st) == 0 && S_ISDIR(st.st_mode) : lstat(path, &st) == 0)
+        {
+            path_push(out, want_dir ? join(path, "/", 1) : strdup(path));
+        }
+        free(path);
+        free(name);
+        free(component);
+        return;
+    }
+    free(component);
+
+    DirListing *listing = dir_listing(dir);
+    if (listing == NULL)
+    {
+        return;
+    }
+    GlobMatcher matcher;
+    compile_component(&matcher, comp, len);
+    PathList subdirs = {NULL, 0, 0};
+    for (size_t at = 0; at < listing->len;)
+    {
+        unsigned char type = listing->data[at];
+        const char *name = listing->data + at + 1;
+        size_t name_len = strlen(name);
+        at += name_len + 2;
+        if (!matcher_match(&matcher, name, name_len))
+        {
+            continue;
+        }
+        char *path = join(dir, name, name_len);
+        if (!want_dir)
+        {
+            path_push(out, path);
+        }
+        else if (is_directory(path, type))
+        {
+            path_push(last ? out : &subdirs, join(path, "/", 1));
+            free(path);
+        }
+        else
+        {
+            free(path);
+        }
+    }
+    release_listing(listing);
+    free_matcher(&matcher);
+
+    // the directory is closed before going deeper, so only one is open at a time
+    for (size_t i = 0; i < subdirs.n; i++)
+    {
+        glob_walk(subdirs.paths[i], rest, out);
+        free(subdirs.paths[i]);
+    }
+    free(subdirs.paths);
+}
+
+// The paths matching `pattern`, sorted, as a malloc'd list for free_double_pointer(), or
+// NULL when nothing matches
+char **glob_expand(const char *pattern)
+{
+    PathList out = {NULL, 0, 0};
+    int64_t hits = cache_hits, misses = cache_misses;
+    if (pattern[0] == '/')
+    {
+        glob_walk("/", pattern + strspn(pattern, "/"), &out);
+    }
+    else
+    {
+        glob_walk("", pattern, &out);
+    }
+    if (cache_hits != hits || cache_misses != misses)
+    {
+        var_set_number("PSH_GLOB_CACHE_HITS", cache_hits);
+        var_set_number("PSH_GLOB_CACHE_MISSES", cache_misses);
+    }
+    if (out.n == 0)
+    {
+        free(out.paths);
+        return NULL;
+    }
+    // a ** walk hands over its results merged already
+    for (size_t i = 1; i < out.n; i++)
+    {
+        if (strcoll(out.paths[i - 1], out.paths[i]) > 0)
+        {
+            qsort(out.paths, out.n, sizeof(char *), compare_paths);
+            break;
+        }
+    }
+    return out.paths;
+}
@@ -408,166 +408,6 @@ int size_token_arr(char **token_arr)
     return i;
 }
 
-bool contains_wildcard(char **token_arr)
-{
-
-    int size = size_token_arr(token_arr);
-    for (int i = 0; i < size; i++)
-    {
-        if (strchr(token_arr[i], '?') ||
-            strchr(token_arr[i], '*'))
-        {
-            return true;
-        }
-    }
-    return false;
-}
-
-int handle_wildcard(char *pattern)
-{
-    char **found;
-    glob_t glob_struct;
-    int run;
-
-    run = glob(pattern, GLOB_ERR, NULL, &glob_struct);
-
-    // check for errors
-    if (run != 0)
-    {
-        if (run == GLOB_NOMATCH)
-            fprintf(stderr, "No matches\n");
-
-        else
-            fprintf(stderr, "Some kinda glob error\n");
-        // exit(1);
-        return 1;
-    }
-
-    /* success, output found filenames */
-    printf("\n");
-    printf("Found %zu filename matches\n", glob_struct.gl_pathc);
-    found = glob_struct.gl_pathv;
-
-    while (*found)
-    {
-        printf("%s\n", *found);
-        found++;
-    }
-    printf("\n");
-    return 1;
-}
-
-char *find_closing_done(char *start)
-{
-    int depth = 0;
-    char *pos = start;
-    while (*pos)
-    {
-        if (strncmp(pos, "for ", 4) == 0)
-        {
-            depth++;
-        }
-        else if (strncmp(pos, "done", 4) == 0)
-        {
-            if (depth == 0)
-            {
-                return pos;
-            }
-            depth--;
-        }
-        pos++;
-    }
-    return NULL;
-}
-
-void process_nested_loops(char *command, int *run)
-{
-    char *current_command = command;
-    while ((current_command = strstr(current_command, "for ")) != NULL)
-    {
-        current_command = process_for_loop(current_command, run);
-        if (!current_command || *run == 0)
-        {
-            return;
-        }
-    }
-}
-
-char *process_for_loop(char *loop_command, int *run)
-{
-    char *saveptr;
-    char *start = strstr(loop_command, "for ");
-    if (!start)
-    {
-        fprintf(stderr, "Error: Missing 'for' keyword\n");
-        return NULL;
-    }
-
-    start += 4;
-    char *var_name = strtok(start, " ");
-    if (!var_name)
-    {
-        fprintf(stderr, "Error: Missing variable name\n");
-        return NULL;
-    }
-
-    char *in = strtok(NULL, " ");
-    if (!in || strcmp(in, "in") != 0)
-    {
-        fprintf(stderr, "Error: Missing 'in' keyword\n");
-        return NULL;
-    }
-
-    char *values = strtok(NULL, ";");
-    if (!values)
-    {
-        fprintf(stderr, "Error: Missing values after 'in'\n");
-        return NULL;
-    }
-
-    char *do_keyword = strtok(NULL, " ");
-    if (!do_keyword || strcmp(do_keyword, "do") != 0)
-    {
-        fprintf(stderr, "Error: Missing 'do' keyword\n");
-        return NULL;
-    }
-
-    char *commands_start = do_keyword + 3;
-    char *commands_end = find_closing_done(commands_start);
-    if (!commands_end)
-    {
-        fprintf(stderr, "Error: Missing 'done' keyword\n");
-        return NULL;
-    }
-
-    size_t commands_length = commands_end - commands_start;
-    char *commands = malloc(commands_length + 1);
-    if (!commands)
-    {
-        fprintf(stderr, "Error: Allocation error for commands\n");
-        return NULL;
-    }
-
-    strncpy(commands, commands_start, commands_length);
-    commands[commands_length] = '\0';
-
-    char *value = strtok_r(values, " ", &saveptr);
-    while (value)
-    {
-        char command_block[PATH_MAX];
-        snprintf(command_block, PATH_MAX, "%s=%s; %s", var_name, value, commands);
-        value = strtok_r(NULL, " ", &saveptr);
-        process_commands(command_block, run);
-        if (*run == 0)
-        {
-            free(commands);
-            return commands_end + 4; // Return the position after "done"
-        }
-    }
-    free(commands);
-    return commands_end + 4; // Return the position after "done"
-}
-
 void get_last_line(char **inputline)
 {
     last_command_up = 1;
@@ -619,7 +459,7 @@ void parse_ps1(const char *ps1, const char *cwd)
             switch (*ps1)
             {
             case 'u':
-                exp_ptr += sprintf(exp_ptr, "%s", getenv("USER"));
+                exp_ptr += sprintf(exp_ptr, "%s", var_get("USER"));
                 break;
             case 'h':
             {
@@ -669,16 +509,26 @@ void parse_ps1(const char *ps1, const char *cwd)
     fflush(stdout);
 }
 
+int prompt_continuation = 0; // the line being read continues an open command
+
 void print_prompt(const char *PATH)
 {
-    char *ps1 = getenv("PS1");
+    if (prompt_continuation)
+    {
+        const char *ps2 = var_get("PS2");
+        printf("%s", ps2 != NULL ? ps2 : "> ");
+        fflush(stdout);
+        return;
+    }
+    const char *ps1 = var_get("PS1");
     if (ps1 == NULL)
     {
         // New default PS1
-        ps1 = "\\[\\e[1;36m\\]\\u\\[\\e[0m\\]@\\[\\e[1;34m\\]PSH\\[\\e[0m\\] → \\[\\e[1;35m\\]\\W\\[\\e[0m\\]";
+        var_set("PS1", "\\[\\e[1;36m\\]\\u\\[\\e[0m\\]@\\[\\e[1;34m\\]PSH\\[\\e[0m\\] → \\[\\e[1;35m\\]\\W\\[\\e[0m\\]");
+        var_export("PS1");
+        ps1 = var_get("PS1");
     }
     parse_ps1(ps1, PATH);
-    setenv("PS1", ps1, 1);
 }
 
 void load_history()
@@ -805,7 +655,8 @@ void generate_session_id()
 {
     snprintf(session_id, sizeof(session_id), "%ld", (long)time(NULL));
     // printf("%s",session_id);
-    setenv("SESSIONID", session_id, 1);
+    var_set("SESSIONID", session_id);
+    var_export("SESSIONID");
 }
 
 void initialize_paths(const char *cwd)
@@ -905,6 +756,8 @@ const char *get_alias_command(HashMap *map, const char *name)
     return NULL;
 }
 
+// Fills `map` from the ALIAS file, creating it if needed. Without a usable file, e.g. when
+// psh runs from a directory with no writable .files, the map is simply left empty.
 void load_aliases(HashMap *map, const char *filepath)
 {
     FILE *fp = fopen(filepath, "r");
@@ -913,10 +766,7 @@ void load_aliases(HashMap *map, const char *filepath)
         fp = fopen(filepath, "w");
         if (!fp)
         {
-            perror("Failed to create ALIAS file\n");
-            free(map->buckets);
-            free(map);
-            // return -1;
+            return;
         }
         fclose(fp);
         fp = fopen(filepath, "r");
@@ -1169,81 +1019,24 @@ char *remove_quotes(char *str)
     return str;
 }
 
-// Function to expand environment variables within a string
-char *expand_variables(char *str)
+void get_alias_path(char *path_session, size_t size, const char *cwd)
 {
-    static char buffer[1024];
-    char *ptr = str;
-    char *buf_ptr = buffer;
-
-    while (*ptr)
-    {
-        if (*ptr == '$')
-        {
-            ptr++;
-            char var_name[256];
-            char *var_ptr = var_name;
-
-            while (*ptr && (isalnum(*ptr) || *ptr == '_'))
-            {
-                *var_ptr++ = *ptr++;
-            }
-            *var_ptr = '\0';
-
-            char *var_value = getenv(var_name);
-            if (var_value)
-            {
-                while (*var_value)
-                {
-                    *buf_ptr++ = *var_value++;
-                }
-            }
-        }
-        else
-        {
-            *buf_ptr++ = *ptr++;
-        }
-    }
-    *buf_ptr = '\0';
-    return buffer;
+    snprintf(path_session, size, "%s/.files/ALIAS", cwd);
 }
 
-void handle_env_variable(char *token_arr[])
+// The aliases of this shell, read from the ALIAS file on first use. alias and unalias edit
+// this map in place and save it back, so parsing never has to read the file again.
+HashMap *alias_map(void)
 {
-    if (strchr(token_arr[0], '='))
+    static HashMap *aliases = NULL;
+    if (aliases == NULL)
     {
-        char *input = strdup(token_arr[0]);
-        if (input == NULL)
-        {
-            perror("strdup");
-            return;
-        }
-
-        char *var_name = strtok(input, "=");
-        char *var_value = strtok(NULL, "=");
-
-        if (var_name && var_value)
-        {
-            var_value = remove_quotes(var_value);
-            var_value = expand_variables(var_value);
-
-            if (setenv(var_name, var_value, 1) != 0)
-            {
-                perror("setenv");
-            }
-        }
-        else
-        {
-            fprintf(stderr, "Error: Invalid environment variable assignment\n");
-        }
-
-        free(input);
+        char ALIAS[PATH_MAX];
+        get_alias_path(ALIAS, sizeof(ALIAS), cwd);
+        aliases = create_map(HASHMAP_SIZE);
+        load_aliases(aliases, ALIAS);
     }
-}
-
-void get_alias_path(char *path_session, size_t size, const char *cwd)
-{
-    snprintf(path_session, size, "%s/.files/ALIAS", cwd);
+    return aliases;
 }
 
 void sigint_handler()
@@ -1251,7 +1044,7 @@ void sigint_handler()
     const char *message = "SIGINT Detected\n";
     write(STDOUT_FILENO, message, strlen(message));
     SIGNAL = 1;
-    setenv("?", "130", 1);
+    last_status = 130;
 }
 
 char **get_commands_from_usr_bin(size_t *count)
@@ -1267,7 +1060,7 @@ char **get_commands_from_usr_bin(size_t *count)
         exit(EXIT_FAILURE);
     }
 
-    char *path_env = getenv("PATH");
+    const char *path_env = var_get("PATH");
     if (path_env == NULL)
     {
         perror("getenv");
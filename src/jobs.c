@@ -0,0 +1,567 @@
+// jobs.c
+#include "psh.h"
+
+static Job *job_list = NULL;        // registered (background or stopped) jobs, oldest first
+static Job *foreground_job = NULL;  // job currently being waited on, not necessarily registered
+static int job_control = 0;         // process groups + terminal handoff, interactive shells only
+static int in_subshell = 0;         // this process is a forked copy of the shell
+static pid_t shell_pgid;
+static struct termios shell_tmodes;
+volatile sig_atomic_t SIGCHLD_PENDING = 0;
+
+static void sigchld_handler(int sig)
+{
+    (void)sig;
+    SIGCHLD_PENDING = 1;
+}
+
+// Scripts only get SIGCHLD bookkeeping; an interactive shell on a terminal also gets
+// its own process group and owns the terminal between jobs.
+void jobs_init(int interactive)
+{
+    struct sigaction sa;
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    if (!interactive || !isatty(STDIN_FILENO))
+    {
+        return;
+    }
+
+    // wait until we are in the foreground before taking over the terminal
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+    {
+        kill(-shell_pgid, SIGTTIN);
+    }
+
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    shell_pgid = getpid();
+    if (getpgrp() != shell_pgid && setpgid(shell_pgid, shell_pgid) == -1)
+    {
+        perror("psh: setpgid");
+        return;
+    }
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+    job_control = 1;
+}
+
+// Called in a forked copy of the shell that runs a compound pipeline stage or background
+// list: it has no terminal to hand out and its parent's jobs are not its own.
+void jobs_subshell(void)
+{
+    if (job_control)
+    {
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+    }
+    job_control = 0;
+    job_list = NULL;
+    foreground_job = NULL;
+    in_subshell = 1;
+}
+
+// True in a forked copy of the shell, which must leave with _exit() so it never touches
+// the parent's session files or the stdio buffers of the script being read
+int jobs_in_subshell(void)
+{
+    return in_subshell;
+}
+
+int jobs_enabled(void)
+{
+    return job_control;
+}
+
+Job *job_new(const char *command)
+{
+    Job *job = calloc(1, sizeof(Job));
+    if (!job)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    command += strspn(command, " \t");
+    size_t len = strlen(command);
+    while (len > 0 && (command[len - 1] == ' ' || command[len - 1] == '\t'))
+    {
+        len--;
+    }
+    job->command = strndup(command, len);
+    job->pgid = 0;
+    return job;
+}
+
+// pgid the next process of `job` should be spawned with, see SpawnOptions
+pid_t job_spawn_pgid(const Job *job)
+{
+    return job_control ? job->pgid : -1;
+}
+
+void job_add_process(Job *job, pid_t pid)
+{
+    if (job->n_procs == job->cap_procs)
+    {
+        job->cap_procs = job->cap_procs ? job->cap_procs * 2 : 4;
+        job->procs = realloc(job->procs, job->cap_procs * sizeof(JobProcess));
+        if (!job->procs)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    job->procs[job->n_procs].pid = pid;
+    job->procs[job->n_procs].state = JOB_RUNNING;
+    job->procs[job->n_procs].status = 0;
+    job->n_procs++;
+    if (job->pgid == 0)
+    {
+        job->pgid = pid;
+    }
+}
+
+static void job_free(Job *job)
+{
+    free(job->command);
+    free(job->procs);
+    free(job);
+}
+
+int job_state(const Job *job)
+{
+    int stopped = 0;
+    for (int i = 0; i < job->n_procs; i++)
+    {
+        if (job->procs[i].state == JOB_RUNNING)
+        {
+            return JOB_RUNNING;
+        }
+        if (job->procs[i].state == JOB_STOPPED)
+        {
+            stopped = 1;
+        }
+    }
+    return stopped ? JOB_STOPPED : JOB_DONE;
+}
+
+// $? of a job is the status of its last process, like a pipeline
+int job_status(const Job *job)
+{
+    if (job->n_procs == 0)
+    {
+        return job->launch_status;
+    }
+    int status = job->procs[job->n_procs - 1].status;
+    if (WIFEXITED(status))
+    {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status))
+    {
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status))
+    {
+        return 128 + WSTOPSIG(status);
+    }
+    return 0;
+}
+
+static int record_in(Job *job, pid_t pid, int status)
+{
+    for (int i = 0; job != NULL && i < job->n_procs; i++)
+    {
+        if (job->procs[i].pid == pid)
+        {
+            job->procs[i].status = status;
+            if (WIFSTOPPED(status))
+            {
+                job->procs[i].state = JOB_STOPPED;
+            }
+            else if (WIFCONTINUED(status))
+            {
+                job->procs[i].state = JOB_RUNNING;
+            }
+            else
+            {
+                job->procs[i].state = JOB_DONE;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Files one waitpid() result under whichever job owns the pid. Returns 0 if no job does.
+static int job_record(pid_t pid, int status)
+{
+    if (record_in(foreground_job, pid, status))
+    {
+        return 1;
+    }
+    for (Job *job = job_list; job != NULL; job = job->next)
+    {
+        if (record_in(job, pid, status))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Non-blocking sweep, safe to call from the prompt loop whenever SIGCHLD_PENDING is set
+void jobs_reap(void)
+{
+    int status;
+    pid_t pid;
+
+    SIGCHLD_PENDING = 0;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+    {
+        job_record(pid, status);
+    }
+}
+
+// Blocks until `job` finishes (or stops, when `untraced`), filing every other child that
+// changes state along the way. This is the one place the shell blocks on children.
+void job_wait(Job *job, int untraced)
+{
+    Job *saved = foreground_job;
+    foreground_job = job;
+    while (job_state(job) == JOB_RUNNING)
+    {
+        int status;
+        pid_t pid = waitpid(-1, &status, untraced ? WUNTRACED : 0);
+        if (pid == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break; // ECHILD: nothing left to wait for
+        }
+        job_record(pid, status);
+    }
+    foreground_job = saved;
+}
+
+// Blocks for the next child that exits without belonging to a job (the workers `parallel`
+// runs itself); job processes finishing meanwhile are filed as usual. Returns -1 on ECHILD.
+pid_t jobs_wait_untracked(int *status)
+{
+    while (1)
+    {
+        pid_t pid = waitpid(-1, status, 0);
+        if (pid == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (!job_record(pid, *status))
+        {
+            return pid;
+        }
+    }
+}
+
+static int job_next_id(void)
+{
+    int id = 0;
+    for (Job *job = job_list; job != NULL; job = job->next)
+    {
+        if (job->id > id)
+        {
+            id = job->id;
+        }
+    }
+    return id + 1;
+}
+
+static void job_register(Job *job)
+{
+    if (job->id != 0)
+    {
+        return;
+    }
+    job->id = job_next_id();
+    job->next = NULL;
+    Job **tail = &job_list;
+    while (*tail != NULL)
+    {
+        tail = &(*tail)->next;
+    }
+    *tail = job;
+}
+
+static void job_unregister(Job *job)
+{
+    for (Job **link = &job_list; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == job)
+        {
+            *link = job->next;
+            return;
+        }
+    }
+}
+
+static char job_marker(const Job *job)
+{
+    const Job *current = NULL, *previous = NULL;
+    for (const Job *j = job_list; j != NULL; j = j->next)
+    {
+        previous = current;
+        current = j;
+    }
+    if (job == current)
+    {
+        return '+';
+    }
+    return job == previous ? '-' : ' ';
+}
+
+static void job_signal(Job *job, int sig)
+{
+    if (job_control && job->pgid > 0)
+    {
+        kill(-job->pgid, sig);
+        return;
+    }
+    for (int i = 0; i < job->n_procs; i++)
+    {
+        if (job->procs[i].state != JOB_DONE)
+        {
+            kill(job->procs[i].pid, sig);
+        }
+    }
+}
+
+static void job_mark_running(Job *job)
+{
+    for (int i = 0; i < job->n_procs; i++)
+    {
+        if (job->procs[i].state == JOB_STOPPED)
+        {
+            job->procs[i].state = JOB_RUNNING;
+        }
+    }
+}
+
+// Hands the terminal to `job`, optionally resumes it, and waits for it to finish or stop.
+// A stopped job stays in the table; anything else is freed. Returns the job's $?.
+int job_foreground(Job *job, int cont)
+{
+    if (job_control && job->n_procs > 0)
+    {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+        if (cont && job->has_tmodes)
+        {
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+        }
+    }
+    if (cont)
+    {
+        job_mark_running(job);
+        job_signal(job, SIGCONT);
+    }
+
+    job_wait(job, 1);
+
+    if (job_control && job->n_procs > 0)
+    {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+        job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+    }
+
+    int status = job_status(job);
+    if (job_state(job) == JOB_STOPPED)
+    {
+        job_register(job);
+        printf("\n[%d]%c  Stopped                 %s\n", job->id, job_marker(job), job->command);
+        fflush(stdout);
+        return status;
+    }
+    job_unregister(job);
+    job_free(job);
+    return status;
+}
+
+// Leaves `job` running in the background (resuming it if asked) and reports it like bash does
+void job_background(Job *job, int cont)
+{
+    int is_new = job->id == 0;
+    job_register(job);
+    if (cont)
+    {
+        job_mark_running(job);
+        job_signal(job, SIGCONT);
+        printf("[%d]%c %s &\n", job->id, job_marker(job), job->command);
+    }
+    else if (is_new && job->n_procs > 0)
+    {
+        char pid_str[16];
+        pid_t last_pid = job->procs[job->n_procs - 1].pid;
+        snprintf(pid_str, sizeof(pid_str), "%d", (int)last_pid);
+        var_set("!", pid_str);
+        if (job_control)
+        {
+            printf("[%d] %d\n", job->id, (int)last_pid);
+        }
+    }
+    fflush(stdout);
+}
+
+// Waits for a registered job without giving it the terminal, then drops it unless it
+// stopped. Returns its $?.
+int job_wait_and_remove(Job *job)
+{
+    job_wait(job, 1);
+    int status = job_status(job);
+    if (job_state(job) == JOB_DONE)
+    {
+        job_unregister(job);
+        job_free(job);
+    }
+    return status;
+}
+
+// Resolves %n, %%, %+, %-, %prefix (and, for `wait`, a plain pid) to a registered job
+Job *job_find(const char *spec)
+{
+    Job *current = NULL, *previous = NULL;
+    for (Job *job = job_list; job != NULL; job = job->next)
+    {
+        previous = current;
+        current = job;
+    }
+
+    if (spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0 || strcmp(spec, "%") == 0)
+    {
+        return current;
+    }
+    if (strcmp(spec, "%-") == 0)
+    {
+        return previous;
+    }
+    if (spec[0] == '%' && isdigit((unsigned char)spec[1]))
+    {
+        int id = atoi(spec + 1);
+        for (Job *job = job_list; job != NULL; job = job->next)
+        {
+            if (job->id == id)
+            {
+                return job;
+            }
+        }
+        return NULL;
+    }
+    if (spec[0] == '%')
+    {
+        Job *match = NULL;
+        for (Job *job = job_list; job != NULL; job = job->next)
+        {
+            if (strncmp(job->command, spec + 1, strlen(spec + 1)) == 0)
+            {
+                match = job;
+            }
+        }
+        return match;
+    }
+    pid_t pid = atoi(spec);
+    for (Job *job = job_list; job != NULL; job = job->next)
+    {
+        for (int i = 0; i < job->n_procs; i++)
+        {
+            if (job->procs[i].pid == pid)
+            {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+Job *jobs_first(void)
+{
+    return job_list;
+}
+
+static const char *job_state_name(const Job *job, char *buf, size_t size)
+{
+    switch (job_state(job))
+    {
+    case JOB_RUNNING:
+        return "Running";
+    case JOB_STOPPED:
+        return "Stopped";
+    default:
+    {
+        int status = job_status(job);
+        if (status == 0)
+        {
+            return "Done";
+        }
+        snprintf(buf, size, "Exit %d", status);
+        return buf;
+    }
+    }
+}
+
+void jobs_print(int show_pids, int pids_only)
+{
+    if (SIGCHLD_PENDING)
+    {
+        jobs_reap();
+    }
+    for (Job *job = job_list; job != NULL; job = job->next)
+    {
+        if (pids_only)
+        {
+            printf("%d\n", (int)job->pgid);
+            continue;
+        }
+        char buf[32];
+        if (show_pids)
+        {
+            printf("[%d]%c %d %-22s %s\n", job->id, job_marker(job), (int)job->pgid,
+                   job_state_name(job, buf, sizeof(buf)), job->command);
+        }
+        else
+        {
+            printf("[%d]%c  %-22s  %s\n", job->id, job_marker(job), job_state_name(job, buf, sizeof(buf)), job->command);
+        }
+    }
+}
+
+// Reports and forgets background jobs that have finished; run before each prompt
+void jobs_notify(void)
+{
+    if (SIGCHLD_PENDING)
+    {
+        jobs_reap();
+    }
+    Job *job = job_list;
+    while (job != NULL)
+    {
+        Job *next = job->next;
+        if (job_state(job) == JOB_DONE)
+        {
+            char buf[32];
+            printf("[%d]%c  %-22s  %s\n", job->id, job_marker(job), job_state_name(job, buf, sizeof(buf)), job->command);
+            job_unregister(job);
+            job_free(job);
+        }
+        job = next;
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,554 @@
+// lexer.c
+#include "psh.h"
+
+// Characters that end a run of ordinary word characters
+#define WORD_BREAKS " \t\n;&|<>()'\"\\$`"
+
+// Removes the backslash-newline pairs that continue a word on the next line, except inside
+// single quotes where a backslash is an ordinary character
+static void drop_continuations(char *text)
+{
+    char *to = text;
+    char quote = '\0';
+    for (const char *from = text; *from; from++)
+    {
+        if (*from == '\'' && quote != '"')
+        {
+            quote = quote ? '\0' : '\'';
+        }
+        else if (*from == '"' && quote != '\'')
+        {
+            quote = quote ? '\0' : '"';
+        }
+        else if (*from == '\\' && quote != '\'' && from[1] != '\0')
+        {
+            if (from[1] == '\n')
+            {
+                from++;
+                continue;
+            }
+            *to++ = *from++;
+        }
+        *to++ = *from;
+    }
+    *to = '\0';
+}
+
+static void push_token(TokenList *list, int type, int flags, const char *start, size_t len, char **out)
+{
+    if (list->n == list->cap)
+    {
+        list->cap = list->cap ? list->cap * 2 : 32;
+        list->tokens = realloc(list->tokens, list->cap * sizeof(Token));
+        if (!list->tokens)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // every token's text lives in the one per-line buffer, NUL-terminated
+    memcpy(*out, start, len);
+    (*out)[len] = '\0';
+    if (type == TOK_WORD && memchr(start, '\n', len) != NULL)
+    {
+        drop_continuations(*out);
+    }
+
+    Token *tok = &list->tokens[list->n++];
+    tok->type = type;
+    tok->flags = flags;
+    tok->text = *out;
+    tok->body = NULL;
+    tok->start = start - list->src;
+    tok->end = tok->start + len;
+    *out += len + 1;
+}
+
+// Length of the redirection operator at `p` (after any fd number), 0 if there is none
+static size_t redirect_length(const char *p)
+{
+    if ((p[0] == '<' || p[0] == '>') && p[1] == '(')
+    {
+        return 0; // process substitution, a word
+    }
+    if (p[0] == '<')
+    {
+        if (p[1] == '<')
+        {
+            return (p[2] == '<' || p[2] == '-') ? 3 : 2; // <<<, <<- and <<
+        }
+        return p[1] == '&' ? 2 : 1;
+    }
+    if (p[0] == '>')
+    {
+        return (p[1] == '>' || p[1] == '&' || p[1] == '|') ? 2 : 1;
+    }
+    if (p[0] == '&' && p[1] == '>')
+    {
+        return p[2] == '>' ? 3 : 2;
+    }
+    return 0;
+}
+
+// Recognises a control or redirection operator at `p`. Returns its length, 0 for a word.
+static size_t operator_length(const char *p, int *type)
+{
+    size_t digits = strspn(p, "0123456789");
+    size_t len = redirect_length(p + digits);
+    if (len > 0 && (digits == 0 || p[digits] != '&'))
+    {
+        *type = TOK_REDIR;
+        return digits + len;
+    }
+
+    switch (p[0])
+    {
+    case ';':
+        *type = p[1] == ';' ? TOK_DSEMI : TOK_SEMI;
+        return p[1] == ';' ? 2 : 1;
+    case '(':
+        *type = TOK_LPAREN;
+        return 1;
+    case ')':
+        *type = TOK_RPAREN;
+        return 1;
+    case '&':
+        *type = p[1] == '&' ? TOK_AND_IF : TOK_AMP;
+        return p[1] == '&' ? 2 : 1;
+    case '|':
+        *type = p[1] == '|' ? TOK_OR_IF : TOK_PIPE;
+        return p[1] == '|' ? 2 : 1;
+    default:
+        return 0;
+    }
+}
+
+// Skips the balanced `open` ... `close` group starting at `p`, as in $(( )) or ${ }. Quotes
+// inside are skipped whole. Returns the character after the closing one, NULL when the
+// input ends first.
+static const char *skip_group(const char *p, char open, char close)
+{
+    const char stops[] = {open, close, '\'', '"', '\\', '\0'};
+    int depth = 0;
+    while (1)
+    {
+        p += strcspn(p, stops);
+        if (*p == open)
+        {
+            depth++;
+            p++;
+            continue;
+        }
+        if (*p == close)
+        {
+            p++;
+            if (--depth == 0)
+            {
+                return p;
+            }
+            continue;
+        }
+        switch (*p)
+        {
+        case '\0':
+            return NULL;
+        case '\'':
+            p = strchr(p + 1, '\'');
+            if (p == NULL)
+            {
+                return NULL;
+            }
+            p++;
+            break;
+        case '"':
+            for (p++; *p != '"'; p++)
+            {
+                if (*p == '\0')
+                {
+                    return NULL;
+                }
+                if (*p == '\\' && p[1] != '\0')
+                {
+                    p++;
+                }
+            }
+            p++;
+            break;
+        case '\\':
+            p += p[1] != '\0' ? 2 : 1;
+            break;
+        }
+    }
+}
+
+// True for `NAME=` or `NAME+=` running from `start` to `end`, where a compound array
+// assignment NAME=( ... ) can begin
+static int is_array_assignment(const char *start, const char *end)
+{
+    if (end - start < 2 || end[-1] != '=' || (!isalpha((unsigned char)*start) && *start != '_'))
+    {
+        return 0;
+    }
+    end -= end[-2] == '+' ? 2 : 1;
+    while (start < end && (isalnum((unsigned char)*start) || *start == '_'))
+    {
+        start++;
+    }
+    return start == end;
+}
+
+// Finds the end of the word starting at `p`, skipping over quoted and escaped parts.
+// Returns NULL on an unterminated quote.
+static const char *scan_word(const char *p, int *flags)
+{
+    const char *start = p;
+    while (1)
+    {
+        // bulk-skip ordinary characters, strcspn is vectorised in glibc
+        p += strcspn(p, WORD_BREAKS);
+        switch (*p)
+        {
+        case '\'':
+        {
+            const char *close = strchr(p + 1, '\'');
+            if (close == NULL)
+            {
+                return NULL;
+            }
+            *flags |= WORD_QUOTED;
+            p = close + 1;
+            break;
+        }
+        case '"':
+            *flags |= WORD_QUOTED;
+            p++;
+            while (1)
+            {
+                p += strcspn(p, "\"\\$");
+                if (*p == '\\' && p[1] != '\0')
+                {
+                    p += 2;
+                    continue;
+                }
+                if (*p == '$')
+                {
+                    // "${v:-"x y"}" and "$(cmd "x y")" can hold quotes of their own
+                    if (p[1] == '{' || p[1] == '(')
+                    {
+                        p = skip_group(p + 1, p[1], p[1] == '{' ? '}' : ')');
+                        if (p == NULL)
+                        {
+                            return NULL;
+                        }
+                    }
+                    else
+                    {
+                        p++;
+                    }
+                    continue;
+                }
+                if (*p != '"')
+                {
+                    return NULL;
+                }
+                p++;
+                break;
+            }
+            break;
+        case '\\':
+            if (p[1] == '\0' || (p[1] == '\n' && p[2] == '\0'))
+            {
+                return NULL; // a trailing backslash continues the line
+            }
+            if (p[1] != '\n')
+            {
+                *flags |= WORD_QUOTED;
+            }
+            p += 2;
+            break;
+        case '`':
+            // `cmd` belongs to the word, blanks and all
+            for (p++; *p != '`'; p++)
+            {
+                if (*p == '\0')
+                {
+                    return NULL;
+                }
+                if (*p == '\\' && p[1] != '\0')
+                {
+                    p++;
+                }
+            }
+            p++;
+            break;
+        case '$':
+            if (p[1] != '{')
+            {
+                p++;
+                break;
+            }
+            // ${ ... } belongs to the word, blanks and all, as in ${VAR:-a default}
+            p = skip_group(p + 1, '{', '}');
+            if (p == NULL)
+            {
+                return NULL;
+            }
+            break;
+        case '(':
+            if (p[-1] != '$' && !is_array_assignment(start, p))
+            {
+                return p;
+            }
+            // $( ... ), $(( ... )) and arr=( ... ) belong to the word, whatever they contain
+            p = skip_group(p, '(', ')');
+            if (p == NULL)
+            {
+                return NULL;
+            }
+            break;
+        case '<':
+        case '>':
+            if (p[1] != '(')
+            {
+                return p;
+            }
+            // <( ... ) and >( ... ) belong to the word
+            p = skip_group(p + 1, '(', ')');
+            if (p == NULL)
+            {
+                return NULL;
+            }
+            break;
+        default:
+            return p;
+        }
+    }
+}
+
+// True for a TOK_REDIR that opens a here-document, << or <<- with an optional fd number
+static int is_heredoc(const Token *tok)
+{
+    if (tok->type != TOK_REDIR)
+    {
+        return 0;
+    }
+    const char *op = tok->text + strspn(tok->text, "0123456789");
+    return strcmp(op, "<<") == 0 || strcmp(op, "<<-") == 0;
+}
+
+// Reads the bodies of the here-documents opened by tokens [from, list->n) out of the lines
+// starting at `p`, one after the other, and hangs each on its delimiter word. <<- drops
+// the leading tabs of every line. Returns the text after the last delimiter line, or NULL
+// when the input ends before it.
+static const char *read_heredocs(TokenList *list, int from, const char *p, char **out)
+{
+    for (int i = from; i + 1 < list->n; i++)
+    {
+        Token *word = &list->tokens[i + 1];
+        if (!is_heredoc(&list->tokens[i]) || word->type != TOK_WORD)
+        {
+            continue;
+        }
+        int strip = list->tokens[i].text[strlen(list->tokens[i].text) - 1] == '-';
+        char *delimiter = strdup(word->text);
+        word_unquote(delimiter);
+        size_t delimiter_len = strlen(delimiter);
+
+        word->body = *out;
+        while (1)
+        {
+            if (*p == '\0')
+            {
+                free(delimiter);
+                return NULL;
+            }
+            const char *line = strip ? p + strspn(p, "\t") : p;
+            const char *eol = strchrnul(line, '\n');
+            p = *eol ? eol + 1 : eol;
+            if ((size_t)(eol - line) == delimiter_len && strncmp(line, delimiter, delimiter_len) == 0)
+            {
+                break;
+            }
+            memcpy(*out, line, p - line);
+            *out += p - line;
+        }
+        *(*out)++ = '\0';
+        free(delimiter);
+    }
+    return p;
+}
+
+// Splits `line` into words and operators in a single pass. Word text is kept as written
+// (quotes included, see word_unquote) in one buffer owned by `list`, so a line of any length
+// costs two allocations plus the token vector's geometric growth.
+// Here-document bodies are taken from the lines after the one that opens them.
+// Returns PARSE_INCOMPLETE, leaving `list` empty, when a quote or parenthesis is still open
+// at the end or a here-document has not seen its delimiter.
+int lex_line(const char *line, TokenList *list)
+{
+    size_t len = strlen(line);
+
+    list->src = line;
+    list->tokens = NULL;
+    list->n = 0;
+    list->cap = 0;
+    // every character plus one terminator per token, which can't outnumber the characters
+    list->buf = malloc(2 * len + 2);
+    if (!list->buf)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *out = list->buf;
+    const char *p = line;
+    int heredoc_from = 0; // tokens before this one have their here-documents read
+    while (1)
+    {
+        p += strspn(p, " \t");
+        if (*p == '\0')
+        {
+            break;
+        }
+        if (p[0] == '\\' && (p[1] == '\n' || p[1] == '\0'))
+        {
+            // a line continuation between words, or one still waiting for its next line
+            if (p[1] == '\0' || p[2] == '\0')
+            {
+                lex_free(list);
+                return PARSE_INCOMPLETE;
+            }
+            p += 2;
+            continue;
+        }
+        if (*p == '#')
+        {
+            // comment up to the end of the line
+            const char *eol = strchr(p, '\n');
+            if (eol == NULL)
+            {
+                break;
+            }
+            p = eol;
+            continue;
+        }
+        if (*p == '\n')
+        {
+            push_token(list, TOK_NEWLINE, 0, p, 1, &out);
+            p = read_heredocs(list, heredoc_from, p + 1, &out);
+            heredoc_from = list->n;
+            if (p == NULL)
+            {
+                lex_free(list);
+                return PARSE_INCOMPLETE;
+            }
+            continue;
+        }
+
+        if (p[0] == '(' && p[1] == '(')
+        {
+            // ((expression)), unless the parentheses do not close as a pair: ((a) (b))
+            const char *end = skip_group(p, '(', ')');
+            if (end == NULL)
+            {
+                lex_free(list);
+                return PARSE_INCOMPLETE;
+            }
+            if (end[-2] == ')' && skip_group(p + 1, '(', ')') == end - 1)
+            {
+                push_token(list, TOK_ARITH, 0, p, end - p, &out);
+                p = end;
+                continue;
+            }
+        }
+
+        int type;
+        size_t op_len = operator_length(p, &type);
+        if (op_len > 0)
+        {
+            push_token(list, type, 0, p, op_len, &out);
+            p += op_len;
+            continue;
+        }
+
+        int flags = 0;
+        const char *end = scan_word(p, &flags);
+        if (end == NULL)
+        {
+            lex_free(list);
+            return PARSE_INCOMPLETE;
+        }
+        push_token(list, TOK_WORD, flags, p, end - p, &out);
+        p = end;
+    }
+    if (read_heredocs(list, heredoc_from, p, &out) == NULL)
+    {
+        lex_free(list);
+        return PARSE_INCOMPLETE;
+    }
+    return PARSE_OK;
+}
+
+void lex_free(TokenList *list)
+{
+    free(list->buf);
+    free(list->tokens);
+    list->buf = NULL;
+    list->tokens = NULL;
+    list->n = 0;
+    list->cap = 0;
+}
+
+// Quote removal, done in place since the result is never longer than the word
+void word_unquote(char *word)
+{
+    char *dst = word;
+    const char *p = word;
+
+    while (*p)
+    {
+        size_t run = strcspn(p, "'\"\\");
+        memmove(dst, p, run);
+        dst += run;
+        p += run;
+
+        if (*p == '\'')
+        {
+            const char *close = strchr(p + 1, '\'');
+            if (close == NULL)
+            {
+                close = p + strlen(p);
+            }
+            memmove(dst, p + 1, close - p - 1);
+            dst += close - p - 1;
+            p = *close ? close + 1 : close;
+        }
+        else if (*p == '"')
+        {
+            p++;
+            while (*p && *p != '"')
+            {
+                // inside double quotes a backslash only escapes \ " $ ` and newline
+                if (*p == '\\' && p[1] != '\0' && strchr("\\\"$`\n", p[1]) != NULL)
+                {
+                    p++;
+                }
+                *dst++ = *p++;
+            }
+            if (*p == '"')
+            {
+                p++;
+            }
+        }
+        else if (*p == '\\')
+        {
+            p++;
+            if (*p)
+            {
+                *dst++ = *p++;
+            }
+        }
+    }
+    *dst = '\0';
+}
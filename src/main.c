@@ -4,6 +4,9 @@
 // Unused Parameters
 int main(int argc, char **argv)
 {
+    extern char **environ;
+    var_init(environ); // from here on variables only live in the shell's own table
+
     printf("\033[1;1H\033[2J"); // basically clears the screen
     getcwd(cwd, sizeof(cwd));   // home/$USER/psh
     strcpy(PATH, cwd);
@@ -14,8 +17,9 @@ int main(int argc, char **argv)
     // load pshrc
     PSH_SCRIPT(COPY_PATH_PSHRC);
 
-    if (argc == 2)
+    if (argc >= 2)
     {
+        positional_init(argv + 2, argc - 2); // psh script.psh arg ...
         return PSH_SCRIPT(argv[1]);
     }
     else
@@ -39,21 +43,54 @@ int PSH_LOOP(void)
     size_t n = 0;
     int run = 1;
     char *inputline = malloc(PATH_MAX);
+    char *pending = NULL; // lines of a command that is still open, e.g. after a trailing backslash
+    size_t pending_len = 0;
     strcpy(path_memory, cwd);
     strcat(path_memory, "/.files/MEMORY_HISTORY_FILE");
+    jobs_init(1);
 
     while (run == 1)
     {
+        if (pending_len == 0)
+        {
+            jobs_notify(); // report background jobs that finished since the last prompt
+        }
+        prompt_continuation = pending_len > 0;
         handle_input(&inputline, &n, PATH);
-        if (inputline[0] == '\0')
+        if (pending_len > 0 && !prompt_continuation)
+        {
+            pending_len = 0; // ^C at the continuation prompt drops the open command
+            continue;
+        }
+        if (inputline[0] == '\0' && pending_len == 0)
         {
             continue;
         }
         char path_session[PATH_MAX];
         get_session_path(path_session, sizeof(path_session), cwd);
-        save_history(inputline, path_session);
-        process_commands(inputline, &run);
+        if (inputline[0] != '\0')
+        {
+            save_history(inputline, path_session);
+        }
+
+        size_t len = strlen(inputline);
+        pending = realloc(pending, pending_len + len + 2);
+        if (!pending)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(pending + pending_len, inputline, len);
+        pending_len += len;
+        pending[pending_len++] = '\n';
+        pending[pending_len] = '\0';
+        if (process_commands(pending, &run) != PARSE_INCOMPLETE)
+        {
+            pending_len = 0;
+        }
     }
+    prompt_continuation = 0;
+    free(pending);
     free(inputline);
     return run;
 }
@@ -67,6 +104,10 @@ int PSH_SCRIPT(const char *file)
     size_t n = 0;
     char *inputline = NULL;
     int result = 0;
+    char *pending = NULL; // lines of a command that is still open, e.g. a `for` before its `done`
+    size_t pending_len = 0;
+    int nesting = 0;  // compound commands the pending lines open and do not close yet
+    int counted = 1;  // every pending line could be judged by line_nesting()
 
     if (script == NULL)
     {
@@ -74,6 +115,7 @@ int PSH_SCRIPT(const char *file)
         run = 0;
         return -1;
     }
+    jobs_init(0);
 
     while (run == 1)
     {
@@ -95,62 +137,44 @@ int PSH_SCRIPT(const char *file)
             break;
         }
 
-        inputline[strcspn(inputline, "\n")] = '\0';
-
-        // Ignore comments starting with '#'
-        char *comment_pos = strchr(inputline, '#');
-        if (comment_pos)
+        size_t len = strlen(inputline);
+        pending = realloc(pending, pending_len + len + 1);
+        if (!pending)
         {
-            *comment_pos = '\0';
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
         }
+        memcpy(pending + pending_len, inputline, len + 1);
+        pending_len += len;
 
-        // Skip processing if the line becomes empty after stripping comments
-        if (inputline[0] == '\0')
+        // while a compound command is still open for sure, parsing the pending lines again
+        // would only fail again; that made long bodies quadratic
+        int delta;
+        if (line_nesting(inputline, &delta) == -1)
+        {
+            counted = 0;
+        }
+        nesting += delta;
+        if (counted && nesting > 0)
         {
             continue;
         }
 
-        char **commands = split_commands(inputline);
-        for (int i = 0; commands[i] != NULL; i++)
+        // comments and blank lines come out of the lexer as no tokens at all
+        if (process_commands(pending, &run) != PARSE_INCOMPLETE)
         {
-            char **token_arr = PSH_TOKENIZER(commands[i]);
-            if (token_arr[0] != NULL)
-            {
-                if (strchr(token_arr[0], '='))
-                {
-                    handle_env_variable(token_arr);
-                    free_double_pointer(token_arr);
-                    continue;
-                }
-                int isinbuilt = 0;
-                for (int j = 0; j < size_builtin_str; j++)
-                {
-                    if (strcmp(token_arr[0], builtin_str[j]) == 0)
-                    {
-                        if (!strcmp(token_arr[0], "exit"))
-                        {
-                            run = (*builtin_func[j])(token_arr);
-                            free_double_pointer(token_arr);
-                            free_double_pointer(commands);
-                            free(inputline);
-                            fclose(script);
-                            return run;
-                        }
-                        run = (*builtin_func[j])(token_arr);
-                        isinbuilt = 1;
-                        break;
-                    }
-                }
-                if (!isinbuilt)
-                {
-                    run = PSH_EXEC_EXTERNAL(token_arr);
-                }
-                free_double_pointer(token_arr);
-            }
+            pending_len = 0;
+            nesting = 0;
+            counted = 1;
         }
-        free_double_pointer(commands);
+    }
+    if (pending_len > 0)
+    {
+        fprintf(stderr, "psh: %s: syntax error: unexpected end of file\n", file);
+        set_exit_status(2);
     }
 
+    free(pending);
     free(inputline);
     fclose(script);
     return result;
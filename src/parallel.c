@@ -0,0 +1,247 @@
+// parallel.c
+#include "psh.h"
+#include <sys/mman.h>
+
+// One running instance of the command template
+typedef struct ParallelSlot
+{
+    pid_t pid;    // 0 when the slot is free
+    int index;    // position of the argument in the input list, for reporting
+    int out_fd;   // memfd holding the job's stdout until it finishes
+    int err_fd;   // memfd holding the job's stderr
+    char **argv;
+} ParallelSlot;
+
+// Anonymous in-memory file for a job's output; falls back to an unlinked temp file
+static int buffer_fd(void)
+{
+    int fd = memfd_create("psh-parallel", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        char name[] = "/tmp/psh-parallel-XXXXXX";
+        fd = mkostemp(name, O_CLOEXEC);
+        if (fd != -1)
+        {
+            unlink(name);
+        }
+    }
+    return fd;
+}
+
+// Copies a finished job's buffered output to `fd` in one piece, so jobs never interleave
+static void flush_buffer(int buf_fd, int fd)
+{
+    char chunk[8192];
+    ssize_t n;
+
+    lseek(buf_fd, 0, SEEK_SET);
+    while ((n = read(buf_fd, chunk, sizeof(chunk))) > 0)
+    {
+        ssize_t done = 0;
+        while (done < n)
+        {
+            ssize_t w = write(fd, chunk + done, n - done);
+            if (w == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return;
+            }
+            done += w;
+        }
+    }
+}
+
+// Instantiates the template for one argument: every `{}` inside a word is replaced by `arg`,
+// and when no word mentions `{}` the argument is appended as the last word.
+static char **build_argv(char **template, const char *arg)
+{
+    int n = size_token_arr(template);
+    char **argv = malloc((n + 2) * sizeof(char *));
+    int used = 0;
+
+    if (!argv)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        const char *word = template[i];
+        size_t arg_len = strlen(arg);
+        size_t len = strlen(word) + 1;
+        for (const char *p = strstr(word, "{}"); p != NULL; p = strstr(p + 2, "{}"))
+        {
+            len += arg_len;
+            used = 1;
+        }
+
+        char *out = malloc(len);
+        if (!out)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        char *dst = out;
+        const char *p;
+        while ((p = strstr(word, "{}")) != NULL)
+        {
+            memcpy(dst, word, p - word);
+            dst += p - word;
+            memcpy(dst, arg, arg_len);
+            dst += arg_len;
+            word = p + 2;
+        }
+        strcpy(dst, word);
+        argv[i] = out;
+    }
+    if (!used)
+    {
+        argv[n++] = strdup(arg);
+    }
+    argv[n] = NULL;
+    return argv;
+}
+
+// Only start another job while the 1-minute load average is under `max_load` (0 = no limit)
+static int load_allows_start(double max_load)
+{
+    double load;
+    if (max_load <= 0 || getloadavg(&load, 1) != 1)
+    {
+        return 1;
+    }
+    return load < max_load;
+}
+
+static int finish_slot(ParallelSlot *slot, int status)
+{
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+
+    fflush(stdout);
+    fflush(stderr);
+    if (slot->out_fd != -1)
+    {
+        flush_buffer(slot->out_fd, STDOUT_FILENO);
+        close(slot->out_fd);
+    }
+    if (slot->err_fd != -1)
+    {
+        flush_buffer(slot->err_fd, STDERR_FILENO);
+        close(slot->err_fd);
+    }
+    if (code != 0)
+    {
+        fprintf(stderr, "psh: parallel: job %d (%s) failed with status %d\n", slot->index + 1, slot->argv[0], code);
+    }
+    free_double_pointer(slot->argv);
+    slot->pid = 0;
+    return code;
+}
+
+// Runs `template` once per argument with at most `slots` children alive at a time.
+// Children go through the same launch path as pipeline stages, no sub-shell is involved.
+// Returns the number of failed jobs (capped at 101, like GNU parallel), 0 if all succeeded.
+int parallel_run(char **template, char **args, int n_args, int slots, double max_load, int null_stdin)
+{
+    ParallelSlot *table = calloc(slots, sizeof(ParallelSlot));
+    sigset_t sigset, oldset;
+    int running = 0, failed = 0, next = 0;
+    int devnull = -1;
+
+    if (!table)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    if (null_stdin)
+    {
+        // stdin has been consumed for the argument list, jobs must not read from it
+        devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    // Blocking SIGINT in the parent process
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGINT);
+    sigprocmask(SIG_BLOCK, &sigset, &oldset);
+
+    while (next < n_args || running > 0)
+    {
+        if (next < n_args && running < slots && (running == 0 || load_allows_start(max_load)))
+        {
+            ParallelSlot *slot = table;
+            while (slot->pid != 0)
+            {
+                slot++;
+            }
+
+            FdAction actions[3];
+            int n_actions = 0;
+            slot->index = next;
+            slot->argv = build_argv(template, args[next++]);
+            slot->out_fd = buffer_fd();
+            slot->err_fd = buffer_fd();
+            if (slot->out_fd != -1)
+            {
+                actions[n_actions++] = (FdAction){STDOUT_FILENO, slot->out_fd};
+            }
+            if (slot->err_fd != -1)
+            {
+                actions[n_actions++] = (FdAction){STDERR_FILENO, slot->err_fd};
+            }
+            if (devnull != -1)
+            {
+                actions[n_actions++] = (FdAction){STDIN_FILENO, devnull};
+            }
+
+            SpawnOptions opts = {&oldset, actions, n_actions, -1, 0, NULL};
+            slot->pid = launch_command(slot->argv, &opts);
+            if (slot->pid > 0)
+            {
+                running++;
+                continue;
+            }
+            // launch_command already reported why and left 127/126 in last_status
+            if (finish_slot(slot, W_EXITCODE(last_status, 0)) != 0)
+            {
+                failed++;
+            }
+            continue;
+        }
+
+        if (running == 0)
+        {
+            continue;
+        }
+
+        int status;
+        pid_t pid = jobs_wait_untracked(&status);
+        if (pid == -1)
+        {
+            break;
+        }
+        for (int i = 0; i < slots; i++)
+        {
+            if (table[i].pid == pid)
+            {
+                if (finish_slot(&table[i], status) != 0)
+                {
+                    failed++;
+                }
+                running--;
+                break;
+            }
+        }
+    }
+
+    // Restoring the old signal mask
+    sigprocmask(SIG_SETMASK, &oldset, NULL);
+    if (devnull != -1)
+    {
+        close(devnull);
+    }
+    free(table);
+    return failed > 101 ? 101 : failed;
+}
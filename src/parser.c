@@ -0,0 +1,1003 @@
+// parser.c
+#include "psh.h"
+
+// Words that mean something to the grammar when they appear unquoted in command position
+static const char *reserved_words[] = {"!", "{", "}", "for", "in", "do", "done", "if", "then", "elif", "else",
+                                       "fi", "while", "until", "case", "esac", "function", "[[", "]]", NULL};
+
+// Reserved words that close a nested list; a command can never start with one
+static const char *closing_words[] = {"}", "do", "done", "then", "elif", "else", "fi", "esac", NULL};
+
+typedef struct Parser
+{
+    TokenList *list;
+    int pos;
+    int incomplete; // ran out of tokens where more were required
+} Parser;
+
+static Node *parse_list(Parser *p, int top_level);
+static Node *parse_command(Parser *p);
+
+int is_reserved_word(const char *word)
+{
+    for (int i = 0; reserved_words[i] != NULL; i++)
+    {
+        if (strcmp(word, reserved_words[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static Token *peek(Parser *p)
+{
+    return p->pos < p->list->n ? &p->list->tokens[p->pos] : NULL;
+}
+
+// True when the next token is the unquoted reserved word `word`
+static int peek_reserved(Parser *p, const char *word)
+{
+    Token *tok = peek(p);
+    return tok != NULL && tok->type == TOK_WORD && !(tok->flags & WORD_QUOTED) && strcmp(tok->text, word) == 0;
+}
+
+// True when the next token ends the list of a compound command
+static int at_list_end(Parser *p)
+{
+    Token *tok = peek(p);
+    if (tok != NULL && (tok->type == TOK_DSEMI || tok->type == TOK_RPAREN))
+    {
+        return 1;
+    }
+    for (int i = 0; closing_words[i] != NULL; i++)
+    {
+        if (peek_reserved(p, closing_words[i]))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void skip_newlines(Parser *p)
+{
+    while (peek(p) != NULL && peek(p)->type == TOK_NEWLINE)
+    {
+        p->pos++;
+    }
+}
+
+// Reports the token the parser choked on; at the end of input the text is just incomplete
+static Node *syntax_error(Parser *p)
+{
+    Token *tok = peek(p);
+    if (tok == NULL)
+    {
+        p->incomplete = 1;
+        return NULL;
+    }
+    fprintf(stderr, "psh: syntax error near unexpected token `%s'\n", tok->type == TOK_NEWLINE ? "newline" : tok->text);
+    return NULL;
+}
+
+static int expect_reserved(Parser *p, const char *word)
+{
+    skip_newlines(p);
+    if (!peek_reserved(p, word))
+    {
+        syntax_error(p);
+        return 0;
+    }
+    p->pos++;
+    return 1;
+}
+
+static Node *new_node(int type)
+{
+    Node *node = calloc(1, sizeof(Node));
+    if (!node)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    node->type = type;
+    return node;
+}
+
+static void add_child(Node *node, Node *child)
+{
+    node->children = realloc(node->children, (node->n_children + 1) * sizeof(Node *));
+    if (!node->children)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    node->children[node->n_children++] = child;
+}
+
+// Appends to a NULL-terminated word list, growing it geometrically: `for` lists can be long
+static void add_word(char ***words, int *n, int *cap, const char *word)
+{
+    if (*n + 2 > *cap)
+    {
+        *cap = *cap ? *cap * 2 : 8;
+        *words = realloc(*words, *cap * sizeof(char *));
+        if (!*words)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*words)[(*n)++] = strdup(word);
+    (*words)[*n] = NULL;
+}
+
+// Source text of tokens [from, p->pos), kept for job listings
+static char *source_text(Parser *p, int from)
+{
+    const Token *first = &p->list->tokens[from];
+    const Token *last = &p->list->tokens[p->pos - 1];
+    return strndup(p->list->src + first->start, last->end - first->start);
+}
+
+// Consumes a redirection operator and its operand, appending to `*tail`
+static int parse_redirect(Parser *p, Redirect ***tail)
+{
+    Token *op = &p->list->tokens[p->pos++];
+    Token *operand = peek(p);
+    if (operand == NULL || operand->type != TOK_WORD)
+    {
+        fprintf(stderr, "psh: syntax error near unexpected token `%s'\n",
+                operand == NULL || operand->type == TOK_NEWLINE ? "newline" : operand->text);
+        return -1;
+    }
+    p->pos++;
+    **tail = redirect_from_operator(op->text, operand);
+    if (**tail == NULL)
+    {
+        fprintf(stderr, "psh: syntax error near unexpected token `%s'\n", op->text);
+        return -1;
+    }
+    while (**tail != NULL)
+    {
+        *tail = &(**tail)->next;
+    }
+    return 0;
+}
+
+// Redirections written after a compound command, e.g. `for ...; done > log`
+static int parse_trailing_redirects(Parser *p, Node *node)
+{
+    Redirect **tail = &node->redirs;
+    while (peek(p) != NULL && peek(p)->type == TOK_REDIR)
+    {
+        if (parse_redirect(p, &tail) == -1)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static Node *parse_simple(Parser *p)
+{
+    Node *node = new_node(NODE_SIMPLE);
+    Redirect **tail = &node->redirs;
+    int n_words = 0, cap_words = 0;
+
+    while (peek(p) != NULL && (peek(p)->type == TOK_WORD || peek(p)->type == TOK_REDIR))
+    {
+        if (peek(p)->type == TOK_REDIR)
+        {
+            if (parse_redirect(p, &tail) == -1)
+            {
+                free_node(node);
+                return NULL;
+            }
+            continue;
+        }
+        add_word(&node->words, &n_words, &cap_words, peek(p)->text);
+        p->pos++;
+    }
+    if (n_words == 0 && node->redirs == NULL)
+    {
+        free_node(node);
+        return syntax_error(p);
+    }
+    return node;
+}
+
+// Copies the expression between (( and )) of an arithmetic token
+static char *arith_text(const Token *tok)
+{
+    return strndup(tok->text + 2, strlen(tok->text) - 4);
+}
+
+// for ((init; condition; step)) do LIST done. The three parts are split at the top-level
+// semicolons and stored as words[0..2].
+static Node *parse_arith_for(Parser *p, Node *node)
+{
+    char *text = arith_text(peek(p));
+    int n_words = 0, cap_words = 0;
+    int depth = 0;
+    char *part = text;
+
+    node->type = NODE_ARITH_FOR;
+    p->pos++;
+    for (char *c = text;; c++)
+    {
+        depth += (*c == '(') - (*c == ')');
+        if (*c == '\0' || (*c == ';' && depth == 0))
+        {
+            char end = *c;
+            *c = '\0';
+            add_word(&node->words, &n_words, &cap_words, part);
+            part = c + 1;
+            if (end == '\0')
+            {
+                break;
+            }
+        }
+    }
+    free(text);
+    if (n_words != 3)
+    {
+        fprintf(stderr, "psh: syntax error: arithmetic for needs three expressions\n");
+        free_node(node);
+        return NULL;
+    }
+    if (peek(p) != NULL && (peek(p)->type == TOK_SEMI || peek(p)->type == TOK_NEWLINE))
+    {
+        p->pos++;
+    }
+
+    Node *body = NULL;
+    if (!expect_reserved(p, "do") || (body = parse_list(p, 0)) == NULL || !expect_reserved(p, "done"))
+    {
+        free_node(body);
+        free_node(node);
+        return NULL;
+    }
+    add_child(node, body);
+    return node;
+}
+
+// for NAME [in WORD ...] ; do LIST ; done
+static Node *parse_for(Parser *p)
+{
+    Node *node = new_node(NODE_FOR);
+    int n_words = 0, cap_words = 0;
+
+    p->pos++; // `for`
+    if (peek(p) != NULL && peek(p)->type == TOK_ARITH)
+    {
+        return parse_arith_for(p, node);
+    }
+    Token *name = peek(p);
+    if (name == NULL || name->type != TOK_WORD)
+    {
+        free_node(node);
+        return syntax_error(p);
+    }
+    node->name = strdup(name->text);
+    p->pos++;
+
+    skip_newlines(p);
+    if (peek_reserved(p, "in"))
+    {
+        p->pos++;
+        node->words = calloc(1, sizeof(char *)); // the list exists even when it is empty
+        while (peek(p) != NULL && peek(p)->type == TOK_WORD)
+        {
+            add_word(&node->words, &n_words, &cap_words, peek(p)->text);
+            p->pos++;
+        }
+    }
+    if (peek(p) != NULL && (peek(p)->type == TOK_SEMI || peek(p)->type == TOK_NEWLINE))
+    {
+        p->pos++;
+    }
+
+    Node *body = NULL;
+    if (!expect_reserved(p, "do") || (body = parse_list(p, 0)) == NULL || !expect_reserved(p, "done"))
+    {
+        free_node(body);
+        free_node(node);
+        return NULL;
+    }
+    add_child(node, body);
+    return node;
+}
+
+// { LIST ; }
+static Node *parse_group(Parser *p)
+{
+    Node *node = new_node(NODE_GROUP);
+    Node *body;
+
+    p->pos++; // `{`
+    if ((body = parse_list(p, 0)) == NULL || !expect_reserved(p, "}"))
+    {
+        free_node(body);
+        free_node(node);
+        return NULL;
+    }
+    add_child(node, body);
+    return node;
+}
+
+// ( list ), run in a forked copy of the shell
+static Node *parse_subshell(Parser *p)
+{
+    int start = p->pos;
+    Node *node = new_node(NODE_SUBSHELL);
+    Node *body;
+
+    p->pos++; // `(`
+    if ((body = parse_list(p, 0)) == NULL)
+    {
+        free_node(node);
+        return NULL;
+    }
+    skip_newlines(p);
+    if (peek(p) == NULL || peek(p)->type != TOK_RPAREN)
+    {
+        free_node(body);
+        free_node(node);
+        return syntax_error(p);
+    }
+    p->pos++;
+    add_child(node, body);
+    node->text = source_text(p, start);
+    return node;
+}
+
+// if LIST; then LIST; [elif LIST; then LIST; ...] [else LIST;] fi
+// Children are condition/body pairs, plus the else body last when there is one.
+static Node *parse_if(Parser *p)
+{
+    Node *node = new_node(NODE_IF);
+
+    p->pos++; // `if`
+    while (1)
+    {
+        Node *cond = parse_list(p, 0);
+        if (cond == NULL)
+        {
+            free_node(node);
+            return NULL;
+        }
+        add_child(node, cond);
+        Node *body = NULL;
+        if (!expect_reserved(p, "then") || (body = parse_list(p, 0)) == NULL)
+        {
+            free_node(node);
+            return NULL;
+        }
+        add_child(node, body);
+        if (!peek_reserved(p, "elif"))
+        {
+            break;
+        }
+        p->pos++;
+    }
+    if (peek_reserved(p, "else"))
+    {
+        p->pos++;
+        Node *body = parse_list(p, 0);
+        if (body == NULL)
+        {
+            free_node(node);
+            return NULL;
+        }
+        add_child(node, body);
+    }
+    if (!expect_reserved(p, "fi"))
+    {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// while LIST; do LIST; done, and the same for until
+static Node *parse_loop(Parser *p, int type)
+{
+    Node *node = new_node(type);
+    Node *cond, *body = NULL;
+
+    p->pos++; // `while` / `until`
+    if ((cond = parse_list(p, 0)) == NULL)
+    {
+        free_node(node);
+        return NULL;
+    }
+    add_child(node, cond);
+    if (!expect_reserved(p, "do") || (body = parse_list(p, 0)) == NULL || !expect_reserved(p, "done"))
+    {
+        free_node(body);
+        free_node(node);
+        return NULL;
+    }
+    add_child(node, body);
+    return node;
+}
+
+// One `[(] pattern [| pattern ...]) [LIST]` of a case, up to its `;;` or the `esac`
+static Node *parse_case_item(Parser *p)
+{
+    Node *item = new_node(NODE_CASE_ITEM);
+    int n_words = 0, cap_words = 0;
+
+    if (peek(p) != NULL && peek(p)->type == TOK_LPAREN)
+    {
+        p->pos++;
+    }
+    while (1)
+    {
+        Token *pattern = peek(p);
+        if (pattern == NULL || pattern->type != TOK_WORD)
+        {
+            free_node(item);
+            return syntax_error(p);
+        }
+        add_word(&item->words, &n_words, &cap_words, pattern->text);
+        p->pos++;
+        if (peek(p) == NULL || peek(p)->type != TOK_PIPE)
+        {
+            break;
+        }
+        p->pos++;
+    }
+    if (peek(p) == NULL || peek(p)->type != TOK_RPAREN)
+    {
+        free_node(item);
+        return syntax_error(p);
+    }
+    p->pos++;
+
+    skip_newlines(p);
+    if (!at_list_end(p))
+    {
+        Node *body = parse_list(p, 0);
+        if (body == NULL)
+        {
+            free_node(item);
+            return NULL;
+        }
+        add_child(item, body);
+    }
+    if (peek(p) != NULL && peek(p)->type == TOK_DSEMI)
+    {
+        p->pos++;
+    }
+    else if (!peek_reserved(p, "esac"))
+    {
+        free_node(item);
+        return syntax_error(p);
+    }
+    return item;
+}
+
+// case WORD in [item ...] esac
+static Node *parse_case(Parser *p)
+{
+    Node *node = new_node(NODE_CASE);
+    int n_words = 0, cap_words = 0;
+
+    p->pos++; // `case`
+    Token *subject = peek(p);
+    if (subject == NULL || subject->type != TOK_WORD)
+    {
+        free_node(node);
+        return syntax_error(p);
+    }
+    add_word(&node->words, &n_words, &cap_words, subject->text);
+    p->pos++;
+    if (!expect_reserved(p, "in"))
+    {
+        free_node(node);
+        return NULL;
+    }
+    skip_newlines(p);
+    while (!peek_reserved(p, "esac"))
+    {
+        Node *item = parse_case_item(p);
+        if (item == NULL)
+        {
+            free_node(node);
+            return NULL;
+        }
+        add_child(node, item);
+        skip_newlines(p);
+    }
+    p->pos++; // `esac`
+    return node;
+}
+
+// [[ expression ]]: the words up to ]] are kept as written and evaluated by cond_eval() on every
+// run. The operators the lexer splits off (&&, ||, <, >, parentheses) come back as words, and
+// the regex after =~ is rejoined from the tokens written without blanks between them, so
+// `[[ $x =~ ^(a|b)$ ]]` needs no quotes.
+static Node *parse_cond(Parser *p)
+{
+    Node *node = new_node(NODE_COND);
+    int n_words = 0, cap_words = 0;
+    p->pos++;
+    while (1)
+    {
+        Token *tok = peek(p);
+        if (tok == NULL)
+        {
+            free_node(node);
+            return syntax_error(p);
+        }
+        if (tok->type == TOK_NEWLINE)
+        {
+            p->pos++;
+            continue;
+        }
+        if (tok->type == TOK_WORD && !(tok->flags & WORD_QUOTED) && strcmp(tok->text, "]]") == 0)
+        {
+            p->pos++;
+            break;
+        }
+        if (tok->type == TOK_SEMI || tok->type == TOK_AMP || tok->type == TOK_PIPE || tok->type == TOK_DSEMI)
+        {
+            free_node(node);
+            return syntax_error(p);
+        }
+        if (n_words > 0 && strcmp(node->words[n_words - 1], "=~") == 0)
+        {
+            int first = p->pos;
+            while (p->pos + 1 < p->list->n && p->list->tokens[p->pos + 1].type != TOK_NEWLINE &&
+                   p->list->tokens[p->pos + 1].start == p->list->tokens[p->pos].end)
+            {
+                p->pos++;
+            }
+            char *regex = strndup(p->list->src + p->list->tokens[first].start,
+                                  p->list->tokens[p->pos].end - p->list->tokens[first].start);
+            add_word(&node->words, &n_words, &cap_words, regex);
+            free(regex);
+        }
+        else
+        {
+            add_word(&node->words, &n_words, &cap_words, tok->text);
+        }
+        p->pos++;
+    }
+    if (n_words == 0)
+    {
+        free_node(node);
+        fprintf(stderr, "psh: syntax error near unexpected token `]]'\n");
+        return NULL;
+    }
+    return node;
+}
+
+static int is_function_name(const char *name)
+{
+    if (!isalpha((unsigned char)name[0]) && name[0] != '_')
+    {
+        return 0;
+    }
+    for (const char *c = name; *c; c++)
+    {
+        if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-' && *c != '.')
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// name() compound-command, or `function name [()] compound-command`
+static Node *parse_function(Parser *p)
+{
+    if (peek_reserved(p, "function"))
+    {
+        p->pos++;
+    }
+    Token *name = peek(p);
+    if (name == NULL || name->type != TOK_WORD || (name->flags & WORD_QUOTED) || !is_function_name(name->text))
+    {
+        return syntax_error(p);
+    }
+    p->pos++;
+    if (peek(p) != NULL && peek(p)->type == TOK_LPAREN)
+    {
+        p->pos++;
+        if (peek(p) == NULL || peek(p)->type != TOK_RPAREN)
+        {
+            return syntax_error(p);
+        }
+        p->pos++;
+    }
+    skip_newlines(p);
+
+    Token *start = peek(p);
+    Node *body = parse_command(p);
+    if (body == NULL)
+    {
+        return NULL;
+    }
+    if (body->type == NODE_SIMPLE)
+    {
+        free_node(body);
+        fprintf(stderr, "psh: syntax error near unexpected token `%s'\n", start->text);
+        return NULL;
+    }
+    Node *node = new_node(NODE_FUNCTION);
+    node->name = strdup(name->text);
+    add_child(node, body);
+    return node;
+}
+
+static Node *parse_command(Parser *p)
+{
+    Token *tok = peek(p);
+    if (tok == NULL)
+    {
+        return syntax_error(p);
+    }
+
+    Node *node;
+    if (tok->type == TOK_ARITH)
+    {
+        node = new_node(NODE_ARITH);
+        node->words = calloc(2, sizeof(char *));
+        if (!node->words)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        node->words[0] = arith_text(tok);
+        p->pos++;
+    }
+    else if (tok->type == TOK_LPAREN)
+    {
+        node = parse_subshell(p);
+    }
+    else if (tok->type != TOK_WORD || (tok->flags & WORD_QUOTED))
+    {
+        return parse_simple(p);
+    }
+    else if (strcmp(tok->text, "for") == 0)
+    {
+        node = parse_for(p);
+    }
+    else if (strcmp(tok->text, "{") == 0)
+    {
+        node = parse_group(p);
+    }
+    else if (strcmp(tok->text, "if") == 0)
+    {
+        node = parse_if(p);
+    }
+    else if (strcmp(tok->text, "while") == 0 || strcmp(tok->text, "until") == 0)
+    {
+        node = parse_loop(p, tok->text[0] == 'w' ? NODE_WHILE : NODE_UNTIL);
+    }
+    else if (strcmp(tok->text, "case") == 0)
+    {
+        node = parse_case(p);
+    }
+    else if (strcmp(tok->text, "[[") == 0)
+    {
+        node = parse_cond(p);
+    }
+    else if (strcmp(tok->text, "function") == 0 ||
+             (p->pos + 1 < p->list->n && p->list->tokens[p->pos + 1].type == TOK_LPAREN))
+    {
+        return parse_function(p);
+    }
+    else if (at_list_end(p))
+    {
+        return syntax_error(p);
+    }
+    else
+    {
+        return parse_simple(p);
+    }
+    if (node != NULL && parse_trailing_redirects(p, node) == -1)
+    {
+        free_node(node);
+        return NULL;
+    }
+    return node;
+}
+
+// [!] command [| command ...]
+static Node *parse_pipeline(Parser *p)
+{
+    int start = p->pos;
+    Node *node = new_node(NODE_PIPELINE);
+
+    if (peek_reserved(p, "!"))
+    {
+        node->negate = 1;
+        p->pos++;
+    }
+    while (1)
+    {
+        Node *command = parse_command(p);
+        if (command == NULL)
+        {
+            free_node(node);
+            return NULL;
+        }
+        add_child(node, command);
+        if (peek(p) == NULL || peek(p)->type != TOK_PIPE)
+        {
+            break;
+        }
+        p->pos++;
+        skip_newlines(p);
+    }
+    node->text = source_text(p, start);
+    return node;
+}
+
+// pipeline [&& pipeline | || pipeline ...], grouped to the left
+static Node *parse_and_or(Parser *p)
+{
+    int start = p->pos;
+    Node *left = parse_pipeline(p);
+    while (left != NULL && peek(p) != NULL && (peek(p)->type == TOK_AND_IF || peek(p)->type == TOK_OR_IF))
+    {
+        Node *node = new_node(peek(p)->type == TOK_AND_IF ? NODE_AND : NODE_OR);
+        p->pos++;
+        skip_newlines(p);
+        Node *right = parse_pipeline(p);
+        add_child(node, left);
+        if (right == NULL)
+        {
+            free_node(node);
+            return NULL;
+        }
+        add_child(node, right);
+        node->text = source_text(p, start);
+        left = node;
+    }
+    return left;
+}
+
+// and_or [; and_or | & and_or | newline and_or ...]. Inside compound commands the list
+// stops in front of the reserved word that closes it.
+static Node *parse_list(Parser *p, int top_level)
+{
+    Node *list = new_node(NODE_LIST);
+
+    skip_newlines(p);
+    while (peek(p) != NULL)
+    {
+        if (!top_level && at_list_end(p))
+        {
+            break;
+        }
+        Node *item = parse_and_or(p);
+        if (item == NULL)
+        {
+            free_node(list);
+            return NULL;
+        }
+        add_child(list, item);
+
+        Token *sep = peek(p);
+        if (sep == NULL)
+        {
+            break;
+        }
+        if (sep->type == TOK_AMP)
+        {
+            item->background = 1;
+        }
+        else if (sep->type != TOK_SEMI && sep->type != TOK_NEWLINE)
+        {
+            if (!top_level && (sep->type == TOK_DSEMI || sep->type == TOK_RPAREN))
+            {
+                break; // end of a case item or a subshell, the caller takes it
+            }
+            free_node(list);
+            return syntax_error(p);
+        }
+        p->pos++;
+        skip_newlines(p);
+    }
+    if (!top_level && list->n_children == 0)
+    {
+        free_node(list);
+        return syntax_error(p);
+    }
+    return list;
+}
+
+void free_node(Node *node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+    if (node->refs > 0)
+    {
+        node->refs--; // still in use elsewhere, e.g. as a function body
+        return;
+    }
+    for (int i = 0; i < node->n_children; i++)
+    {
+        free_node(node->children[i]);
+    }
+    free(node->children);
+    free_double_pointer(node->words);
+    free(node->name);
+    free(node->text);
+    free_redirections(node->redirs);
+    free_code(node->code);
+    free(node);
+}
+
+// Whether the token after `prev` is in command position, where aliases apply
+static int opens_command(const Token *prev)
+{
+    if (prev == NULL)
+    {
+        return 1;
+    }
+    if (prev->type != TOK_WORD)
+    {
+        return prev->type != TOK_REDIR;
+    }
+    // a new command also starts right after a reserved word such as `do`, `then` or `{`,
+    // except the ones that are followed by a name or word: `for x`, `case w`, `in`, `function f`
+    return !(prev->flags & WORD_QUOTED) && is_reserved_word(prev->text) && strcmp(prev->text, "for") != 0 &&
+           strcmp(prev->text, "case") != 0 && strcmp(prev->text, "in") != 0 && strcmp(prev->text, "function") != 0;
+}
+
+// Substitutes aliases for the command word of each simple command and lexes the result again.
+// Returns the text `list` now refers to: `line` itself when no alias applied, else a malloc'd copy.
+static char *expand_aliases(const char *line, TokenList *list, HashMap *map)
+{
+    char *expanded = (char *)line;
+    size_t guard = 0; // text before this offset came out of an alias and is not expanded again
+    int in_cond = 0;  // between [[ and ]] nothing is a command
+    for (int i = 0; i < list->n; i++)
+    {
+        Token *tok = &list->tokens[i];
+        if (in_cond || (tok->type == TOK_WORD && strcmp(tok->text, "[[") == 0))
+        {
+            in_cond = !(tok->type == TOK_WORD && strcmp(tok->text, "]]") == 0);
+            continue;
+        }
+        if (tok->type != TOK_WORD || (tok->flags & WORD_QUOTED) || tok->start < guard || is_reserved_word(tok->text))
+        {
+            continue;
+        }
+        if (!opens_command(i > 0 ? &list->tokens[i - 1] : NULL))
+        {
+            continue;
+        }
+        const char *command = get_alias_command(map, tok->text);
+        if (command == NULL)
+        {
+            continue;
+        }
+
+        size_t command_len = strlen(command);
+        size_t tail_len = strlen(expanded + tok->end);
+        char *next = malloc(tok->start + command_len + tail_len + 1);
+        if (!next)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(next, expanded, tok->start);
+        memcpy(next + tok->start, command, command_len);
+        memcpy(next + tok->start + command_len, expanded + tok->end, tail_len + 1);
+        guard = tok->start + command_len;
+
+        lex_free(list);
+        if (expanded != line)
+        {
+            free(expanded);
+        }
+        expanded = next;
+        lex_line(expanded, list);
+        i = -1;
+    }
+    return expanded;
+}
+
+// How much one line on its own changes the nesting of compound commands: `for`, `while`,
+// `until`, `if`, `{`, `[[` and `(` count up, their closing words and `)` down. A script reader
+// only has to parse its pending lines again once the count is back to zero. Returns -1 when
+// the line cannot be judged alone: it does not lex by itself, ends in a continuation, opens
+// a here-document, starts a `case` (whose patterns end in a bare `)`) or uses an alias.
+int line_nesting(const char *line, int *delta)
+{
+    TokenList list;
+    size_t len = strlen(line);
+    *delta = 0;
+    if ((len >= 2 && strcmp(line + len - 2, "\\\n") == 0) || lex_line(line, &list) == PARSE_INCOMPLETE)
+    {
+        return -1;
+    }
+    static const char *openers[] = {"for", "while", "until", "if", "{", "[[", NULL};
+    static const char *closers[] = {"done", "fi", "}", NULL};
+    int result = 0, in_cond = 0;
+    for (int i = 0; i < list.n && result == 0; i++)
+    {
+        Token *tok = &list.tokens[i];
+        if (tok->type == TOK_LPAREN || tok->type == TOK_RPAREN)
+        {
+            *delta += tok->type == TOK_LPAREN ? 1 : -1;
+            continue;
+        }
+        if (tok->type == TOK_REDIR && strstr(tok->text, "<<") != NULL && strstr(tok->text, "<<<") == NULL)
+        {
+            result = -1;
+        }
+        if (tok->type != TOK_WORD || (tok->flags & WORD_QUOTED))
+        {
+            continue;
+        }
+        if (strcmp(tok->text, "]]") == 0)
+        {
+            in_cond = 0; // its [[ may be on an earlier line
+            (*delta)--;
+            continue;
+        }
+        if (in_cond)
+        {
+            continue;
+        }
+        if (!opens_command(i > 0 ? &list.tokens[i - 1] : NULL))
+        {
+            continue;
+        }
+        if (strcmp(tok->text, "case") == 0 || get_alias_command(alias_map(), tok->text) != NULL)
+        {
+            result = -1;
+        }
+        for (int j = 0; openers[j] != NULL; j++)
+        {
+            *delta += strcmp(tok->text, openers[j]) == 0;
+        }
+        for (int j = 0; closers[j] != NULL; j++)
+        {
+            *delta -= strcmp(tok->text, closers[j]) == 0;
+        }
+        in_cond = strcmp(tok->text, "[[") == 0;
+    }
+    lex_free(&list);
+    return result;
+}
+
+// Lexes and parses a complete piece of input into one NODE_LIST. Returns PARSE_OK,
+// PARSE_ERROR (already reported) or PARSE_INCOMPLETE when the input stops inside a
+// construct, e.g. an open quote, a trailing `|` or a `for` without its `done`.
+int parse_program(const char *text, Node **out)
+{
+    TokenList list;
+    *out = NULL;
+    if (lex_line(text, &list) == PARSE_INCOMPLETE)
+    {
+        return PARSE_INCOMPLETE;
+    }
+
+    char *line = expand_aliases(text, &list, alias_map());
+    Parser p = {&list, 0, 0};
+    Node *program = parse_list(&p, 1);
+
+    lex_free(&list);
+    if (line != text)
+    {
+        free(line);
+    }
+    if (program == NULL)
+    {
+        return p.incomplete ? PARSE_INCOMPLETE : PARSE_ERROR;
+    }
+    *out = program;
+    return PARSE_OK;
+}
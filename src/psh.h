@@ -2,6 +2,11 @@
 #ifndef PSH_H
 #define PSH_H
 
+// pipe2, F_SETPIPE_SZ and friends
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 //for reverse search
 #define CTRL_R 18
 #define CTRL_S 19
@@ -45,14 +50,14 @@
 #include <signal.h>
 #include <dirent.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <fnmatch.h>
 
-#define MAX_VARS 100
 #define ARROW_UP 'A'
 #define ARROW_DOWN 'B'
 #define ARROW_LEFT 'D'
 #define ARROW_RIGHT 'C'
 
-#define MAX_VARS 100
 #define PATH_MAX 4096
 #define ARROW_UP 'A'
 #define ARROW_DOWN 'B'
@@ -61,20 +66,19 @@
 #define MAX_LINE_LENGTH 1024
 #define BACKSPACE 127
 #define HASHMAP_SIZE 256
+#define CMDHASH_SIZE 256
+#define VARS_SIZE 256
+#define FUNCS_SIZE 64
 
 #define MAX_COMMAND_LENGTH 50
 
-// Defining Structs to hold variables and functions
-struct Variable
-{
-    char var_name[64];
-    char var_value[256];
-};
-// struct Func              // function declarations
-// {
-//     char func_name[64];
-//     char func_def[1024];
-// };
+// Launch backends for external commands, pick at build time with `make SPAWN=fork`
+// or at runtime with PSH_SPAWN=fork / PSH_SPAWN=posix_spawn
+#define SPAWN_BACKEND_POSIX 0
+#define SPAWN_BACKEND_FORK 1
+#ifndef PSH_SPAWN_BACKEND
+#define PSH_SPAWN_BACKEND SPAWN_BACKEND_POSIX
+#endif
 
 typedef struct Alias
 {
@@ -89,6 +93,180 @@ typedef struct HashMap
     int size;
 } HashMap;
 
+// One piece of child fd plumbing: dup2(source, fd), or close(fd) when source is -1
+typedef struct FdAction
+{
+    int fd;
+    int source;
+} FdAction;
+
+// How psh_spawn should set a child up before exec
+typedef struct SpawnOptions
+{
+    const sigset_t *mask;     // signal mask the child starts with
+    const FdAction *actions;  // fd plumbing, applied in order
+    int n_actions;
+    pid_t pgid;               // -1 stay in the shell's group, 0 lead a new group, >0 join that group
+    int foreground;           // give the terminal to the child's group (job control only)
+    char **envp;              // environment for an exec, NULL for var_environ()
+} SpawnOptions;
+
+// Job control: one Job per pipeline, one JobProcess per stage
+#define JOB_RUNNING 0
+#define JOB_STOPPED 1
+#define JOB_DONE 2
+
+typedef struct JobProcess
+{
+    pid_t pid;
+    int state;  // JOB_*
+    int status; // raw waitpid() status
+} JobProcess;
+
+typedef struct Job
+{
+    int id;                 // %n, 0 until the job is registered in the table
+    pid_t pgid;
+    JobProcess *procs;
+    int n_procs;
+    int cap_procs;
+    int launch_status;      // $? when no process could be started at all
+    char *command;
+    struct termios tmodes;  // terminal modes saved when the job stopped
+    int has_tmodes;
+    struct Job *next;
+} Job;
+
+// Token kinds produced by lex_line()
+#define TOK_WORD 0
+#define TOK_SEMI 1     // ;
+#define TOK_AMP 2      // &
+#define TOK_PIPE 3     // |
+#define TOK_AND_IF 4   // &&
+#define TOK_OR_IF 5    // ||
+#define TOK_REDIR 6    // N<, N>, N>>, N>&, N<&, >|, &>, &>>, N<<, N<<-, N<<< (the operand is the next word)
+#define TOK_NEWLINE 7
+#define TOK_DSEMI 8    // ;; ending a case item
+#define TOK_LPAREN 9   // (
+#define TOK_RPAREN 10  // )
+#define TOK_ARITH 11   // ((expression))
+
+#define WORD_QUOTED 1  // some part of the word was quoted or escaped
+
+typedef struct Token
+{
+    int type;      // TOK_*
+    int flags;     // WORD_*
+    char *text;    // NUL-terminated, points into TokenList.buf
+    char *body;    // for the delimiter word of << and <<-, the lines of the here-document
+    size_t start;  // byte range of the token in the source line
+    size_t end;
+} Token;
+
+typedef struct TokenList
+{
+    const char *src;  // the line that was lexed
+    char *buf;        // one buffer holding the text of every token
+    Token *tokens;
+    int n;
+    int cap;
+} TokenList;
+
+// Redirection kinds, parsed once per command by redirect_from_operator()
+#define REDIR_IN 0     // N<file
+#define REDIR_OUT 1    // N>file, &>file
+#define REDIR_APPEND 2 // N>>file, &>>file
+#define REDIR_DUP 3    // N>&M, N<&M
+#define REDIR_CLOSE 4  // N>&-
+#define REDIR_HEREDOC 5    // N<<word, N<<-word: the body, expanded per run
+#define REDIR_HERESTRING 6 // N<<<word
+#define REDIR_TEXT 7       // N<<'word', and what the two above expand to: text fed as it is
+
+typedef struct Redirect
+{
+    int fd;         // descriptor being redirected
+    int type;       // REDIR_*
+    int dup_fd;     // source descriptor for REDIR_DUP
+    char *target;   // file name for REDIR_IN/OUT/APPEND, the text of a here-document
+    int opened_fd;  // shell-side descriptor of the opened target, -1 when not open
+    int saved_fd;   // copy of the original fd while a builtin runs redirected
+    struct Redirect *next;
+} Redirect;
+
+// Results of lex_line() and parse_program()
+#define PARSE_OK 0
+#define PARSE_ERROR -1
+#define PARSE_INCOMPLETE 1 // the input stops inside a quote or a compound command
+
+// Syntax tree built by parse_program(), walked by exec_node()
+#define NODE_SIMPLE 0   // words and redirections
+#define NODE_PIPELINE 1 // children are the stages
+#define NODE_AND 2      // children[0] && children[1]
+#define NODE_OR 3       // children[0] || children[1]
+#define NODE_LIST 4     // children run one after another
+#define NODE_FOR 5      // for name in words; do children[0]; done
+#define NODE_GROUP 6    // { children[0]; }
+#define NODE_IF 7       // condition/body pairs, then an optional else body
+#define NODE_WHILE 8    // while children[0]; do children[1]; done
+#define NODE_UNTIL 9    // until children[0]; do children[1]; done
+#define NODE_CASE 10    // case words[0] in, one NODE_CASE_ITEM child per item
+#define NODE_CASE_ITEM 11 // words are the patterns, children[0] the body if it has one
+#define NODE_FUNCTION 12 // name() children[0]
+#define NODE_ARITH 13   // (( words[0] ))
+#define NODE_ARITH_FOR 14 // for (( words[0]; words[1]; words[2] )); do children[0]; done
+#define NODE_COND 15    // [[ words ]]
+#define NODE_SUBSHELL 16 // ( children[0] ), in a forked copy of the shell
+
+typedef struct Node
+{
+    int type;          // NODE_*
+    int background;    // item of a list ended by `&`
+    int negate;        // pipeline prefixed with `!`
+    char **words;      // raw words as written, expanded every time the node runs
+    char *name;        // loop variable of a for
+    Redirect *redirs;  // redirections as written, targets unexpanded
+    struct Node **children;
+    int n_children;
+    char *text;        // source text of a pipeline or and-or list, for job listings
+    struct Code *code; // compound commands: instructions compiled on first run, see bytecode.c
+    int refs;          // owners besides the parent, e.g. the function table for a body
+} Node;
+
+// Instructions of a compiled compound command. Jumps hold absolute instruction indexes.
+#define OP_RUN 0         // run node, a simple command, a pipeline or a subshell
+#define OP_BACKGROUND 1  // start node as a background job
+#define OP_JUMP 2        // continue at target
+#define OP_JUMP_ZERO 3   // continue at target when $? is 0
+#define OP_JUMP_NONZERO 4 // continue at target when $? is not 0
+#define OP_NOT 5         // $? = !$?
+#define OP_STATUS 6      // $? = target
+#define OP_LOOP 7        // enter a loop whose OP_END_LOOP is at target; node is the for, if any
+#define OP_NEXT 8        // bind the for variable to the next word, or go to target when done
+#define OP_SAVE 9        // remember $? as the status of the innermost loop
+#define OP_END_LOOP 10   // leave the innermost loop, $? is its status; target is where `continue` resumes
+#define OP_REDIRECT 11   // apply node's redirections until the OP_RESTORE at target
+#define OP_RESTORE 12
+#define OP_CASE 13       // expand node's subject word
+#define OP_MATCH 14      // continue at target when a pattern of item node matches the subject
+#define OP_END_CASE 15
+#define OP_DEFINE 16     // define the function node
+#define OP_ARITH 17      // evaluate node->words[target], $? is 0 when the result is not 0
+#define OP_COND 18       // evaluate the [[ ]] of node
+
+typedef struct Instr
+{
+    int op;     // OP_*
+    int target; // jump destination, or the status for OP_STATUS
+    Node *node; // borrowed from the tree the code was compiled from
+} Instr;
+
+typedef struct Code
+{
+    Instr *ops;
+    int n;
+    int cap;
+} Code;
+
 //Adding the reverse search structure
 typedef struct {
     int active;
@@ -122,13 +300,20 @@ extern char COPY_PATH_PSHRC[PATH_MAX];
 extern char path_memory[PATH_MAX];
 extern char session_id[32];
 extern int last_command_up;
+extern int prompt_continuation;
 extern char path_memory[];
 extern volatile int SIGNAL;
-extern struct Variable global_vars[MAX_VARS]; // Global array to store variables
+extern volatile sig_atomic_t SIGCHLD_PENDING;
 extern int num_vars;
 extern char *history[PATH_MAX];
 extern int history_count;
 extern int current_history;
+extern int last_status;
+extern int caller_status;
+extern int loop_depth;
+extern int loop_break;
+extern int loop_continue;
+extern int func_returning;
 
 
 extern reverse_search_state_t search_state; //adding the reverse search extern
@@ -145,13 +330,186 @@ int PSH_LOOP(void);
 // int PSH_READ(void);      //now split up to be more modular
 
 // execute.c functions
-char **PSH_TOKENIZER(char *);
-int PSH_EXEC_EXTERNAL(char **);
+int PSH_EXEC_EXTERNAL(char **, Redirect *, char **);
 void handle_input(char **, size_t *, const char *);
 void save_history(const char *, const char *);
-void process_commands(char *, int *);
-void execute_command(char **, int *);
+int process_commands(const char *, int *);
+void execute_command(char **, Redirect *, char **, int *);
+void exec_node(Node *, int *);
+void exec_simple(Node *, int *);
+int assign_array(const char *, const char *, int);
+void exec_background(Node *);
 int kbhit();
+void run_pipeline(Node **, int, const char *, int);
+void set_exit_status(int);
+int find_builtin(const char *);
+int run_builtin(int, char **, Redirect *);
+pid_t launch_command(char **, const SpawnOptions *);
+pid_t launch_subshell(Node *, const SpawnOptions *);
+int is_assignment(const char *);
+
+// spawn.c functions
+int spawn_backend(void);
+pid_t psh_spawn(const char *, char **, const SpawnOptions *);
+void spawn_apply_fd_actions(const FdAction *, int);
+void spawn_child_setup(const SpawnOptions *);
+
+// jobs.c functions
+void jobs_init(int);
+void jobs_subshell(void);
+int jobs_in_subshell(void);
+int jobs_enabled(void);
+Job *job_new(const char *);
+pid_t job_spawn_pgid(const Job *);
+void job_add_process(Job *, pid_t);
+int job_state(const Job *);
+int job_status(const Job *);
+void jobs_reap(void);
+pid_t jobs_wait_untracked(int *);
+void job_wait(Job *, int);
+int job_foreground(Job *, int);
+void job_background(Job *, int);
+int job_wait_and_remove(Job *);
+Job *job_find(const char *);
+Job *jobs_first(void);
+void jobs_print(int, int);
+void jobs_notify(void);
+
+// parallel.c functions
+#define PARALLEL_MAX_JOBS 1024 // -j above this is refused rather than allocated
+int parallel_run(char **, char **, int, int, double, int);
+
+// lexer.c functions
+int lex_line(const char *, TokenList *);
+void lex_free(TokenList *);
+void word_unquote(char *);
+
+// parser.c functions
+int parse_program(const char *, Node **);
+int line_nesting(const char *, int *);
+void free_node(Node *);
+int is_reserved_word(const char *);
+
+// expand.c functions
+extern int expand_error;
+extern int expand_substituted;
+char **expand_words(char **);
+char *expand_word_single(const char *);
+char *expand_pattern(const char *);
+char *expand_heredoc(const char *);
+char *expand_regex(const char *);
+
+// capture.c functions
+char *command_output(const char *);
+char *process_substitution(const char *, int);
+int procsub_mark(void);
+void procsub_release(int);
+
+// bytecode.c functions
+Code *compile_node(Node *);
+void free_code(Code *);
+void run_code(Code *, int *);
+
+// redirect.c functions
+Redirect *redirect_from_operator(const char *, const Token *);
+Redirect *redirect_expand(const Redirect *);
+void free_redirections(Redirect *);
+int count_redirections(const Redirect *);
+int redirect_prepare(Redirect *, FdAction *);
+void redirect_close(Redirect *);
+int redirect_apply(Redirect *);
+void redirect_restore(Redirect *);
+
+// vars.c functions
+#define VAR_INTEGER 1  // declare -i: assignments are evaluated, the value is kept as an int64_t
+#define VAR_EXPORTED 2 // passed to children through var_environ()
+#define VAR_READONLY 4 // assignments and unset fail
+#define VAR_ARRAY 8    // indexed array, see array.c
+#define VAR_ASSOC 16   // declare -A: associative array
+
+typedef struct ShellVar ShellVar;
+
+void var_init(char **);
+const char *var_get(const char *);
+int var_set(const char *, const char *);
+int var_get_number(const char *, int64_t *);
+int var_set_number(const char *, int64_t);
+int var_append(const char *, const char *);
+void var_export(const char *);
+int var_unset(const char *);
+int var_save(const char *, ShellVar **);
+void var_restore(const char *, ShellVar *);
+int var_declare(const char *, int, int);
+int var_attrs(const char *);
+char **var_environ(void);
+char **var_environ_with(char **);
+uint32_t var_hash(const char *);
+int var_array_clear(const char *);
+int var_array_push(const char *, const char *);
+char **var_array_list(const char *, int);
+size_t var_array_count(const char *);
+int var_print(const char *);
+void var_print_all(int);
+
+// array.c functions
+#define ARRAY_MAX_INDEX (1 << 24) // indexed arrays are dense vectors, larger indices are refused
+
+typedef struct VarArray VarArray;
+VarArray *array_new(int);
+void array_free(VarArray *);
+size_t array_count(const VarArray *);
+int64_t array_next_index(const VarArray *);
+const char *array_get(const VarArray *, int64_t);
+int array_set(VarArray *, int64_t, const char *);
+void array_unset(VarArray *, int64_t);
+const char *array_get_key(const VarArray *, const char *);
+void array_set_key(VarArray *, const char *, const char *);
+void array_unset_key(VarArray *, const char *);
+char **array_list(const VarArray *, int);
+
+// arith.c functions
+int arith_eval(const char *, int64_t *);
+int arith_expand(const char *, int64_t *);
+
+// brace.c functions
+typedef struct BraceGen BraceGen;
+typedef struct WordStream WordStream;
+BraceGen *brace_new(const char *);
+char *brace_next(BraceGen *);
+void brace_free(BraceGen *);
+char **brace_expand(char **);
+WordStream *word_stream_new(char **);
+const char *word_stream_next(WordStream *);
+void word_stream_free(WordStream *);
+
+// test.c functions
+int cond_eval(char **);
+
+// glob.c functions
+extern int glob_star;
+extern int glob_follow;
+extern int glob_cache;
+int glob_is_pattern(const char *);
+char **glob_expand(const char *);
+
+// functions.c functions
+void func_define(const char *, Node *);
+int func_exists(const char *);
+int func_call(char **, Redirect *, int *);
+int func_local(const char *);
+int func_depth(void);
+const char *positional(int);
+int positional_count(void);
+char **positional_all(void);
+void positional_init(char **, int);
+int positional_shift(int);
+
+// cmdhash.c functions
+const char *cmdhash_lookup(const char *, int);
+void cmdhash_insert(const char *, const char *);
+void cmdhash_forget(const char *);
+void cmdhash_clear(void);
+void cmdhash_print(void);
 
 //reverse search functions
 char* reverse_search();
@@ -186,13 +544,7 @@ void read_lines_reverse_wo_no(const char *, int, int);
 char *expand_history(const char *, FILE *);
 int compare_strings(const void *, const void *);
 void sort_strings(char **, int);
-char **split_commands(char *);
 int size_token_arr(char **);
-bool contains_wildcard(char **);
-int handle_wildcard(char *);
-char *find_closing_done(char *);
-void process_nested_loops(char *, int *);
-char *process_for_loop(char *, int *);
 void get_last_line(char **);
 unsigned int hash(const char *, int);
 HashMap *create_map(int);
@@ -218,9 +570,8 @@ void disableRawMode();
 char *trim_whitespace(char *);
 void parse_ps1(const char *, const char *);
 char *remove_quotes(char *);
-char *expand_variables(char *);
-void handle_env_variable(char *[]);
 void get_alias_path(char *, size_t, const char *);
+HashMap *alias_map(void);
 
 // signal
 void sigint_handler();
@@ -0,0 +1,475 @@
+// redirect.c
+#include "psh.h"
+#include <stdio_ext.h>
+#include <sys/mman.h>
+
+static int redirects_stdin(const Redirect *redir)
+{
+    for (; redir != NULL; redir = redir->next)
+    {
+        if (redir->fd == STDIN_FILENO)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int all_digits(const char *str)
+{
+    if (*str == '\0')
+    {
+        return 0;
+    }
+    for (; *str; str++)
+    {
+        if (!isdigit((unsigned char)*str))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static Redirect *new_redirect(int fd, int type, const char *target, int dup_fd)
+{
+    Redirect *redir = malloc(sizeof(Redirect));
+    if (!redir)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    redir->fd = fd;
+    redir->type = type;
+    redir->dup_fd = dup_fd;
+    redir->target = target ? strdup(target) : NULL;
+    redir->opened_fd = -1;
+    redir->saved_fd = -1;
+    redir->next = NULL;
+    return redir;
+}
+
+// Decodes one redirection operator as split off by the lexer (TOK_REDIR).
+// Returns the length of the operator (including any fd prefix) or 0 if `token` is not one.
+static size_t match_operator(const char *token, int *fd, int *type, int *both)
+{
+    const char *p = token;
+    *both = 0;
+    *fd = -1;
+
+    if (p[0] == '&' && p[1] == '>')
+    {
+        *both = 1;
+        *fd = STDOUT_FILENO;
+        p += 2;
+        if (*p == '>')
+        {
+            *type = REDIR_APPEND;
+            p++;
+        }
+        else
+        {
+            *type = REDIR_OUT;
+        }
+        return p - token;
+    }
+
+    if (isdigit((unsigned char)*p))
+    {
+        int n = 0;
+        while (isdigit((unsigned char)*p))
+        {
+            n = n * 10 + (*p - '0');
+            p++;
+        }
+        if (*p != '<' && *p != '>')
+        {
+            return 0;
+        }
+        *fd = n;
+    }
+
+    if (p[0] == '<')
+    {
+        if (*fd == -1)
+        {
+            *fd = STDIN_FILENO;
+        }
+        if (p[1] == '&')
+        {
+            *type = REDIR_DUP;
+            return p + 2 - token;
+        }
+        if (p[1] == '<')
+        {
+            *type = p[2] == '<' ? REDIR_HERESTRING : REDIR_HEREDOC;
+            return p + (p[2] == '<' || p[2] == '-' ? 3 : 2) - token;
+        }
+        *type = REDIR_IN;
+        return p + 1 - token;
+    }
+    if (p[0] == '>')
+    {
+        if (*fd == -1)
+        {
+            *fd = STDOUT_FILENO;
+        }
+        if (p[1] == '>')
+        {
+            *type = REDIR_APPEND;
+            return p + 2 - token;
+        }
+        if (p[1] == '&')
+        {
+            *type = REDIR_DUP;
+            return p + 2 - token;
+        }
+        *type = REDIR_OUT;
+        return p + (p[1] == '|' ? 2 : 1) - token;
+    }
+    return 0;
+}
+
+// Builds the redirection(s) for one operator token and its operand word as written, e.g.
+// (">&", "2") or ("&>", "log"). `&>` yields two entries. The target is expanded per run.
+// A here-document takes the body the lexer stored on its delimiter word instead.
+// Returns NULL when `op` is not a redirection operator.
+Redirect *redirect_from_operator(const char *op, const Token *operand)
+{
+    int fd, type, both;
+    Redirect *redir;
+
+    if (match_operator(op, &fd, &type, &both) == 0)
+    {
+        return NULL;
+    }
+    if (type == REDIR_DUP)
+    {
+        if (strcmp(operand->text, "-") == 0)
+        {
+            redir = new_redirect(fd, REDIR_CLOSE, NULL, -1);
+        }
+        else if (all_digits(operand->text))
+        {
+            redir = new_redirect(fd, REDIR_DUP, NULL, atoi(operand->text));
+        }
+        else
+        {
+            // `>&file` is the csh spelling of `&>file`
+            both = 1;
+            redir = new_redirect(STDOUT_FILENO, REDIR_OUT, operand->text, -1);
+        }
+    }
+    else if (type == REDIR_HEREDOC)
+    {
+        // a quoted delimiter, as in <<'EOF', keeps the body from being expanded
+        redir = new_redirect(fd, (operand->flags & WORD_QUOTED) ? REDIR_TEXT : REDIR_HEREDOC,
+                             operand->body ? operand->body : "", -1);
+    }
+    else
+    {
+        redir = new_redirect(fd, type, operand->text, -1);
+    }
+
+    if (both)
+    {
+        redir->next = new_redirect(STDERR_FILENO, REDIR_DUP, NULL, STDOUT_FILENO);
+    }
+    return redir;
+}
+
+// Instantiates a parsed redirection list for one run, expanding every target word.
+// Here-documents and here-strings come out as REDIR_TEXT holding what the command reads.
+Redirect *redirect_expand(const Redirect *templ)
+{
+    Redirect *head = NULL;
+    Redirect **tail = &head;
+    for (; templ != NULL; templ = templ->next)
+    {
+        *tail = new_redirect(templ->fd, templ->type, NULL, templ->dup_fd);
+        if (templ->type == REDIR_HEREDOC)
+        {
+            (*tail)->type = REDIR_TEXT;
+            (*tail)->target = expand_heredoc(templ->target);
+        }
+        else if (templ->type == REDIR_HERESTRING)
+        {
+            // the word plus a newline, as if it were a one-line here-document
+            char *word = expand_word_single(templ->target);
+            size_t len = strlen(word);
+            char *text = realloc(word, len + 2);
+            if (!text)
+            {
+                fprintf(stderr, "psh: allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(text + len, "\n", 2);
+            (*tail)->type = REDIR_TEXT;
+            (*tail)->target = text;
+        }
+        else if (templ->type == REDIR_TEXT)
+        {
+            (*tail)->target = strdup(templ->target);
+        }
+        else if (templ->target != NULL)
+        {
+            (*tail)->target = expand_word_single(templ->target);
+        }
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+void free_redirections(Redirect *redir)
+{
+    while (redir != NULL)
+    {
+        Redirect *next = redir->next;
+        free(redir->target);
+        free(redir);
+        redir = next;
+    }
+}
+
+int count_redirections(const Redirect *redir)
+{
+    int n = 0;
+    for (; redir != NULL; redir = redir->next)
+    {
+        n++;
+    }
+    return n;
+}
+
+static int write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// A readable descriptor holding the text of a here-document, without a temporary file.
+// Text that fits in a pipe buffer goes into a pipe, so the write cannot block before the
+// reader exists; anything bigger into an anonymous memfd rewound to its start.
+static int text_fd(const char *text)
+{
+    size_t len = strlen(text);
+    int fds[2];
+    if (len <= PIPE_BUF)
+    {
+        if (pipe2(fds, O_CLOEXEC) == -1)
+        {
+            return -1;
+        }
+        if (write_all(fds[1], text, len) == -1)
+        {
+            close(fds[0]);
+            fds[0] = -1;
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    int fd = memfd_create("psh-heredoc", MFD_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    if (write_all(fd, text, len) == -1 || lseek(fd, 0, SEEK_SET) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int open_flags(int type)
+{
+    switch (type)
+    {
+    case REDIR_IN:
+        return O_RDONLY;
+    case REDIR_APPEND:
+        return O_WRONLY | O_CREAT | O_APPEND;
+    default:
+        return O_WRONLY | O_CREAT | O_TRUNC;
+    }
+}
+
+static int open_target(Redirect *redir)
+{
+    int text = redir->type == REDIR_TEXT;
+    int fd = text ? text_fd(redir->target) : open(redir->target, open_flags(redir->type) | O_CLOEXEC, 0666);
+    if (fd == -1)
+    {
+        fprintf(stderr, "psh: %s: %s\n", text ? "here-document" : redir->target, strerror(errno));
+        return -1;
+    }
+    if (fd < 10)
+    {
+        // keep opened files clear of the low descriptors a redirection may target
+        int high = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        if (high != -1)
+        {
+            close(fd);
+            fd = high;
+        }
+    }
+    redir->opened_fd = fd;
+    return fd;
+}
+
+// Opens file targets in the parent and describes the redirections as dup2 actions for a child.
+// `actions` must hold count_redirections() entries. Returns the number of actions, or -1 on error.
+int redirect_prepare(Redirect *redir, FdAction *actions)
+{
+    int n = 0;
+    for (Redirect *r = redir; r != NULL; r = r->next)
+    {
+        switch (r->type)
+        {
+        case REDIR_DUP:
+            actions[n++] = (FdAction){r->fd, r->dup_fd};
+            break;
+        case REDIR_CLOSE:
+            actions[n++] = (FdAction){r->fd, -1};
+            break;
+        default:
+            if (open_target(r) == -1)
+            {
+                redirect_close(redir);
+                return -1;
+            }
+            actions[n++] = (FdAction){r->fd, r->opened_fd};
+            break;
+        }
+    }
+    return n;
+}
+
+// Drops the parent's copies of files opened by redirect_prepare once the child has them
+void redirect_close(Redirect *redir)
+{
+    for (; redir != NULL; redir = redir->next)
+    {
+        if (redir->opened_fd != -1)
+        {
+            close(redir->opened_fd);
+            redir->opened_fd = -1;
+        }
+    }
+}
+
+// Applies redirections to the shell itself so a builtin can run without forking.
+// Each target fd is saved first and put back by redirect_restore. Returns -1 on error (already undone).
+int redirect_apply(Redirect *redir)
+{
+    fflush(stdout);
+    fflush(stderr);
+    if (redirects_stdin(redir))
+    {
+        __fpurge(stdin);
+    }
+    for (Redirect *r = redir; r != NULL; r = r->next)
+    {
+        int saved_already = 0;
+        for (Redirect *prev = redir; prev != r; prev = prev->next)
+        {
+            if (prev->fd == r->fd)
+            {
+                saved_already = 1;
+                break;
+            }
+        }
+        if (!saved_already)
+        {
+            // -1 means the fd was closed before, restore closes it again
+            r->saved_fd = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+            if (r->saved_fd == -1 && errno != EBADF)
+            {
+                perror("psh: redirect");
+                redirect_restore(redir);
+                return -1;
+            }
+            if (r->saved_fd == -1)
+            {
+                r->saved_fd = -2;
+            }
+        }
+
+        int source;
+        if (r->type == REDIR_DUP)
+        {
+            source = r->dup_fd;
+        }
+        else if (r->type == REDIR_CLOSE)
+        {
+            close(r->fd);
+            continue;
+        }
+        else
+        {
+            source = open_target(r);
+            if (source == -1)
+            {
+                redirect_restore(redir);
+                return -1;
+            }
+        }
+
+        if (dup2(source, r->fd) == -1)
+        {
+            fprintf(stderr, "psh: %d: %s\n", source, strerror(errno));
+            redirect_restore(redir);
+            return -1;
+        }
+        if (r->opened_fd != -1)
+        {
+            close(r->opened_fd);
+            r->opened_fd = -1;
+        }
+    }
+    return 0;
+}
+
+void redirect_restore(Redirect *redir)
+{
+    fflush(stdout);
+    fflush(stderr);
+    if (redirects_stdin(redir))
+    {
+        // drop whatever stdio read ahead from the redirected input
+        __fpurge(stdin);
+        clearerr(stdin);
+    }
+    for (Redirect *r = redir; r != NULL; r = r->next)
+    {
+        if (r->opened_fd != -1)
+        {
+            close(r->opened_fd);
+            r->opened_fd = -1;
+        }
+        if (r->saved_fd == -2)
+        {
+            close(r->fd);
+        }
+        else if (r->saved_fd >= 0)
+        {
+            dup2(r->saved_fd, r->fd);
+            close(r->saved_fd);
+        }
+        r->saved_fd = -1;
+    }
+}
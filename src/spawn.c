@@ -0,0 +1,196 @@
+// spawn.c
+#include "psh.h"
+#include <spawn.h>
+
+
+// Signals whose disposition the shell may change; children always start with these at default
+static const int child_default_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE, SIGCHLD};
+
+int spawn_backend(void)
+{
+    // runtime override so both launch paths can be benchmarked from one binary
+    const char *mode = var_get("PSH_SPAWN");
+    if (mode != NULL)
+    {
+        if (strcmp(mode, "fork") == 0)
+        {
+            return SPAWN_BACKEND_FORK;
+        }
+        if (strcmp(mode, "posix_spawn") == 0 || strcmp(mode, "spawn") == 0)
+        {
+            return SPAWN_BACKEND_POSIX;
+        }
+    }
+    return PSH_SPAWN_BACKEND;
+}
+
+static void child_default_sigset(sigset_t *set)
+{
+    sigemptyset(set);
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++)
+    {
+        sigaddset(set, child_default_signals[i]);
+    }
+}
+
+// Replays fd plumbing in a forked child, same order posix_spawn applies its file actions
+void spawn_apply_fd_actions(const FdAction *actions, int n_actions)
+{
+    for (int i = 0; i < n_actions; i++)
+    {
+        if (actions[i].source < 0)
+        {
+            close(actions[i].fd);
+        }
+        else if (actions[i].source == actions[i].fd)
+        {
+            // dup2 onto itself is a no-op, clear close-on-exec instead
+            fcntl(actions[i].fd, F_SETFD, 0);
+        }
+        else if (dup2(actions[i].source, actions[i].fd) == -1)
+        {
+            perror("psh: dup2");
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// posix_spawn() runs the child on the parent's address space (clone(CLONE_VM|CLONE_VFORK) in glibc),
+// so no page tables are copied no matter how large the shell's heap has grown.
+// Returns 0 and sets *pid on success, otherwise the errno value reported by posix_spawn.
+static int spawn_posix(const char *path, char **argv, const SpawnOptions *opts, pid_t *pid)
+{
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t file_actions;
+    sigset_t defaults;
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    int err;
+
+    err = posix_spawnattr_init(&attr);
+    if (err != 0)
+    {
+        return err;
+    }
+    posix_spawn_file_actions_init(&file_actions);
+    for (int i = 0; i < opts->n_actions; i++)
+    {
+        if (opts->actions[i].source < 0)
+        {
+            posix_spawn_file_actions_addclose(&file_actions, opts->actions[i].fd);
+        }
+        else
+        {
+            // glibc clears close-on-exec when source == fd, matching spawn_apply_fd_actions
+            posix_spawn_file_actions_adddup2(&file_actions, opts->actions[i].source, opts->actions[i].fd);
+        }
+    }
+
+    child_default_sigset(&defaults);
+    posix_spawnattr_setsigmask(&attr, opts->mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    if (opts->pgid >= 0)
+    {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, opts->pgid);
+#ifdef POSIX_SPAWN_TCSETPGROUP
+        // hand over the terminal before exec, so the child can never read it from the background
+        if (opts->foreground && opts->pgid == 0)
+        {
+            flags |= POSIX_SPAWN_TCSETPGROUP;
+            posix_spawnattr_tcsetpgrp_np(&attr, STDIN_FILENO);
+        }
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    err = posix_spawn(pid, path, &file_actions, &attr, argv, opts->envp != NULL ? opts->envp : var_environ());
+
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&attr);
+    return err;
+}
+
+// Puts a freshly forked child into the state posix_spawn's attributes describe
+void spawn_child_setup(const SpawnOptions *opts)
+{
+    if (opts->pgid >= 0)
+    {
+        setpgid(0, opts->pgid);
+        if (opts->foreground)
+        {
+            tcsetpgrp(STDIN_FILENO, getpgrp());
+        }
+    }
+
+    // Restoring the default signal behavior in the child process
+    for (size_t i = 0; i < sizeof(child_default_signals) / sizeof(child_default_signals[0]); i++)
+    {
+        signal(child_default_signals[i], SIG_DFL);
+    }
+    sigprocmask(SIG_SETMASK, opts->mask, NULL);
+    spawn_apply_fd_actions(opts->actions, opts->n_actions);
+}
+
+static pid_t spawn_fork(const char *path, char **argv, const SpawnOptions *opts)
+{
+    // built before the fork, the child only execs
+    char **envp = opts->envp != NULL ? opts->envp : var_environ();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        spawn_child_setup(opts);
+
+        execve(path, argv, envp);
+        if (errno == ENOEXEC)
+        {
+            // no shebang line, hand the file to /bin/sh the way execvp() would
+            int argc = size_token_arr(argv);
+            char **sh_argv = malloc((argc + 2) * sizeof(char *));
+            if (sh_argv != NULL)
+            {
+                sh_argv[0] = "/bin/sh";
+                sh_argv[1] = (char *)path;
+                for (int i = 1; i <= argc; i++)
+                {
+                    sh_argv[i + 1] = argv[i];
+                }
+                execve("/bin/sh", sh_argv, envp);
+            }
+        }
+        perror("psh error");
+        _exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+// Starts `path` (already resolved, see cmdhash_lookup) with argv and the given fd plumbing.
+// Returns the child's pid, or -1 with errno set when the launch itself failed.
+pid_t psh_spawn(const char *path, char **argv, const SpawnOptions *opts)
+{
+    pid_t pid = -1;
+    if (spawn_backend() == SPAWN_BACKEND_POSIX)
+    {
+        int err = spawn_posix(path, argv, opts, &pid);
+        if (err != 0)
+        {
+            // ENOEXEC: shebang-less scripts need the /bin/sh retry only the fork path does.
+            // ENOSYS/EAGAIN: the host refused the vfork-style clone, a plain fork may still succeed.
+            if (err != ENOEXEC && err != ENOSYS && err != EAGAIN)
+            {
+                errno = err;
+                return -1;
+            }
+            pid = -1;
+        }
+    }
+    if (pid == -1)
+    {
+        pid = spawn_fork(path, argv, opts);
+    }
+    if (pid > 0 && opts->pgid >= 0)
+    {
+        // also set from the parent so the group exists before we signal or wait on it
+        setpgid(pid, opts->pgid == 0 ? pid : opts->pgid);
+    }
+    return pid;
+}
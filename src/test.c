@@ -0,0 +1,514 @@
+// test.c
+#include "psh.h"
+#include <regex.h>
+
+// test, [ and [[ ]]. One recursive-descent evaluator serves all three: test and [ get their
+// arguments already expanded, [[ ]] gets the words as written and expands each operand only
+// when it is reached, so `[[ -n $x && $(cmd) ]]` never runs cmd for an empty x.
+
+#define OPERAND_STRING 0
+#define OPERAND_PATTERN 1 // right of == and != in [[ ]]
+#define OPERAND_REGEX 2   // right of =~
+
+// A stat() result kept for the rest of the expression, so `[ -f x -a -r x ]` stats x once
+typedef struct StatCache
+{
+    char *path; // NULL while empty
+    int ok;
+    struct stat st;
+} StatCache;
+
+typedef struct TestState
+{
+    char **words;
+    int n;
+    int pos;
+    int cond;  // [[ ]]: && || ( ) < > =~ and patterns, operands expanded on demand
+    int error; // set once a syntax or operand error was reported; the status becomes 2
+    const char *name; // for messages: test, [ or [[
+    StatCache stat;   // stat(), following symlinks
+    StatCache lstat;  // lstat(), for -h and -L
+} TestState;
+
+static int or_expr(TestState *t, int eval);
+
+static void test_error(TestState *t, const char *what, const char *detail)
+{
+    if (!t->error)
+    {
+        if (detail != NULL)
+        {
+            fprintf(stderr, "psh: %s: %s: %s\n", t->name, detail, what);
+        }
+        else
+        {
+            fprintf(stderr, "psh: %s: %s\n", t->name, what);
+        }
+    }
+    t->error = 1;
+}
+
+static const char *peek_word(TestState *t, int offset)
+{
+    return t->pos + offset < t->n ? t->words[t->pos + offset] : NULL;
+}
+
+static int word_is(TestState *t, int offset, const char *op)
+{
+    const char *word = peek_word(t, offset);
+    return word != NULL && strcmp(word, op) == 0;
+}
+
+// The word at `i`, malloc'd: for [[ ]] expanded as `how` says, for test and [ as it is
+static char *operand(TestState *t, int i, int how)
+{
+    if (!t->cond)
+    {
+        return strdup(t->words[i]);
+    }
+    switch (how)
+    {
+    case OPERAND_PATTERN:
+        return expand_pattern(t->words[i]);
+    case OPERAND_REGEX:
+        return expand_regex(t->words[i]);
+    default:
+        return expand_word_single(t->words[i]);
+    }
+}
+
+static const struct stat *file_stat(StatCache *cache, const char *path, int follow)
+{
+    if (cache->path == NULL || strcmp(cache->path, path) != 0)
+    {
+        free(cache->path);
+        cache->path = strdup(path);
+        cache->ok = (follow ? stat(path, &cache->st) : lstat(path, &cache->st)) == 0;
+    }
+    return cache->ok ? &cache->st : NULL;
+}
+
+static int is_unary(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' && strchr("abcdefghknprstuvwxzGLOS", op[1]) != NULL;
+}
+
+static int is_binary(TestState *t, const char *op)
+{
+    static const char *ops[] = {"=",   "==",  "!=",  "<",   ">",   "-eq", "-ne", "-lt",
+                                "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+    if (op == NULL)
+    {
+        return 0;
+    }
+    for (int i = 0; ops[i] != NULL; i++)
+    {
+        if (strcmp(op, ops[i]) == 0)
+        {
+            return 1;
+        }
+    }
+    return t->cond && strcmp(op, "=~") == 0;
+}
+
+static int unary_test(TestState *t, char op, const char *arg)
+{
+    const struct stat *st;
+    switch (op)
+    {
+    case 'z':
+        return *arg == '\0';
+    case 'n':
+        return *arg != '\0';
+    case 'v':
+        return var_get(arg) != NULL;
+    case 't':
+        return isatty(atoi(arg));
+    case 'r':
+        return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+    case 'w':
+        return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+    case 'x':
+        return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+    case 'h':
+    case 'L':
+        st = file_stat(&t->lstat, arg, 0);
+        return st != NULL && S_ISLNK(st->st_mode);
+    }
+
+    st = file_stat(&t->stat, arg, 1);
+    if (st == NULL)
+    {
+        return 0;
+    }
+    switch (op)
+    {
+    case 'a':
+    case 'e':
+        return 1;
+    case 'f':
+        return S_ISREG(st->st_mode);
+    case 'd':
+        return S_ISDIR(st->st_mode);
+    case 'b':
+        return S_ISBLK(st->st_mode);
+    case 'c':
+        return S_ISCHR(st->st_mode);
+    case 'p':
+        return S_ISFIFO(st->st_mode);
+    case 'S':
+        return S_ISSOCK(st->st_mode);
+    case 's':
+        return st->st_size > 0;
+    case 'g':
+        return (st->st_mode & S_ISGID) != 0;
+    case 'u':
+        return (st->st_mode & S_ISUID) != 0;
+    case 'k':
+        return (st->st_mode & S_ISVTX) != 0;
+    case 'O':
+        return st->st_uid == geteuid();
+    case 'G':
+        return st->st_gid == getegid();
+    default:
+        return 0;
+    }
+}
+
+// An integer operand of -eq and friends: for test a plain decimal number, for [[ ]] an
+// arithmetic expression
+static int integer(TestState *t, int i, int64_t *out)
+{
+    if (t->cond)
+    {
+        if (arith_expand(t->words[i], out) == -1)
+        {
+            t->error = 1;
+            return -1;
+        }
+        return 0;
+    }
+    const char *s = t->words[i];
+    char *end;
+    errno = 0;
+    long long value = strtoll(s, &end, 10);
+    end += strspn(end, " \t");
+    if (end == s || *end != '\0' || errno == ERANGE)
+    {
+        test_error(t, "integer expression expected", s);
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+static int compare_times(const struct stat *a, const struct stat *b)
+{
+    if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+    {
+        return a->st_mtim.tv_sec < b->st_mtim.tv_sec ? -1 : 1;
+    }
+    return (a->st_mtim.tv_nsec > b->st_mtim.tv_nsec) - (a->st_mtim.tv_nsec < b->st_mtim.tv_nsec);
+}
+
+// Compiled =~ patterns, keyed by their text. A regex in a loop compiles on the first pass
+// only; the least recently used one makes room when the cache is full.
+#define REGEX_CACHE_SIZE 16
+
+typedef struct RegexEntry
+{
+    char *pattern; // NULL for a free entry
+    regex_t re;
+    unsigned long used;
+} RegexEntry;
+
+static RegexEntry regex_cache[REGEX_CACHE_SIZE];
+static unsigned long regex_clock = 0;
+
+static regex_t *regex_compile(TestState *t, const char *pattern)
+{
+    RegexEntry *victim = &regex_cache[0];
+    for (int i = 0; i < REGEX_CACHE_SIZE; i++)
+    {
+        RegexEntry *entry = &regex_cache[i];
+        if (entry->pattern != NULL && strcmp(entry->pattern, pattern) == 0)
+        {
+            entry->used = ++regex_clock;
+            return &entry->re;
+        }
+        if (entry->used < victim->used)
+        {
+            victim = entry; // free entries have never been used and go first
+        }
+    }
+
+    if (victim->pattern != NULL)
+    {
+        regfree(&victim->re);
+        free(victim->pattern);
+        victim->pattern = NULL;
+        victim->used = 0;
+    }
+    int err = regcomp(&victim->re, pattern, REG_EXTENDED);
+    if (err != 0)
+    {
+        char message[256];
+        regerror(err, &victim->re, message, sizeof(message));
+        regfree(&victim->re);
+        test_error(t, message, pattern);
+        return NULL;
+    }
+    victim->pattern = strdup(pattern);
+    victim->used = ++regex_clock;
+    return &victim->re;
+}
+
+// [[ string =~ regex ]]: BASH_REMATCH gets the whole match and then every group, and is
+// left empty when nothing matched
+static int regex_test(TestState *t, const char *string, const char *pattern)
+{
+    regex_t *re = regex_compile(t, pattern);
+    if (re == NULL)
+    {
+        return 0;
+    }
+    size_t n_groups = re->re_nsub + 1;
+    regmatch_t *groups = malloc(n_groups * sizeof(regmatch_t));
+    if (!groups)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    int matched = regexec(re, string, n_groups, groups, 0) == 0;
+    var_array_clear("BASH_REMATCH");
+    for (size_t i = 0; matched && i < n_groups; i++)
+    {
+        regoff_t start = groups[i].rm_so;
+        char *text = start == -1 ? strdup("") : strndup(string + start, groups[i].rm_eo - start);
+        var_array_push("BASH_REMATCH", text);
+        free(text);
+    }
+    free(groups);
+    return matched;
+}
+
+static int binary_test(TestState *t, int left, const char *op, int right)
+{
+    if (op[0] == '-' && (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0))
+    {
+        char *a_path = operand(t, left, OPERAND_STRING);
+        char *b_path = operand(t, right, OPERAND_STRING);
+        struct stat a_st, b_st;
+        // the second file has its own stat, the cache keeps serving the first
+        const struct stat *a = file_stat(&t->stat, a_path, 1);
+        int b_ok = stat(b_path, &b_st) == 0;
+        int result;
+        if (a != NULL)
+        {
+            a_st = *a;
+        }
+        if (op[1] == 'e')
+        {
+            result = a != NULL && b_ok && a_st.st_dev == b_st.st_dev && a_st.st_ino == b_st.st_ino;
+        }
+        else if (op[1] == 'n')
+        {
+            result = a != NULL && (!b_ok || compare_times(&a_st, &b_st) > 0);
+        }
+        else
+        {
+            result = b_ok && (a == NULL || compare_times(&a_st, &b_st) < 0);
+        }
+        free(a_path);
+        free(b_path);
+        return result;
+    }
+    if (op[0] == '-')
+    {
+        int64_t a, b;
+        if (integer(t, left, &a) == -1 || integer(t, right, &b) == -1)
+        {
+            return 0;
+        }
+        if (strcmp(op, "-eq") == 0)
+        {
+            return a == b;
+        }
+        if (strcmp(op, "-ne") == 0)
+        {
+            return a != b;
+        }
+        if (strcmp(op, "-lt") == 0)
+        {
+            return a < b;
+        }
+        if (strcmp(op, "-le") == 0)
+        {
+            return a <= b;
+        }
+        if (strcmp(op, "-gt") == 0)
+        {
+            return a > b;
+        }
+        return a >= b; // -ge
+    }
+
+    char *a = operand(t, left, OPERAND_STRING);
+    int how = strcmp(op, "=~") == 0 ? OPERAND_REGEX : (op[0] == '=' || op[0] == '!') ? OPERAND_PATTERN : OPERAND_STRING;
+    char *b = operand(t, right, how);
+    int result;
+    if (how == OPERAND_REGEX)
+    {
+        result = regex_test(t, a, b);
+    }
+    else if (op[0] == '<' || op[0] == '>')
+    {
+        int cmp = strcoll(a, b);
+        result = op[0] == '<' ? cmp < 0 : cmp > 0;
+    }
+    else
+    {
+        // [[ ]] matches the right side as a pattern, test compares strings
+        int equal = t->cond ? fnmatch(b, a, 0) == 0 : strcmp(a, b) == 0;
+        result = op[0] == '!' ? !equal : equal;
+    }
+    free(a);
+    free(b);
+    return result;
+}
+
+// ( expr ), a unary or binary test, or a lone string that is true when not empty.
+// With `eval` clear the words are only stepped over, as on the right of a decided && or ||.
+static int primary(TestState *t, int eval)
+{
+    const char *word = peek_word(t, 0);
+    if (word == NULL)
+    {
+        test_error(t, "argument expected", NULL);
+        return 0;
+    }
+    if (is_binary(t, peek_word(t, 1)) && peek_word(t, 2) != NULL)
+    {
+        int left = t->pos;
+        const char *op = peek_word(t, 1);
+        t->pos += 3;
+        return eval && binary_test(t, left, op, left + 2);
+    }
+    if (strcmp(word, "(") == 0 && peek_word(t, 1) != NULL)
+    {
+        t->pos++;
+        int result = or_expr(t, eval);
+        if (!word_is(t, 0, ")"))
+        {
+            test_error(t, "`)' expected", NULL);
+            return 0;
+        }
+        t->pos++;
+        return result;
+    }
+    if (is_unary(word) && peek_word(t, 1) != NULL)
+    {
+        t->pos += 2;
+        if (!eval)
+        {
+            return 0;
+        }
+        char *arg = operand(t, t->pos - 1, OPERAND_STRING);
+        int result = unary_test(t, word[1], arg);
+        free(arg);
+        return result;
+    }
+    t->pos++;
+    if (!eval)
+    {
+        return 0;
+    }
+    char *arg = operand(t, t->pos - 1, OPERAND_STRING);
+    int result = *arg != '\0';
+    free(arg);
+    return result;
+}
+
+static int not_expr(TestState *t, int eval)
+{
+    // `! = x` compares the string "!" instead of negating
+    if (word_is(t, 0, "!") && !(is_binary(t, peek_word(t, 1)) && peek_word(t, 2) != NULL))
+    {
+        t->pos++;
+        return !not_expr(t, eval);
+    }
+    return primary(t, eval);
+}
+
+static int and_expr(TestState *t, int eval)
+{
+    int result = not_expr(t, eval);
+    while (word_is(t, 0, t->cond ? "&&" : "-a"))
+    {
+        t->pos++;
+        result = not_expr(t, eval && result) && result;
+    }
+    return result;
+}
+
+static int or_expr(TestState *t, int eval)
+{
+    int result = and_expr(t, eval);
+    while (word_is(t, 0, t->cond ? "||" : "-o"))
+    {
+        t->pos++;
+        result = and_expr(t, eval && !result) || result;
+    }
+    return result;
+}
+
+// Evaluates `n` words and returns the exit status: 0 true, 1 false, 2 error
+static int evaluate(char **words, int n, int cond, const char *name)
+{
+    TestState t = {words, n, 0, cond, 0, name, {NULL, 0, {0}}, {NULL, 0, {0}}};
+    if (n == 0)
+    {
+        return 1;
+    }
+    int result = or_expr(&t, 1);
+    if (!t.error && t.pos < n)
+    {
+        test_error(&t, "too many arguments", NULL);
+    }
+    free(t.stat.path);
+    free(t.lstat.path);
+    return t.error ? 2 : !result;
+}
+
+// [[ words ]], with the words as the parser kept them
+int cond_eval(char **words)
+{
+    int n = 0;
+    while (words[n] != NULL)
+    {
+        n++;
+    }
+    return evaluate(words, n, 1, "[[");
+}
+
+// test expr, [ expr ]
+int PSH_TEST(char **token_arr)
+{
+    int n = 0;
+    while (token_arr[n + 1] != NULL)
+    {
+        n++;
+    }
+    if (strcmp(token_arr[0], "[") == 0)
+    {
+        if (n == 0 || strcmp(token_arr[n], "]") != 0)
+        {
+            fprintf(stderr, "psh: [: missing `]'\n");
+            last_status = 2;
+            return 1;
+        }
+        n--;
+    }
+    last_status = evaluate(token_arr + 1, n, 0, token_arr[0]);
+    return 1;
+}
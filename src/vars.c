@@ -0,0 +1,943 @@
+// vars.c
+#include "psh.h"
+
+// Every shell variable, exported or not, lives in one open-addressing table; the process
+// environment is only read once at startup. Children get the exported ones through
+// var_environ(), so scratch assignments never reach them.
+struct ShellVar
+{
+    char *name;     // NULL for a free slot, `deleted` for a removed one
+    uint32_t hash;
+    char *value;    // NULL while declared but unset
+    size_t cap;     // bytes allocated for value, so reassignments in a loop reuse the buffer
+    int attrs;      // VAR_*
+    int64_t number; // VAR_INTEGER: the value itself, `value` is only its text
+    int stale;      // VAR_INTEGER: `value` lags behind `number`, formatted on the next read
+    VarArray *array; // VAR_ARRAY and VAR_ASSOC: the elements, `value` is unused
+};
+
+static ShellVar *var_table = NULL;
+static size_t table_cap = 0;  // always a power of two
+static size_t table_used = 0; // live and deleted slots; a probe only stops at a free one
+static size_t table_live = 0;
+static char deleted[] = "";
+
+static char **env_array = NULL; // the environment handed to children, see var_environ()
+static int env_dirty = 1;        // an exported variable changed since env_array was built
+
+// FNV-1a, the shared hash() drops the start of long names
+uint32_t var_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+    for (; *name; name++)
+    {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h;
+}
+
+static void table_grow(void)
+{
+    ShellVar *old = var_table;
+    size_t old_cap = table_cap;
+
+    // deleted slots are dropped on the way, so the new table can be the same size
+    table_cap = table_cap ? table_cap : VARS_SIZE;
+    while (table_live * 2 >= table_cap)
+    {
+        table_cap *= 2;
+    }
+    var_table = calloc(table_cap, sizeof(ShellVar));
+    if (!var_table)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    table_used = table_live;
+    for (size_t i = 0; i < old_cap; i++)
+    {
+        if (old[i].name == NULL || old[i].name == deleted)
+        {
+            continue;
+        }
+        size_t at = old[i].hash & (table_cap - 1);
+        while (var_table[at].name != NULL)
+        {
+            at = (at + 1) & (table_cap - 1);
+        }
+        var_table[at] = old[i];
+    }
+    free(old);
+}
+
+// Finds `name`. With `create` set a missing variable is added, unset and without attributes.
+static ShellVar *find_var(const char *name, int create)
+{
+    if (table_cap == 0)
+    {
+        if (!create)
+        {
+            return NULL;
+        }
+        table_grow();
+    }
+
+    uint32_t h = var_hash(name);
+    size_t at = h & (table_cap - 1);
+    ShellVar *free_slot = NULL;
+    for (; var_table[at].name != NULL; at = (at + 1) & (table_cap - 1))
+    {
+        ShellVar *var = &var_table[at];
+        if (var->name == deleted)
+        {
+            free_slot = free_slot ? free_slot : var;
+        }
+        else if (var->hash == h && strcmp(var->name, name) == 0)
+        {
+            return var;
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+
+    if (free_slot == NULL)
+    {
+        if ((table_used + 1) * 4 > table_cap * 3)
+        {
+            table_grow();
+            return find_var(name, create);
+        }
+        free_slot = &var_table[at];
+        table_used++;
+    }
+    *free_slot = (ShellVar){strdup(name), h, NULL, 0, 0, 0, 0, NULL};
+    table_live++;
+    return free_slot;
+}
+
+static void store_string(ShellVar *var, const char *value)
+{
+    size_t len = strlen(value);
+    if (len + 1 > var->cap)
+    {
+        var->cap = len + 1 > 32 ? len + 1 : 32;
+        free(var->value);
+        var->value = malloc(var->cap);
+        if (!var->value)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(var->value, value, len + 1);
+}
+
+static int readonly_error(const ShellVar *var)
+{
+    fprintf(stderr, "psh: %s: readonly variable\n", var->name);
+    return -1;
+}
+
+// Called after any change to a value or attribute
+static void var_changed(const ShellVar *var)
+{
+    if (var->attrs & VAR_EXPORTED)
+    {
+        env_dirty = 1;
+    }
+    if (strcmp(var->name, "PATH") == 0)
+    {
+        cmdhash_clear();
+    }
+}
+
+// Splits an element reference `name[subscript]` into its parts, both malloc'd. Returns NULL
+// when `ref` is not of that form.
+static char *split_element(const char *ref, char **subscript)
+{
+    const char *open = strchr(ref, '[');
+    size_t len = strlen(ref);
+    if (open == NULL || open == ref || ref[len - 1] != ']' || (!isalpha((unsigned char)*ref) && *ref != '_'))
+    {
+        return NULL;
+    }
+    for (const char *c = ref; c < open; c++)
+    {
+        if (!isalnum((unsigned char)*c) && *c != '_')
+        {
+            return NULL;
+        }
+    }
+    *subscript = strndup(open + 1, ref + len - 1 - open - 1);
+    return strndup(ref, open - ref);
+}
+
+// Turns a variable into an array, a scalar value becomes element 0
+static void make_array(ShellVar *var, int assoc)
+{
+    if (var->array != NULL)
+    {
+        return;
+    }
+    var->array = array_new(assoc);
+    const char *value = var_get(var->name);
+    if (value != NULL)
+    {
+        if (assoc)
+        {
+            array_set_key(var->array, "0", value);
+        }
+        else
+        {
+            array_set(var->array, 0, value);
+        }
+    }
+    free(var->value);
+    var->value = NULL;
+    var->cap = 0;
+    var->stale = 0;
+    var->attrs |= assoc ? VAR_ASSOC : VAR_ARRAY;
+}
+
+// The index an indexed array's subscript stands for: arithmetic, with negative values
+// counting back from the end. Returns -1 after reporting a bad subscript.
+static int element_index(const char *name, const char *subscript, int64_t *index)
+{
+    if (arith_eval(subscript, index) == -1)
+    {
+        return -1;
+    }
+    ShellVar *var = find_var(name, 0); // looked up after the expression, which may move the table
+    if (*index < 0 && var != NULL && var->array != NULL)
+    {
+        *index += array_next_index(var->array);
+    }
+    if (*index < 0)
+    {
+        fprintf(stderr, "psh: %s[%s]: bad array subscript\n", name, subscript);
+        return -1;
+    }
+    return 0;
+}
+
+// var_get() of `name[subscript]`. A scalar is its own element 0.
+static const char *element_get(const char *ref)
+{
+    char *subscript;
+    char *name = split_element(ref, &subscript);
+    const char *value = NULL;
+    int64_t index;
+    if (name == NULL)
+    {
+        return NULL;
+    }
+    ShellVar *var = find_var(name, 0);
+    if (var != NULL && (var->attrs & VAR_ASSOC))
+    {
+        value = array_get_key(var->array, subscript);
+    }
+    else if (var != NULL && element_index(name, subscript, &index) == 0)
+    {
+        var = find_var(name, 0);
+        if (var != NULL && var->array != NULL)
+        {
+            value = array_get(var->array, index);
+        }
+        else if (var != NULL && index == 0)
+        {
+            value = var_get(name);
+        }
+    }
+    free(name);
+    free(subscript);
+    return value;
+}
+
+// var_set() of `name[subscript]`, turning the variable into an array if needed
+static int element_set(const char *ref, const char *value)
+{
+    char *subscript;
+    char *name = split_element(ref, &subscript);
+    if (name == NULL)
+    {
+        fprintf(stderr, "psh: `%s': not a valid identifier\n", ref);
+        return -1;
+    }
+    ShellVar *var = find_var(name, 1);
+    int attrs = var->attrs;
+    int64_t index = 0, number;
+    char text[32];
+    int ret = -1;
+
+    if (attrs & VAR_READONLY)
+    {
+        readonly_error(var);
+    }
+    else if (!(attrs & VAR_ASSOC) && element_index(name, subscript, &index) == -1)
+    {
+        // reported
+    }
+    else if ((attrs & VAR_INTEGER) && arith_eval(value, &number) == -1)
+    {
+        // reported
+    }
+    else
+    {
+        if (attrs & VAR_INTEGER)
+        {
+            snprintf(text, sizeof(text), "%" PRId64, number);
+            value = text;
+        }
+        var = find_var(name, 1); // the expressions may have added variables and moved the table
+        make_array(var, attrs & VAR_ASSOC);
+        if (attrs & VAR_ASSOC)
+        {
+            array_set_key(var->array, subscript, value);
+            ret = 0;
+        }
+        else if (array_set(var->array, index, value) == -1)
+        {
+            fprintf(stderr, "psh: %s[%s]: array index too large\n", name, subscript);
+        }
+        else
+        {
+            ret = 0;
+        }
+        var_changed(var);
+    }
+    free(name);
+    free(subscript);
+    return ret;
+}
+
+// unset of `name[subscript]`; name[@] and name[*] remove the whole array
+static int element_unset(const char *ref)
+{
+    char *subscript;
+    char *name = split_element(ref, &subscript);
+    int64_t index;
+    int ret = 0;
+    if (name == NULL)
+    {
+        fprintf(stderr, "psh: unset: `%s': not a valid identifier\n", ref);
+        return -1;
+    }
+    ShellVar *var = find_var(name, 0);
+    if (var == NULL)
+    {
+        // nothing to remove
+    }
+    else if (strcmp(subscript, "@") == 0 || strcmp(subscript, "*") == 0)
+    {
+        ret = var_unset(name);
+    }
+    else if (var->attrs & VAR_READONLY)
+    {
+        ret = readonly_error(var);
+    }
+    else if (var->attrs & VAR_ASSOC)
+    {
+        array_unset_key(var->array, subscript);
+    }
+    else if (element_index(name, subscript, &index) == -1)
+    {
+        ret = -1;
+    }
+    else if ((var = find_var(name, 0))->array != NULL)
+    {
+        array_unset(var->array, index);
+    }
+    else if (index == 0)
+    {
+        ret = var_unset(name);
+    }
+    free(name);
+    free(subscript);
+    return ret;
+}
+
+// Imports the environment psh was started with as exported variables
+void var_init(char **envp)
+{
+    for (int i = 0; envp != NULL && envp[i] != NULL; i++)
+    {
+        char *eq = strchr(envp[i], '=');
+        if (eq == NULL)
+        {
+            continue;
+        }
+        char *name = strndup(envp[i], eq - envp[i]);
+        ShellVar *var = find_var(name, 1);
+        store_string(var, eq + 1);
+        var->attrs |= VAR_EXPORTED;
+        free(name);
+    }
+}
+
+// Value of a variable, NULL when unset
+const char *var_get(const char *name)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var == NULL)
+    {
+        // names never contain '[', so element references only cost a failed lookup
+        return strchr(name, '[') != NULL ? element_get(name) : NULL;
+    }
+    if (var->array != NULL)
+    {
+        // $arr is ${arr[0]}
+        return var->attrs & VAR_ASSOC ? array_get_key(var->array, "0") : array_get(var->array, 0);
+    }
+    if (var->stale)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%" PRId64, var->number);
+        store_string(var, buf);
+        var->stale = 0;
+    }
+    return var->value;
+}
+
+// Numeric value of an integer variable without going through its text. Returns -1 when
+// the variable is not an integer or is unset, the caller then parses var_get() instead.
+int var_get_number(const char *name, int64_t *out)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var == NULL || !(var->attrs & VAR_INTEGER) || (var->value == NULL && !var->stale))
+    {
+        return -1;
+    }
+    *out = var->number;
+    return 0;
+}
+
+// Assigns a variable. Returns -1 after reporting an error, e.g. when it is readonly.
+int var_set(const char *name, const char *value)
+{
+    if (strchr(name, '[') != NULL)
+    {
+        return element_set(name, value);
+    }
+    ShellVar *var = find_var(name, 1);
+    if (var->attrs & VAR_READONLY)
+    {
+        return readonly_error(var);
+    }
+    if (var->array != NULL)
+    {
+        // arr=x assigns ${arr[0]}
+        size_t len = strlen(name);
+        char *ref = malloc(len + 4);
+        if (!ref)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(ref, name, len);
+        strcpy(ref + len, "[0]");
+        int ret = element_set(ref, value);
+        free(ref);
+        return ret;
+    }
+    if (var->attrs & VAR_INTEGER)
+    {
+        // assigning to an integer variable evaluates the text, as in `declare -i n; n=n*2`
+        int64_t number;
+        if (arith_eval(value, &number) == -1)
+        {
+            return -1;
+        }
+        var = find_var(name, 1); // the expression may have added variables and moved the table
+        var->number = number;
+        var->stale = 1;
+    }
+    else
+    {
+        store_string(var, value);
+    }
+    var_changed(var);
+    return 0;
+}
+
+// Assigns the result of arithmetic. Integer variables just keep the number.
+int var_set_number(const char *name, int64_t value)
+{
+    char buf[32];
+    ShellVar *var = strchr(name, '[') == NULL ? find_var(name, 1) : NULL;
+    if (var == NULL || var->array != NULL)
+    {
+        // array elements only store text
+        snprintf(buf, sizeof(buf), "%" PRId64, value);
+        return var_set(name, buf);
+    }
+    if (var->attrs & VAR_READONLY)
+    {
+        return readonly_error(var);
+    }
+    if (var->attrs & VAR_INTEGER)
+    {
+        var->number = value;
+        var->stale = 1;
+    }
+    else
+    {
+        snprintf(buf, sizeof(buf), "%" PRId64, value);
+        store_string(var, buf);
+    }
+    var_changed(var);
+    return 0;
+}
+
+// NAME+=value: integers add the evaluated value, anything else appends the text
+int var_append(const char *name, const char *value)
+{
+    int64_t number, addend;
+    if (var_get_number(name, &number) == 0)
+    {
+        if (arith_eval(value, &addend) == -1)
+        {
+            return -1;
+        }
+        return var_set_number(name, (int64_t)((uint64_t)number + (uint64_t)addend));
+    }
+    const char *old = var_get(name);
+    if (old == NULL || *old == '\0')
+    {
+        return var_set(name, value);
+    }
+    size_t old_len = strlen(old);
+    char *joined = malloc(old_len + strlen(value) + 1);
+    if (!joined)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(joined, old, old_len);
+    strcpy(joined + old_len, value);
+    int ret = var_set(name, joined);
+    free(joined);
+    return ret;
+}
+
+// Marks a variable for export, creating it unset if needed
+void var_export(const char *name)
+{
+    var_declare(name, VAR_EXPORTED, 0);
+}
+
+// Frees a variable's contents and leaves a deleted slot behind
+static void drop_var(ShellVar *var)
+{
+    int path = strcmp(var->name, "PATH") == 0;
+    if (var->attrs & VAR_EXPORTED)
+    {
+        env_dirty = 1;
+    }
+    free(var->name);
+    free(var->value);
+    array_free(var->array);
+    *var = (ShellVar){deleted, 0, NULL, 0, 0, 0, 0, NULL};
+    table_live--;
+    if (path)
+    {
+        cmdhash_clear();
+    }
+}
+
+// Removes a variable with all its attributes, or one element for `name[subscript]`.
+// Returns -1 for readonly variables.
+int var_unset(const char *name)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var == NULL)
+    {
+        return strchr(name, '[') != NULL ? element_unset(name) : 0;
+    }
+    if (var->attrs & VAR_READONLY)
+    {
+        return readonly_error(var);
+    }
+    drop_var(var);
+    return 0;
+}
+
+// Moves a variable out of the table whole, attributes and elements included, for `local`.
+// Only the export attribute carries over to the unset variable left in its place.
+// `*saved` is NULL when there was no such variable. Returns -1 for readonly variables.
+int var_save(const char *name, ShellVar **saved)
+{
+    ShellVar *var = find_var(name, 0);
+    *saved = NULL;
+    if (var == NULL)
+    {
+        return 0;
+    }
+    if (var->attrs & VAR_READONLY)
+    {
+        return readonly_error(var);
+    }
+    *saved = malloc(sizeof(ShellVar));
+    if (!*saved)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    **saved = *var;
+    *var = (ShellVar){deleted, 0, NULL, 0, 0, 0, 0, NULL};
+    table_live--;
+    var_changed(*saved);
+    if ((*saved)->attrs & VAR_EXPORTED)
+    {
+        var_export(name); // as in bash, the new variable stays exported
+    }
+    return 0;
+}
+
+// Puts back a variable moved out by var_save(), replacing whatever `name` holds now,
+// readonly or not. A NULL `saved` just removes the current one.
+void var_restore(const char *name, ShellVar *saved)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var != NULL)
+    {
+        drop_var(var);
+    }
+    if (saved == NULL)
+    {
+        return;
+    }
+    var = find_var(name, 1);
+    free(var->name);
+    *var = *saved;
+    free(saved);
+    var_changed(var);
+}
+
+// Adds and removes VAR_* attributes, creating the variable unset if needed. A variable that
+// becomes an integer converts its current text, one that becomes an array keeps its value as
+// element 0. Readonly cannot be taken away and an array stays an array.
+int var_declare(const char *name, int set, int clear)
+{
+    ShellVar *var = find_var(name, 1);
+    if ((var->attrs & VAR_READONLY) && (clear & VAR_READONLY))
+    {
+        return readonly_error(var);
+    }
+    if (((set & VAR_ASSOC) && (var->attrs & VAR_ARRAY)) || ((set & VAR_ARRAY) && (var->attrs & VAR_ASSOC)))
+    {
+        fprintf(stderr, "psh: %s: cannot convert %s array\n", name,
+                var->attrs & VAR_ASSOC ? "associative to indexed" : "indexed to associative");
+        return -1;
+    }
+    if (set & (VAR_ARRAY | VAR_ASSOC))
+    {
+        make_array(var, set & VAR_ASSOC);
+    }
+    clear &= ~(VAR_ARRAY | VAR_ASSOC);
+    if ((set & VAR_INTEGER) && !(var->attrs & VAR_INTEGER) && var->value != NULL)
+    {
+        int64_t number;
+        char *text = strdup(var->value);
+        int ok = arith_eval(text, &number) == 0;
+        free(text);
+        var = find_var(name, 1); // the expression may have added variables and moved the table
+        if (ok)
+        {
+            var->number = number;
+            var->stale = 1;
+        }
+    }
+    if ((clear & VAR_INTEGER) && var->stale)
+    {
+        var_get(name); // the text has to be current before the number is dropped
+    }
+    if (var->attrs & VAR_EXPORTED)
+    {
+        env_dirty = 1; // unexported now, or its text is about to change
+    }
+    var->attrs = (var->attrs | set) & ~clear;
+    var_changed(var);
+    return 0;
+}
+
+int var_attrs(const char *name)
+{
+    ShellVar *var = find_var(name, 0);
+    return var != NULL ? var->attrs : 0;
+}
+
+// arr=(...): empties `name` into an array with no elements, associative if it was declared -A
+int var_array_clear(const char *name)
+{
+    ShellVar *var = find_var(name, 1);
+    if (var->attrs & VAR_READONLY)
+    {
+        return readonly_error(var);
+    }
+    int assoc = var->attrs & VAR_ASSOC;
+    array_free(var->array);
+    var->array = NULL;
+    free(var->value);
+    var->value = NULL;
+    var->cap = 0;
+    var->stale = 0;
+    make_array(var, assoc);
+    return 0;
+}
+
+// arr+=(x): adds `value` after the highest element of an indexed array
+int var_array_push(const char *name, const char *value)
+{
+    ShellVar *var = find_var(name, 1);
+    if (var->attrs & VAR_ASSOC)
+    {
+        fprintf(stderr, "psh: %s: %s: must use subscript when assigning associative array\n", name, value);
+        return -1;
+    }
+    make_array(var, 0);
+    char *ref = malloc(strlen(name) + 32);
+    if (!ref)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(ref, "%s[%" PRId64 "]", name, array_next_index(var->array));
+    int ret = element_set(ref, value);
+    free(ref);
+    return ret;
+}
+
+// ${arr[@]} and ${!arr[@]}: the values or subscripts of `name` in order, a scalar is a list
+// of one. The list is malloc'd (free_double_pointer), NULL when the variable is unset.
+char **var_array_list(const char *name, int keys)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var != NULL && var->array != NULL)
+    {
+        return array_list(var->array, keys);
+    }
+    const char *value = var != NULL ? var_get(name) : NULL;
+    if (value == NULL)
+    {
+        return NULL;
+    }
+    char **list = malloc(2 * sizeof(char *));
+    if (!list)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    list[0] = strdup(keys ? "0" : value);
+    list[1] = NULL;
+    return list;
+}
+
+// ${#arr[@]}: number of elements that are set
+size_t var_array_count(const char *name)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var != NULL && var->array != NULL)
+    {
+        return array_count(var->array);
+    }
+    return var != NULL && var_get(name) != NULL;
+}
+
+// The environment for a child: NAME=value of every exported variable that is set. The array
+// is only rebuilt after an exported variable changed, so running commands in a loop does not
+// copy the environment each time. It stays valid until the next change to an exported variable.
+char **var_environ(void)
+{
+    size_t n = 0;
+    if (!env_dirty)
+    {
+        return env_array;
+    }
+    if (env_array != NULL)
+    {
+        for (char **entry = env_array; *entry != NULL; entry++)
+        {
+            free(*entry);
+        }
+        free(env_array);
+    }
+    env_array = malloc((table_live + 1) * sizeof(char *));
+    if (!env_array)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < table_cap; i++)
+    {
+        ShellVar *var = &var_table[i];
+        if (var->name == NULL || var->name == deleted || !(var->attrs & VAR_EXPORTED) || var->array != NULL)
+        {
+            continue; // arrays have no form in the environment
+        }
+        const char *value = var_get(var->name);
+        if (value == NULL)
+        {
+            continue;
+        }
+        size_t name_len = strlen(var->name), value_len = strlen(value);
+        char *entry = malloc(name_len + value_len + 2);
+        if (!entry)
+        {
+            fprintf(stderr, "psh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(entry, var->name, name_len);
+        entry[name_len] = '=';
+        memcpy(entry + name_len + 1, value, value_len + 1);
+        env_array[n++] = entry;
+    }
+    env_array[n] = NULL;
+    env_dirty = 0;
+    return env_array;
+}
+
+// var_environ() with `VAR=x cmd` prefixes layered on top: each NAME=value in `prefix`
+// replaces the exported entry of the same name or is added. Only the returned array is
+// the caller's to free, the strings are borrowed from var_environ() and `prefix`.
+char **var_environ_with(char **prefix)
+{
+    char **base = var_environ();
+    size_t n_base = 0, n_prefix = 0, n = 0;
+    while (base[n_base] != NULL)
+    {
+        n_base++;
+    }
+    while (prefix[n_prefix] != NULL)
+    {
+        n_prefix++;
+    }
+    char **envp = malloc((n_base + n_prefix + 1) * sizeof(char *));
+    if (!envp)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n_base; i++)
+    {
+        size_t name_len = strchr(base[i], '=') - base[i] + 1;
+        size_t j = 0;
+        while (j < n_prefix && strncmp(base[i], prefix[j], name_len) != 0)
+        {
+            j++;
+        }
+        if (j == n_prefix)
+        {
+            envp[n++] = base[i];
+        }
+    }
+    for (size_t j = 0; j < n_prefix; j++)
+    {
+        // in `X=1 X=2 cmd` the last one wins
+        size_t name_len = strchr(prefix[j], '=') - prefix[j] + 1;
+        size_t k = j + 1;
+        while (k < n_prefix && strncmp(prefix[j], prefix[k], name_len) != 0)
+        {
+            k++;
+        }
+        if (k == n_prefix)
+        {
+            envp[n++] = prefix[j];
+        }
+    }
+    envp[n] = NULL;
+    return envp;
+}
+
+static void print_var(ShellVar *var)
+{
+    char flags[8];
+    int n = 0;
+    if (var->attrs & (VAR_ARRAY | VAR_ASSOC))
+    {
+        flags[n++] = var->attrs & VAR_ASSOC ? 'A' : 'a';
+    }
+    if (var->attrs & VAR_INTEGER)
+    {
+        flags[n++] = 'i';
+    }
+    if (var->attrs & VAR_READONLY)
+    {
+        flags[n++] = 'r';
+    }
+    if (var->attrs & VAR_EXPORTED)
+    {
+        flags[n++] = 'x';
+    }
+    if (n == 0)
+    {
+        flags[n++] = '-';
+    }
+    flags[n] = '\0';
+
+    printf("declare -%s %s", flags, var->name);
+    if (var->array != NULL)
+    {
+        char **keys = array_list(var->array, 1);
+        char **values = array_list(var->array, 0);
+        printf("=(");
+        for (int i = 0; keys[i] != NULL; i++)
+        {
+            printf("%s[%s]=\"%s\"", i > 0 ? " " : "", keys[i], values[i]);
+        }
+        printf(")\n");
+        free_double_pointer(keys);
+        free_double_pointer(values);
+        return;
+    }
+    const char *value = var_get(var->name);
+    if (value != NULL)
+    {
+        printf("=\"%s\"", value);
+    }
+    printf("\n");
+}
+
+// `declare -p name`: one variable with its attributes. Returns -1 when there is no such name.
+int var_print(const char *name)
+{
+    ShellVar *var = find_var(name, 0);
+    if (var == NULL)
+    {
+        return -1;
+    }
+    print_var(var);
+    return 0;
+}
+
+static int compare_vars(const void *a, const void *b)
+{
+    return strcmp((*(ShellVar *const *)a)->name, (*(ShellVar *const *)b)->name);
+}
+
+// Lists every variable that has all of `attrs`, sorted by name, for declare and export -p
+void var_print_all(int attrs)
+{
+    ShellVar **sorted = malloc((table_live + 1) * sizeof(ShellVar *));
+    size_t n = 0;
+    if (!sorted)
+    {
+        fprintf(stderr, "psh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < table_cap; i++)
+    {
+        ShellVar *var = &var_table[i];
+        if (var->name != NULL && var->name != deleted && (var->attrs & attrs) == attrs)
+        {
+            sorted[n++] = var;
+        }
+    }
+    qsort(sorted, n, sizeof(ShellVar *), compare_vars);
+    for (size_t i = 0; i < n; i++)
+    {
+        print_var(sorted[i]);
+    }
+    free(sorted);
+}